@@ -0,0 +1,297 @@
+#define ALLOC_INTERNAL   /* This file calls the real allocator */
+#include "alloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef MYMAT_ALLOC_PROFILE
+
+#define LIVE_TABLE_MIN 1024   /* Initial slots of the live block table; a power of two */
+
+/* Allocations made at one call site while running one command type */
+typedef struct alloc_site {
+    const char *file;
+    int line;
+    stats_command command;
+    unsigned long count;          /* Allocations, including reallocations */
+    unsigned long bytes;          /* Bytes requested by them */
+    unsigned long live_count;     /* Blocks not freed yet */
+    unsigned long live_bytes;
+} alloc_site;
+
+/* A block that has not been freed; pointer is NULL in empty slots */
+typedef struct live_block {
+    void *pointer;
+    size_t size;
+    int site;
+} live_block;
+
+static alloc_site sites[MAX_ALLOC_SITES];
+static int site_count = 0;
+static live_block *live = NULL;         /* Open-addressing table with linear probing */
+static size_t live_capacity = 0;
+static size_t live_count = 0;
+static unsigned long live_bytes = 0;
+static unsigned long peak_live_bytes = 0;
+static unsigned long untracked_frees = 0;
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t command_key;
+static pthread_once_t command_once = PTHREAD_ONCE_INIT;
+static char command_marks[STATS_COMMAND_COUNT];   /* Thread values point at these */
+
+/* Create the thread-specific key holding each thread's command type */
+static void create_command_key(void) {
+    pthread_key_create(&command_key, NULL);
+}
+
+/* Set the command type the calling thread's allocations are attributed to */
+void alloc_set_command(stats_command command) {
+    pthread_once(&command_once, create_command_key);
+    pthread_setspecific(command_key, &command_marks[command]);
+}
+
+/* Get the calling thread's command type */
+static stats_command current_command(void) {
+    char *mark;
+
+    pthread_once(&command_once, create_command_key);
+    mark = (char*)pthread_getspecific(command_key);
+    return mark ? (stats_command)(mark - command_marks) : STATS_OTHER;
+}
+
+/* Find or add the site of a call; once the table is full, the last slot (which has no
+ * file) pools the sites that do not fit */
+static int find_site(const char *file, int line, stats_command command) {
+    int i;
+
+    for (i = 0; i < site_count; i++) {
+        if (sites[i].line == line && sites[i].command == command && strcmp(sites[i].file, file) == 0) {
+            return i;
+        }
+    }
+    if (site_count == MAX_ALLOC_SITES - 1) return MAX_ALLOC_SITES - 1;
+    sites[site_count].file = file;
+    sites[site_count].line = line;
+    sites[site_count].command = command;
+    return site_count++;
+}
+
+/* Home slot of a pointer in the live table */
+static size_t live_slot(const void *pointer) {
+    size_t hash = (size_t)pointer >> 4;
+    hash ^= hash >> 17;
+    return (hash * 2654435761UL) & (live_capacity - 1);
+}
+
+/* Add a block to the live table, which must have a free slot */
+static void insert_live(void *pointer, size_t size, int site) {
+    size_t slot = live_slot(pointer);
+
+    while (live[slot].pointer) slot = (slot + 1) & (live_capacity - 1);
+    live[slot].pointer = pointer;
+    live[slot].size = size;
+    live[slot].site = site;
+    live_count++;
+}
+
+/* Double the live table once it is half full; on failure the old table is kept */
+static int grow_live(void) {
+    live_block *old = live;
+    size_t old_capacity = live_capacity, i;
+
+    if (live_count * 2 < live_capacity) return 1;
+    live_capacity = old_capacity ? old_capacity * 2 : LIVE_TABLE_MIN;
+    live = (live_block*)calloc(live_capacity, sizeof(live_block));
+    if (!live) {
+        live = old;
+        live_capacity = old_capacity;
+        return 0;
+    }
+    live_count = 0;
+    for (i = 0; i < old_capacity; i++) {
+        if (old[i].pointer) insert_live(old[i].pointer, old[i].size, old[i].site);
+    }
+    free(old);
+    return 1;
+}
+
+/* Record a new block for the calling site */
+static void record_allocation(void *pointer, size_t size, const char *file, int line) {
+    alloc_site *site;
+    int index;
+
+    pthread_mutex_lock(&alloc_lock);
+    index = find_site(file, line, current_command());
+    site = &sites[index];
+    site->count++;
+    site->bytes += size;
+    /* A block that cannot be recorded is freed later as untracked */
+    if (grow_live()) {
+        insert_live(pointer, size, index);
+        site->live_count++;
+        site->live_bytes += size;
+        live_bytes += size;
+        if (live_bytes > peak_live_bytes) peak_live_bytes = live_bytes;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+/* Remove a block from the live table into removed, returning 0 if it is not recorded */
+static int remove_live(void *pointer, live_block *removed) {
+    size_t slot, next, home;
+
+    if (!live_capacity) return 0;
+    slot = live_slot(pointer);
+    while (live[slot].pointer != pointer) {
+        if (!live[slot].pointer) return 0;
+        slot = (slot + 1) & (live_capacity - 1);
+    }
+
+    *removed = live[slot];
+    sites[live[slot].site].live_count--;
+    sites[live[slot].site].live_bytes -= live[slot].size;
+    live_bytes -= live[slot].size;
+    live_count--;
+
+    /* Shift later blocks of the probe run back so lookups never stop early */
+    next = slot;
+    for (;;) {
+        live[slot].pointer = NULL;
+        do {
+            next = (next + 1) & (live_capacity - 1);
+            if (!live[next].pointer) return 1;
+            home = live_slot(live[next].pointer);
+        } while (slot <= next ? slot < home && home <= next : slot < home || home <= next);
+        live[slot] = live[next];
+        slot = next;
+    }
+}
+
+/* Forget a block that is being freed, storing it in removed; returns 0 if it is untracked */
+static int record_free(void *pointer, live_block *removed) {
+    int tracked;
+
+    pthread_mutex_lock(&alloc_lock);
+    tracked = remove_live(pointer, removed);
+    if (!tracked) untracked_frees++;
+    pthread_mutex_unlock(&alloc_lock);
+    return tracked;
+}
+
+/* Record a removed block again, for a realloc that failed */
+static void restore_block(const live_block *block) {
+    pthread_mutex_lock(&alloc_lock);
+    if (grow_live()) {
+        insert_live(block->pointer, block->size, block->site);
+        sites[block->site].live_count++;
+        sites[block->site].live_bytes += block->size;
+        live_bytes += block->size;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+/* malloc with the block recorded for the call site */
+void* alloc_malloc(size_t size, const char *file, int line) {
+    void *pointer = malloc(size);
+    if (pointer) record_allocation(pointer, size, file, line);
+    return pointer;
+}
+
+/* calloc with the block recorded for the call site */
+void* alloc_calloc(size_t count, size_t size, const char *file, int line) {
+    void *pointer = calloc(count, size);
+    if (pointer) record_allocation(pointer, count * size, file, line);
+    return pointer;
+}
+
+/* realloc with the new block recorded for the call site; the old block is forgotten
+ * first, since its address may be handed out again as soon as realloc returns */
+void* alloc_realloc(void *pointer, size_t size, const char *file, int line) {
+    live_block old;
+    int tracked = pointer && record_free(pointer, &old);
+    void *resized = realloc(pointer, size);
+
+    if (!resized) {
+        if (tracked) restore_block(&old);
+        return NULL;
+    }
+    record_allocation(resized, size, file, line);
+    return resized;
+}
+
+/* free with the block removed from the live table */
+void alloc_free(void *pointer) {
+    live_block removed;
+
+    if (!pointer) return;
+    record_free(pointer, &removed);
+    free(pointer);
+}
+
+/* Order sites by bytes allocated, largest first */
+static int compare_sites(const void *left, const void *right) {
+    unsigned long a = ((const alloc_site*)left)->bytes, b = ((const alloc_site*)right)->bytes;
+    return (a < b) - (a > b);
+}
+
+/* Print the profile to standard error */
+static void dump_profile(void) {
+    static alloc_site sorted[MAX_ALLOC_SITES];   /* Live blocks keep indexing sites */
+    unsigned long count = 0, bytes = 0, leaked = 0, leaked_bytes = 0;
+    unsigned long command_count[STATS_COMMAND_COUNT], command_bytes[STATS_COMMAND_COUNT];
+    char location[64];
+    int entries = site_count, i;
+
+    pthread_mutex_lock(&alloc_lock);
+    memset(command_count, 0, sizeof(command_count));
+    memset(command_bytes, 0, sizeof(command_bytes));
+    memcpy(sorted, sites, site_count * sizeof(alloc_site));
+    if (sites[MAX_ALLOC_SITES - 1].count) sorted[entries++] = sites[MAX_ALLOC_SITES - 1];
+    qsort(sorted, entries, sizeof(alloc_site), compare_sites);
+
+    fprintf(stderr, "%-24s %-16s %10s %12s %8s %12s\n", "allocation site", "command",
+            "count", "bytes", "leaked", "leaked bytes");
+    for (i = 0; i < entries; i++) {
+        if (sorted[i].file) {
+            sprintf(location, "%.50s:%d", sorted[i].file, sorted[i].line);
+            command_count[sorted[i].command] += sorted[i].count;
+            command_bytes[sorted[i].command] += sorted[i].bytes;
+        }
+        fprintf(stderr, "%-24s %-16s %10lu %12lu %8lu %12lu\n",
+                sorted[i].file ? location : "(other sites)",
+                sorted[i].file ? stats_command_name(sorted[i].command) : "-",
+                sorted[i].count, sorted[i].bytes, sorted[i].live_count, sorted[i].live_bytes);
+        count += sorted[i].count;
+        bytes += sorted[i].bytes;
+        leaked += sorted[i].live_count;
+        leaked_bytes += sorted[i].live_bytes;
+    }
+
+    fprintf(stderr, "\n%-16s %10s %12s\n", "command", "count", "bytes");
+    for (i = 0; i < STATS_COMMAND_COUNT; i++) {
+        if (command_count[i]) {
+            fprintf(stderr, "%-16s %10lu %12lu\n", stats_command_name((stats_command)i),
+                    command_count[i], command_bytes[i]);
+        }
+    }
+    fprintf(stderr, "\nallocations: %lu (%lu bytes), peak live: %lu bytes, "
+            "leaked at exit: %lu blocks (%lu bytes)", count, bytes, peak_live_bytes, leaked, leaked_bytes);
+    if (untracked_frees) fprintf(stderr, ", untracked frees: %lu", untracked_frees);
+    fprintf(stderr, "\n");
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+/* Print the profile to standard error at exit */
+void alloc_report_at_exit(void) {
+    atexit(dump_profile);
+}
+
+#else
+
+/* Allocation profiling was compiled out */
+void alloc_report_at_exit(void) {
+}
+
+#endif /* MYMAT_ALLOC_PROFILE */
@@ -0,0 +1,71 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include "stats.h"
+
+#define MAX_ALLOC_SITES 512   /* Distinct (call site, command) pairs tracked; the rest are pooled */
+
+#ifdef MYMAT_ALLOC_PROFILE
+
+/* Route the allocator calls of a source file through the profiler. Include this header
+ * after <stdlib.h>, so the standard declarations are not rewritten. */
+#ifndef ALLOC_INTERNAL
+#define malloc(size) alloc_malloc((size), __FILE__, __LINE__)
+#define calloc(count, size) alloc_calloc((count), (size), __FILE__, __LINE__)
+#define realloc(pointer, size) alloc_realloc((pointer), (size), __FILE__, __LINE__)
+#define free(pointer) alloc_free(pointer)
+#endif
+
+/* Attributes the calling thread's following allocations to a command type */
+#define ALLOC_COMMAND(command) alloc_set_command(command)
+
+/**
+ * @brief Allocates memory like malloc and records it for the call site
+ * @param size Bytes to allocate
+ * @param file Source file of the call
+ * @param line Source line of the call
+ * @return The memory, or NULL if malloc failed
+ * @note Thread-safe; the bookkeeping is protected by one mutex
+ */
+void* alloc_malloc(size_t size, const char *file, int line);
+
+/**
+ * @brief Allocates zeroed memory like calloc and records it for the call site
+ * @return The memory, or NULL if calloc failed
+ */
+void* alloc_calloc(size_t count, size_t size, const char *file, int line);
+
+/**
+ * @brief Resizes memory like realloc; the new block is attributed to this call site
+ * @return The memory, or NULL if realloc failed (the old block stays recorded)
+ */
+void* alloc_realloc(void *pointer, size_t size, const char *file, int line);
+
+/**
+ * @brief Frees memory like free and removes it from the live blocks
+ * @param pointer Block to free; blocks allocated elsewhere are freed and counted as untracked
+ */
+void alloc_free(void *pointer);
+
+/**
+ * @brief Sets the command type the calling thread's allocations are attributed to
+ * @param command Command type; threads start with STATS_OTHER
+ */
+void alloc_set_command(stats_command command);
+
+#else
+
+#define ALLOC_COMMAND(command) ((void)0)
+
+#endif /* MYMAT_ALLOC_PROFILE */
+
+/**
+ * @brief Arranges for the allocation profile to be printed to standard error at exit
+ * @note Reports count and bytes per call site and command, peak live bytes, and the
+ *       blocks still live at exit as leaks. Does nothing when the program was built
+ *       without MYMAT_ALLOC_PROFILE.
+ */
+void alloc_report_at_exit(void);
+
+#endif /* ALLOC_H */
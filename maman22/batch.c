@@ -0,0 +1,234 @@
+#include "batch.h"
+#include "commands.h"
+#include "output.h"
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* One script of the batch and its result */
+typedef struct batch_job {
+    char *path;                   /* Script file (owned) */
+    double elapsed_ms;            /* Wall time of the script */
+    int failed;                   /* The script or its output file could not be opened */
+} batch_job;
+
+/* Jobs shared by the workers */
+typedef struct batch_state {
+    batch_job *jobs;
+    int count;
+    int capacity;
+    int next;                     /* Index of the next job to claim, advanced atomically */
+} batch_state;
+
+static int jobs_per_worker = 1;
+
+/* Set how many scripts a batch needs per worker thread */
+int set_batch_jobs_per_worker(int jobs) {
+    if (jobs < 1 || jobs > MAX_JOBS_PER_WORKER) return 0;
+    jobs_per_worker = jobs;
+    return 1;
+}
+
+/* Get how many scripts a batch needs per worker thread */
+int get_batch_jobs_per_worker(void) {
+    return jobs_per_worker;
+}
+
+/* Current monotonic time in milliseconds */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Add a script to the batch */
+static int add_job(batch_state *batch, const char *path) {
+    batch_job *grown;
+
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        grown = (batch_job*)realloc(batch->jobs, batch->capacity * sizeof(batch_job));
+        if (!grown) {
+            out_printf("Error: Memory allocation failed for batch\n");
+            return 0;
+        }
+        batch->jobs = grown;
+    }
+
+    batch->jobs[batch->count].path = (char*)malloc(strlen(path) + 1);
+    if (!batch->jobs[batch->count].path) {
+        out_printf("Error: Memory allocation failed for batch\n");
+        return 0;
+    }
+    strcpy(batch->jobs[batch->count].path, path);
+    batch->jobs[batch->count].elapsed_ms = 0;
+    batch->jobs[batch->count].failed = 0;
+    batch->count++;
+    return 1;
+}
+
+/* Order jobs by path */
+static int compare_jobs(const void *left, const void *right) {
+    return strcmp(((const batch_job*)left)->path, ((const batch_job*)right)->path);
+}
+
+/* Check whether a name ends with the output file suffix */
+static int is_output_file(const char *name) {
+    size_t length = strlen(name), suffix = strlen(BATCH_OUTPUT_SUFFIX);
+    return length >= suffix && strcmp(name + length - suffix, BATCH_OUTPUT_SUFFIX) == 0;
+}
+
+/* Add every script in a directory, in name order */
+static int add_directory(batch_state *batch, const char *directory) {
+    struct dirent *entry;
+    struct stat info;
+    char *path;
+    DIR *dir;
+    int first = batch->count, ok = 1;
+
+    dir = opendir(directory);
+    if (!dir) {
+        out_printf("Error: Cannot read directory '%s'\n", directory);
+        return 0;
+    }
+
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (is_output_file(entry->d_name)) continue;
+
+        path = (char*)malloc(strlen(directory) + strlen(entry->d_name) + 2);
+        if (!path) {
+            out_printf("Error: Memory allocation failed for batch\n");
+            ok = 0;
+            break;
+        }
+        sprintf(path, "%s/%s", directory, entry->d_name);
+        if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+            ok = add_job(batch, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+
+    qsort(batch->jobs + first, batch->count - first, sizeof(batch_job), compare_jobs);
+    return ok;
+}
+
+/* Run one script with fresh registers, writing its output next to it */
+static void run_job(batch_job *job) {
+    mat matrices[MAT_COUNT];
+    FILE *input, *output;
+    char *output_path;
+    double start = now_ms();
+    int i;
+
+    output_path = (char*)malloc(strlen(job->path) + strlen(BATCH_OUTPUT_SUFFIX) + 1);
+    input = fopen(job->path, "r");
+    output = NULL;
+    if (input && output_path) {
+        sprintf(output_path, "%s%s", job->path, BATCH_OUTPUT_SUFFIX);
+        output = fopen(output_path, "w");
+    }
+    if (!input || !output) {
+        fprintf(stderr, "Error: Cannot run script '%s'\n", job->path);
+        job->failed = 1;
+    } else {
+        for (i = 0; i < MAT_COUNT; i++) {
+            matrices[i] = initialize_mat();
+        }
+        configure_output_buffer(output);
+        set_output_stream(output);
+        set_output_mode(OUTPUT_TEXT);
+        process_stream(input, matrices);
+        set_output_stream(stdout);
+    }
+
+    if (input) fclose(input);
+    if (output && fclose(output) != 0) {
+        fprintf(stderr, "Error: Writing the output of '%s' failed\n", job->path);
+        job->failed = 1;
+    }
+    free(output_path);
+    job->elapsed_ms = now_ms() - start;
+}
+
+/* Worker thread: claim and run jobs until none are left */
+static void* batch_worker(void *arg) {
+    batch_state *batch = (batch_state*)arg;
+    int index;
+
+    while ((index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        run_job(&batch->jobs[index]);
+    }
+    return NULL;
+}
+
+/* Write the wall time of every script and the totals to standard error */
+static void print_summary(const batch_state *batch, double elapsed_ms, int worker_count) {
+    double total_ms = 0;
+    int i, failed = 0;
+
+    for (i = 0; i < batch->count; i++) {
+        fprintf(stderr, "%10.3f ms  %s%s\n", batch->jobs[i].elapsed_ms, batch->jobs[i].path,
+                batch->jobs[i].failed ? "  (failed)" : "");
+        total_ms += batch->jobs[i].elapsed_ms;
+        failed += batch->jobs[i].failed;
+    }
+    fprintf(stderr, "%d scripts (%d failed) in %.3f ms on %d workers, %.3f ms per script\n",
+            batch->count, failed, elapsed_ms, worker_count,
+            batch->count ? total_ms / batch->count : 0.0);
+}
+
+/* Run all scripts of a batch concurrently */
+int run_batch(char **paths, int path_count, int worker_count) {
+    pthread_t workers[MAX_WORKER_COUNT];
+    batch_state batch;
+    struct stat info;
+    double start;
+    int i, started, ok = 1;
+
+    if (!paths || worker_count < 1 || worker_count > MAX_WORKER_COUNT) {
+        out_printf("Error: Invalid parameters for run_batch\n");
+        return 0;
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    for (i = 0; i < path_count && ok; i++) {
+        if (stat(paths[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+            ok = add_directory(&batch, paths[i]);
+        } else {
+            ok = add_job(&batch, paths[i]);
+        }
+    }
+
+    start = now_ms();
+    /* Starting a thread only pays off with enough scripts to run on it */
+    if (worker_count > (batch.count + jobs_per_worker - 1) / jobs_per_worker) {
+        worker_count = (batch.count + jobs_per_worker - 1) / jobs_per_worker;
+    }
+    for (started = 0; ok && worker_count > 1 && started < worker_count; started++) {
+        if (pthread_create(&workers[started], NULL, batch_worker, &batch) != 0) break;
+    }
+    /* A batch for one worker, or jobs left over if no thread could be started, run on
+     * this thread */
+    if (ok && started == 0) {
+        batch_worker(&batch);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    if (ok) {
+        print_summary(&batch, now_ms() - start, started ? started : 1);
+    }
+    for (i = 0; i < batch.count; i++) {
+        ok = ok && !batch.jobs[i].failed;
+        free(batch.jobs[i].path);
+    }
+    free(batch.jobs);
+    return ok;
+}
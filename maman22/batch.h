@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#define BATCH_OUTPUT_SUFFIX ".out"   /* Appended to a script's path to name its output file */
+#define MAX_JOBS_PER_WORKER 256      /* Upper bound for set_batch_jobs_per_worker */
+
+/**
+ * @brief Sets how many scripts a batch needs for each worker thread it starts
+ * @param jobs Scripts per worker (1 to MAX_JOBS_PER_WORKER); the default 1 starts up to
+ *        one worker per script
+ * @return 1 on success, 0 for a value out of range (the setting is unchanged)
+ * @note A batch that warrants only one worker runs on the calling thread
+ */
+int set_batch_jobs_per_worker(int jobs);
+
+/**
+ * @brief Gets the number of scripts a batch needs for each worker thread
+ * @return The value set with set_batch_jobs_per_worker
+ */
+int get_batch_jobs_per_worker(void);
+
+/**
+ * @brief Runs many independent script files concurrently on a pool of worker threads
+ * @param paths Script files and directories; every regular file directly inside a
+ *        directory is a script, except output files ending in BATCH_OUTPUT_SUFFIX
+ * @param path_count Number of entries in paths
+ * @param worker_count Number of worker threads (1 to MAX_WORKER_COUNT)
+ * @return 1 if every script could be run, 0 if any could not be opened
+ * @note Each script runs with its own MAT_A through MAT_F, macros and output mode and
+ *       writes its output to its path followed by BATCH_OUTPUT_SUFFIX
+ * @note The shared registers SHR_A through SHR_F are shared by all scripts, as they are
+ *       by server sessions
+ * @note A summary with the wall time of every script is written to standard error
+ */
+int run_batch(char **paths, int path_count, int worker_count);
+
+#endif /* BATCH_H */
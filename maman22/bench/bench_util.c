@@ -0,0 +1,113 @@
+#define _GNU_SOURCE   /* sched_setaffinity and CPU_SET */
+#include "bench_util.h"
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+
+/* Read the monotonic clock in nanoseconds */
+double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Pin to a single CPU to reduce scheduling noise */
+int bench_pin_cpu(int cpu) {
+    cpu_set_t set;
+
+    if (cpu < 0) return 1;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "Warning: Could not pin to CPU %d\n", cpu);
+        return 0;
+    }
+    return 1;
+}
+
+/* qsort comparator for doubles */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Summarize samples */
+void bench_summarize(double *samples, int count, bench_stats *stats) {
+    double sum = 0;
+    int i;
+
+    stats->samples = count;
+    if (count <= 0) {
+        stats->median = stats->p99 = stats->min = stats->mean = 0;
+        return;
+    }
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+    for (i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    stats->median = samples[count / 2];
+    stats->p99 = samples[(int)(0.99 * (count - 1) + 0.5)];
+    stats->min = samples[0];
+    stats->mean = sum / count;
+}
+
+/* Start a JSON results file */
+int bench_report_open(bench_report *report, const char *path, const char *suite,
+                      const char *commit, int cpu) {
+    report->entries = 0;
+    report->json = NULL;
+    bench_print_header(suite);
+    if (!path) return 1;
+
+    report->json = fopen(path, "w");
+    if (!report->json) {
+        perror(path);
+        return 0;
+    }
+
+    fprintf(report->json, "{\n  \"suite\": \"%s\",\n  \"commit\": \"%s\",\n  \"cpu\": %d,\n"
+            "  \"timestamp\": %ld,\n  \"results\": [", suite, commit ? commit : "", cpu,
+            (long)time(NULL));
+    return 1;
+}
+
+/* Print the table header */
+void bench_print_header(const char *suite) {
+    printf("%-34s %14s %14s %14s %10s\n", suite, "median", "p99", "min", "iters");
+}
+
+/* Print one table row */
+void bench_print_row(const char *name, const char *unit, const bench_stats *stats, long iterations) {
+    printf("%-34s %14.2f %14.2f %14.2f %10ld  %s\n", name, stats->median, stats->p99,
+           stats->min, iterations, unit);
+}
+
+/* Write one result to the JSON file */
+void bench_report_write(bench_report *report, const char *name, const char *unit,
+                        const bench_stats *stats, long iterations) {
+    if (!report || !report->json) return;
+
+    fprintf(report->json, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"median\": %.6g, "
+            "\"p99\": %.6g, \"min\": %.6g, \"mean\": %.6g, \"samples\": %d, \"iterations\": %ld}",
+            report->entries ? "," : "", name, unit, stats->median, stats->p99, stats->min,
+            stats->mean, stats->samples, iterations);
+    report->entries++;
+}
+
+/* Print and record one result */
+void bench_report_add(bench_report *report, const char *name, const char *unit,
+                      const bench_stats *stats, long iterations) {
+    bench_print_row(name, unit, stats, iterations);
+    bench_report_write(report, name, unit, stats, iterations);
+}
+
+/* Finish the JSON results file */
+void bench_report_close(bench_report *report) {
+    if (!report->json) return;
+
+    fprintf(report->json, "\n  ]\n}\n");
+    fclose(report->json);
+    report->json = NULL;
+}
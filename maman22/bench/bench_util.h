@@ -0,0 +1,99 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>
+
+#define BENCH_MAX_SAMPLES 1000   /* Upper bound on timed samples per benchmark */
+
+/* Summary statistics of a set of timing samples */
+typedef struct bench_stats {
+    double median;
+    double p99;
+    double min;
+    double mean;
+    int samples;
+} bench_stats;
+
+/* Structure for a JSON results file being written */
+typedef struct bench_report {
+    FILE *json;
+    int entries;              /* Results written so far */
+} bench_report;
+
+/**
+ * @brief Reads the monotonic clock
+ * @return Current time in nanoseconds
+ */
+double bench_now_ns(void);
+
+/**
+ * @brief Pins the calling thread (and children created afterwards) to one CPU
+ * @param cpu CPU number, or -1 to leave the affinity unchanged
+ * @return 1 on success, 0 if the affinity could not be set
+ */
+int bench_pin_cpu(int cpu);
+
+/**
+ * @brief Computes median, 99th percentile, minimum and mean of the samples
+ * @param samples Sample values (sorted in place)
+ * @param count Number of samples
+ * @param stats Output statistics
+ */
+void bench_summarize(double *samples, int count, bench_stats *stats);
+
+/**
+ * @brief Starts a JSON results file and prints the table header
+ * @param report Report to initialize
+ * @param path Output file path, or NULL to only print results
+ * @param suite Name of the benchmark suite
+ * @param commit Commit identifier recorded with the results (may be empty)
+ * @param cpu CPU the benchmark was pinned to, -1 if not pinned
+ * @return 1 on success, 0 if the file could not be created
+ */
+int bench_report_open(bench_report *report, const char *path, const char *suite,
+                      const char *commit, int cpu);
+
+/**
+ * @brief Prints the header of a results table
+ * @param suite Name of the benchmark suite
+ */
+void bench_print_header(const char *suite);
+
+/**
+ * @brief Prints one result as a table row
+ * @param name Row label
+ * @param unit Unit of the statistics
+ * @param stats Summary statistics
+ * @param iterations Operations per sample
+ */
+void bench_print_row(const char *name, const char *unit, const bench_stats *stats, long iterations);
+
+/**
+ * @brief Writes one result to the JSON report without printing it
+ * @param report Open report (ignored if NULL or not open)
+ * @param name Benchmark name
+ * @param unit Unit of the statistics
+ * @param stats Summary statistics
+ * @param iterations Operations per sample
+ */
+void bench_report_write(bench_report *report, const char *name, const char *unit,
+                        const bench_stats *stats, long iterations);
+
+/**
+ * @brief Adds one result to the report and prints it as a table row
+ * @param report Open report, or NULL to only print
+ * @param name Benchmark name
+ * @param unit Unit of the statistics (for example "ns/op" or "lines/s")
+ * @param stats Summary statistics
+ * @param iterations Operations per sample
+ */
+void bench_report_add(bench_report *report, const char *name, const char *unit,
+                      const bench_stats *stats, long iterations);
+
+/**
+ * @brief Finishes and closes the JSON results file
+ * @param report Report to close
+ */
+void bench_report_close(bench_report *report);
+
+#endif /* BENCH_UTIL_H */
@@ -0,0 +1,240 @@
+/*
+ * End-to-end throughput benchmark for the matrix calculator
+ * Generates deterministic command scripts with different operation mixes,
+ * runs mainmat on each of them with output discarded and reports the time
+ * per input line (and lines per second) over several runs. Each script is also
+ * recorded once with --record and timed with --replay, which executes the same
+ * commands without any text parsing.
+ *
+ * Usage: e2e_bench [--mainmat PATH] [--lines N] [--runs N] [--cpu N]
+ *                  [--json PATH] [--commit ID]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench_util.h"
+
+#define DEFAULT_LINES 200000
+#define DEFAULT_RUNS 7
+#define WARMUP_RUNS 1
+#define REPEAT_BODY_LINES 100   /* Lines in the body of the "repeat" mix */
+
+/* Operation kinds, in the order of the weights in script_mix */
+enum { MIX_READ, MIX_PRINT, MIX_ADD, MIX_SUB, MIX_MUL, MIX_SCALAR, MIX_TRANS, MIX_KINDS };
+
+/* Structure describing a generated workload */
+typedef struct script_mix {
+    const char *name;
+    int weights[MIX_KINDS];   /* Relative frequency of each operation kind */
+    int use_repeat;           /* Wrap a REPEAT_BODY_LINES body in a repeat block */
+} script_mix;
+
+static const script_mix MIXES[] = {
+    { "arith",  {  0,  0, 25, 15, 25, 20, 15 }, 0 },
+    { "print",  {  5, 70,  5,  5,  5,  5,  5 }, 0 },
+    { "read",   { 80,  5,  3,  3,  3,  3,  3 }, 0 },
+    { "mixed",  { 15, 15, 15, 15, 15, 15, 10 }, 0 },
+    { "repeat", { 15, 15, 15, 15, 15, 15, 10 }, 1 }
+};
+
+static unsigned long rng_state;
+
+/* Deterministic pseudo-random number in [0, limit) */
+static int next_random(int limit) {
+    rng_state = (rng_state * 1103515245UL + 12345UL) & 0x7fffffffUL;
+    return (int)((rng_state >> 8) % (unsigned long)limit);
+}
+
+/* Deterministic value in [-range, range] with three decimals */
+static double next_value(double range) {
+    return (next_random(2000001) - 1000000) / 1000000.0 * range;
+}
+
+/* Write one generated command; sources are MAT_A/MAT_B so values stay bounded */
+static void write_command(FILE *out, const script_mix *mix) {
+    static const char *sources[] = { "MAT_A", "MAT_B" };
+    static const char *targets[] = { "MAT_C", "MAT_D", "MAT_E", "MAT_F" };
+    static const char *all[] = { "MAT_A", "MAT_B", "MAT_C", "MAT_D", "MAT_E", "MAT_F" };
+    int total = 0, pick, kind, i;
+
+    for (kind = 0; kind < MIX_KINDS; kind++) total += mix->weights[kind];
+    pick = next_random(total);
+    for (kind = 0; pick >= mix->weights[kind]; kind++) pick -= mix->weights[kind];
+
+    switch (kind) {
+        case MIX_READ:
+            fprintf(out, "read_mat %s", sources[next_random(2)]);
+            for (i = 0; i < 16; i++) fprintf(out, ", %.3f", next_value(10));
+            fprintf(out, "\n");
+            break;
+        case MIX_PRINT:
+            fprintf(out, "print_mat %s\n", all[next_random(6)]);
+            break;
+        case MIX_ADD:
+        case MIX_SUB:
+        case MIX_MUL:
+            fprintf(out, "%s %s, %s, %s\n",
+                    kind == MIX_ADD ? "add_mat" : kind == MIX_SUB ? "sub_mat" : "mul_mat",
+                    sources[next_random(2)], sources[next_random(2)], targets[next_random(4)]);
+            break;
+        case MIX_SCALAR:
+            fprintf(out, "mul_scalar %s, %.3f, %s\n", sources[next_random(2)], next_value(2),
+                    targets[next_random(4)]);
+            break;
+        default:
+            fprintf(out, "trans_mat %s, %s\n", sources[next_random(2)], targets[next_random(4)]);
+            break;
+    }
+}
+
+/* Generate a script into a temporary file and return its path */
+static int generate_script(const script_mix *mix, long lines, char *path) {
+    FILE *out;
+    long i, body;
+    int fd, j;
+
+    strcpy(path, "/tmp/mainmat_e2e_XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0 || !(out = fdopen(fd, "w"))) {
+        perror("mkstemp");
+        return 0;
+    }
+
+    rng_state = 12345;
+    fprintf(out, "read_mat MAT_A");
+    for (j = 0; j < 16; j++) fprintf(out, ", %.3f", next_value(10));
+    fprintf(out, "\nread_mat MAT_B");
+    for (j = 0; j < 16; j++) fprintf(out, ", %.3f", next_value(10));
+    fprintf(out, "\n");
+
+    if (mix->use_repeat) {
+        /* Same command count as the unrolled mixes, parsed once */
+        body = REPEAT_BODY_LINES;
+        fprintf(out, "repeat %ld {\n", lines / body);
+        for (i = 0; i < body; i++) write_command(out, mix);
+        fprintf(out, "}\n");
+    } else {
+        for (i = 0; i < lines; i++) write_command(out, mix);
+    }
+
+    fprintf(out, "stop\n");
+    fclose(out);
+    return 1;
+}
+
+/* Run mainmat once with the given options and input and return the wall time in nanoseconds */
+static double run_once(const char *mainmat, const char *option, const char *option_file,
+                       const char *input) {
+    double start;
+    pid_t pid;
+    int status, in, out;
+
+    start = bench_now_ns();
+    pid = fork();
+    if (pid == 0) {
+        in = open(input, O_RDONLY);
+        out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        execl(mainmat, mainmat, option, option_file, (char*)NULL);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: Running %s failed\n", mainmat);
+        return -1;
+    }
+    return bench_now_ns() - start;
+}
+
+/* Time runs of mainmat after warmup, storing nanoseconds per line; return 0 on failure */
+static int time_runs(const char *mainmat, const char *option, const char *option_file,
+                     const char *input, long lines, int runs, double *times) {
+    double elapsed;
+    int i;
+
+    for (i = 0; i < WARMUP_RUNS + runs; i++) {
+        elapsed = run_once(mainmat, option, option_file, input);
+        if (elapsed < 0) return 0;
+        if (i >= WARMUP_RUNS) times[i - WARMUP_RUNS] = elapsed / lines;
+    }
+    return 1;
+}
+
+/* Print a row with its rate and write it to the report under its bare name */
+static void report_mix(bench_report *report, const char *name, double *times, int runs, long lines) {
+    bench_stats stats;
+    char label[64];
+
+    bench_summarize(times, runs, &stats);
+    sprintf(label, "%s (%.0f lines/s)", name, 1e9 / stats.median);
+    bench_print_row(label, "ns/line", &stats, lines);
+    /* The JSON name is the bare mix name so results can be matched across commits */
+    bench_report_write(report, name, "ns/line", &stats, lines);
+}
+
+int main(int argc, char *argv[]) {
+    double times[BENCH_MAX_SAMPLES];
+    char script[64], trace[80], name[64];
+    const char *mainmat = "./mainmat", *json_path = NULL, *commit = "";
+    bench_report report;
+    long lines = DEFAULT_LINES;
+    int runs = DEFAULT_RUNS, cpu = 0;
+    int i, m, failed = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mainmat") == 0 && i + 1 < argc) {
+            mainmat = argv[++i];
+        } else if (strcmp(argv[i], "--lines") == 0 && i + 1 < argc) {
+            lines = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--commit") == 0 && i + 1 < argc) {
+            commit = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--mainmat PATH] [--lines N] [--runs N] [--cpu N] "
+                    "[--json PATH] [--commit ID]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (lines < REPEAT_BODY_LINES || runs < 1 || runs > BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "Error: Need at least %d lines and 1 to %d runs\n",
+                REPEAT_BODY_LINES, BENCH_MAX_SAMPLES);
+        return 1;
+    }
+
+    /* Children inherit the affinity */
+    bench_pin_cpu(cpu);
+
+    if (!bench_report_open(&report, json_path, "e2e", commit, cpu)) return 1;
+
+    for (m = 0; m < (int)(sizeof(MIXES) / sizeof(MIXES[0])) && !failed; m++) {
+        if (!generate_script(&MIXES[m], lines, script)) return 1;
+        sprintf(trace, "%s.rec", script);
+
+        failed = !time_runs(mainmat, NULL, NULL, script, lines, runs, times);
+        if (!failed) {
+            report_mix(&report, MIXES[m].name, times, runs, lines);
+            /* The recorded run's output is discarded like every timed run */
+            failed = run_once(mainmat, "--record", trace, script) < 0 ||
+                     !time_runs(mainmat, "--replay", trace, "/dev/null", lines, runs, times);
+        }
+        if (!failed) {
+            sprintf(name, "%s replay", MIXES[m].name);
+            report_mix(&report, name, times, runs, lines);
+        }
+        unlink(script);
+        unlink(trace);
+    }
+
+    bench_report_close(&report);
+    return failed;
+}
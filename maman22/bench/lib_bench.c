@@ -0,0 +1,251 @@
+/*
+ * In-process library calls against the pipe-to-process path
+ * Every operation stores two operands, multiplies them and gets the product back.
+ * In process this is mymat_set_values, mymat_mul and a copy of the result, either one
+ * call at a time or through mymat_mul_batch. Through a pipe it is two read_mat lines,
+ * a mul_mat and a print_mat written to a running mainmat, with the printed product
+ * read back; commands are streamed by a writer thread while the output is drained, so
+ * the pipe rows measure throughput, not round-trip latency.
+ *
+ * Usage: lib_bench [--mainmat PATH] [--ops N] [--runs N] [--cpu N]
+ *                  [--json PATH] [--commit ID]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include "bench_util.h"
+#include "../libmymat.h"
+
+#define DEFAULT_OPS 20000
+#define DEFAULT_RUNS 7
+#define WARMUP_RUNS 1
+
+/* Operands of every operation, row by row */
+typedef struct operation_inputs {
+    double *left;             /* 16 values per operation */
+    double *right;
+    long count;
+} operation_inputs;
+
+/* Commands streamed into a mainmat process */
+typedef struct pipe_writer {
+    const operation_inputs *inputs;
+    int fd;
+} pipe_writer;
+
+/* Fill the operands with deterministic values that keep every product finite */
+static int make_inputs(operation_inputs *inputs, long count) {
+    long i;
+
+    inputs->left = (double*)malloc(count * 16 * sizeof(double));
+    inputs->right = (double*)malloc(count * 16 * sizeof(double));
+    inputs->count = count;
+    if (!inputs->left || !inputs->right) {
+        fprintf(stderr, "Error: Memory allocation failed for inputs\n");
+        return 0;
+    }
+    for (i = 0; i < count * 16; i++) {
+        inputs->left[i] = (i % 37) * 0.25 - 4;
+        inputs->right[i] = (i % 23) * 0.5 - 5;
+    }
+    return 1;
+}
+
+/* Time one operation at a time through the library, returning nanoseconds per operation */
+static double run_library_calls(const operation_inputs *inputs, mymat_matrix *products) {
+    mymat_matrix left, right, product;
+    double start = bench_now_ns();
+    long i;
+
+    mymat_zero(&left);
+    mymat_zero(&right);
+    for (i = 0; i < inputs->count; i++) {
+        if (mymat_set_values(&left, inputs->left + i * 16, 16) != MYMAT_OK ||
+            mymat_set_values(&right, inputs->right + i * 16, 16) != MYMAT_OK ||
+            mymat_mul(&left, &right, &product) != MYMAT_OK) {
+            fprintf(stderr, "Error: Library call failed at operation %ld\n", i);
+            return -1;
+        }
+        products[i] = product;
+    }
+    return (bench_now_ns() - start) / inputs->count;
+}
+
+/* Time the batch entry point over caller-owned arrays, returning nanoseconds per operation */
+static double run_library_batch(const operation_inputs *inputs, mymat_matrix *lefts,
+                                mymat_matrix *rights, mymat_matrix *products) {
+    double start = bench_now_ns();
+    size_t done;
+    long i;
+
+    for (i = 0; i < inputs->count; i++) {
+        mymat_set_values(&lefts[i], inputs->left + i * 16, 16);
+        mymat_set_values(&rights[i], inputs->right + i * 16, 16);
+    }
+    if (mymat_mul_batch(lefts, rights, products, inputs->count, &done) != MYMAT_OK) {
+        fprintf(stderr, "Error: Batch call failed at operation %lu\n", (unsigned long)done);
+        return -1;
+    }
+    return (bench_now_ns() - start) / inputs->count;
+}
+
+/* Write one matrix as a read_mat command */
+static void write_read_mat(FILE *out, const char *name, const double *values) {
+    int j;
+
+    fprintf(out, "read_mat %s", name);
+    for (j = 0; j < 16; j++) fprintf(out, ", %.17g", values[j]);
+    fprintf(out, "\n");
+}
+
+/* Writer thread: format every operation as commands into the pipe */
+static void* write_commands(void *arg) {
+    pipe_writer *writer = (pipe_writer*)arg;
+    FILE *out = fdopen(writer->fd, "w");
+    long i;
+
+    if (!out) {
+        close(writer->fd);
+        return NULL;
+    }
+    for (i = 0; i < writer->inputs->count; i++) {
+        write_read_mat(out, "MAT_A", writer->inputs->left + i * 16);
+        write_read_mat(out, "MAT_B", writer->inputs->right + i * 16);
+        fprintf(out, "mul_mat MAT_A, MAT_B, MAT_C\nprint_mat MAT_C\n");
+    }
+    fprintf(out, "stop\n");
+    fclose(out);
+    return NULL;
+}
+
+/* Time the operations through a mainmat process, returning nanoseconds per operation */
+static double run_through_pipe(const char *mainmat, const operation_inputs *inputs) {
+    int to_child[2], from_child[2], status;
+    char buffer[65536];
+    pipe_writer writer;
+    pthread_t thread;
+    double start;
+    pid_t pid;
+
+    if (pipe(to_child) != 0 || pipe(from_child) != 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    start = bench_now_ns();
+    pid = fork();
+    if (pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        execl(mainmat, mainmat, (char*)NULL);
+        _exit(127);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+
+    writer.inputs = inputs;
+    writer.fd = to_child[1];
+    if (pid < 0 || pthread_create(&thread, NULL, write_commands, &writer) != 0) {
+        fprintf(stderr, "Error: Starting %s failed\n", mainmat);
+        return -1;
+    }
+    /* The printed products are read back like a client would */
+    while (read(from_child[0], buffer, sizeof(buffer)) > 0) {
+    }
+    pthread_join(thread, NULL);
+    close(from_child[0]);
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: Running %s failed\n", mainmat);
+        return -1;
+    }
+    return (bench_now_ns() - start) / inputs->count;
+}
+
+int main(int argc, char *argv[]) {
+    double calls[BENCH_MAX_SAMPLES], batch[BENCH_MAX_SAMPLES], piped[BENCH_MAX_SAMPLES];
+    double call_ns, batch_ns, pipe_ns;
+    const char *mainmat = "./mainmat", *json_path = NULL, *commit = "";
+    mymat_matrix *lefts, *rights, *products;
+    operation_inputs inputs;
+    bench_report report;
+    bench_stats stats;
+    long ops = DEFAULT_OPS;
+    int runs = DEFAULT_RUNS, cpu = -1;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mainmat") == 0 && i + 1 < argc) {
+            mainmat = argv[++i];
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ops = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--commit") == 0 && i + 1 < argc) {
+            commit = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--mainmat PATH] [--ops N] [--runs N] [--cpu N] "
+                    "[--json PATH] [--commit ID]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (ops < 1 || runs < 1 || runs > BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "Error: Need at least 1 operation and 1 to %d runs\n", BENCH_MAX_SAMPLES);
+        return 1;
+    }
+    if (mymat_version() / 100 != LIBMYMAT_VERSION_MAJOR) {
+        fprintf(stderr, "Error: libmymat version %d does not match the header\n", mymat_version());
+        return 1;
+    }
+
+    /* Not pinned by default: the pipe path needs the client and mainmat running at once */
+    bench_pin_cpu(cpu);
+
+    lefts = (mymat_matrix*)malloc(ops * sizeof(mymat_matrix));
+    rights = (mymat_matrix*)malloc(ops * sizeof(mymat_matrix));
+    products = (mymat_matrix*)malloc(ops * sizeof(mymat_matrix));
+    if (!lefts || !rights || !products || !make_inputs(&inputs, ops)) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return 1;
+    }
+
+    for (i = 0; i < WARMUP_RUNS + runs; i++) {
+        call_ns = run_library_calls(&inputs, products);
+        batch_ns = run_library_batch(&inputs, lefts, rights, products);
+        pipe_ns = run_through_pipe(mainmat, &inputs);
+        if (call_ns < 0 || batch_ns < 0 || pipe_ns < 0) return 1;
+        if (i >= WARMUP_RUNS) {
+            calls[i - WARMUP_RUNS] = call_ns;
+            batch[i - WARMUP_RUNS] = batch_ns;
+            piped[i - WARMUP_RUNS] = pipe_ns;
+        }
+    }
+
+    if (!bench_report_open(&report, json_path, "lib", commit, cpu)) return 1;
+    bench_summarize(calls, runs, &stats);
+    bench_report_add(&report, "libmymat calls (set, set, mul)", "ns/op", &stats, ops);
+    bench_summarize(batch, runs, &stats);
+    bench_report_add(&report, "libmymat mul_batch", "ns/op", &stats, ops);
+    bench_summarize(piped, runs, &stats);
+    bench_report_add(&report, "pipe to mainmat (read, mul, print)", "ns/op", &stats, ops);
+    bench_report_close(&report);
+
+    free(lefts);
+    free(rights);
+    free(products);
+    free(inputs.left);
+    free(inputs.right);
+    return 0;
+}
@@ -0,0 +1,529 @@
+/*
+ * Per-kernel microbenchmarks for the matrix calculator
+ * Each benchmark is calibrated to run for about SAMPLE_TARGET_NS per sample,
+ * warmed up, then timed over a number of samples; the median and 99th
+ * percentile of the per-operation time are reported. The arithmetic kernels
+ * are measured with both overflow detection modes ("fp flags" rows), and the
+ * unrolled 4x4 kernel bodies are compared with loops over a runtime size.
+ * The "error" rows give the largest error of mul_mat and mul_mat_sw over random
+ * products, against a long double reference, in units of DBL_EPSILON * max|A| * max|B|.
+ *
+ * Usage: microbench [--cpu N] [--samples N] [--json PATH] [--commit ID]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <float.h>
+#include "bench_util.h"
+#include "../mymat.h"
+#include "../commands.h"
+#include "../output.h"
+#include "../shared.h"
+#include "../matfile.h"
+#include "../mat_kernels.h"
+
+#define DEFAULT_SAMPLES 50
+#define WARMUP_SAMPLES 5
+#define SAMPLE_TARGET_NS 1e6   /* Calibrated duration of one sample */
+#define ERROR_PRODUCTS 1000    /* Random products per sample of the error rows */
+
+/* Keep the compiler from hoisting a repeated kernel out of its loop */
+#define KEEP_RESULT(result) __asm__ __volatile__("" : : "m"(result) : "memory")
+
+/* Inputs shared by all kernel benchmarks */
+typedef struct kernel_inputs {
+    mat a, b, c;
+    arg_list *read_args;       /* Arguments of a full 16-value read_mat */
+    char parse_text[256];      /* Line given to parse_line */
+    char npy_path[64];         /* MAT a saved as .npy */
+    char raw_path[64];         /* MAT a saved as raw doubles */
+} kernel_inputs;
+
+/* A benchmark body running the operation the given number of times */
+typedef void (*bench_body)(kernel_inputs *in, long iterations);
+
+static void bench_add_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) add_mat(&in->a, &in->b, &in->c);
+}
+
+static void bench_sub_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) sub_mat(&in->a, &in->b, &in->c);
+}
+
+static void bench_mul_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) mul_mat(&in->a, &in->b, &in->c);
+}
+
+static void bench_mul_mat_sw(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) mul_mat_sw(&in->a, &in->b, &in->c);
+}
+
+/* mul_mat_sw recursing down to 1x1 blocks */
+static void bench_mul_mat_sw_full(kernel_inputs *in, long iterations) {
+    int cutoff = get_sw_cutoff();
+    set_sw_cutoff(1);
+    bench_mul_mat_sw(in, iterations);
+    set_sw_cutoff(cutoff);
+}
+
+static void bench_mul_scalar(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) mul_scalar(&in->a, 1.5, &in->c);
+}
+
+/* Run a kernel benchmark with overflow detected by the floating-point exception flags */
+static void with_fp_flags(bench_body body, kernel_inputs *in, long iterations) {
+    set_fp_check_mode(FP_CHECK_FLAGS);
+    body(in, iterations);
+    set_fp_check_mode(FP_CHECK_ELEMENTS);
+}
+
+static void bench_add_mat_flags(kernel_inputs *in, long iterations) {
+    with_fp_flags(bench_add_mat, in, iterations);
+}
+
+static void bench_sub_mat_flags(kernel_inputs *in, long iterations) {
+    with_fp_flags(bench_sub_mat, in, iterations);
+}
+
+static void bench_mul_mat_flags(kernel_inputs *in, long iterations) {
+    with_fp_flags(bench_mul_mat, in, iterations);
+}
+
+static void bench_mul_scalar_flags(kernel_inputs *in, long iterations) {
+    with_fp_flags(bench_mul_scalar, in, iterations);
+}
+
+static void bench_trans_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) trans_mat(&in->a, &in->c);
+}
+
+static void bench_rand_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) rand_mat((unsigned long)i, &in->c);
+}
+
+static void bench_ident_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) ident_mat(&in->c);
+}
+
+static void bench_fill_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) fill_mat(2.5, &in->c);
+}
+
+static void bench_copy_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) copy_mat(&in->a, &in->c);
+}
+
+static void bench_sum_mat(kernel_inputs *in, long iterations) {
+    double result;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        sum_mat(&in->a, &result);
+        KEEP_RESULT(result);
+    }
+}
+
+static void bench_trace_mat(kernel_inputs *in, long iterations) {
+    double result;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        trace_mat(&in->a, &result);
+        KEEP_RESULT(result);
+    }
+}
+
+static void bench_norm_mat(kernel_inputs *in, long iterations) {
+    double result;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        norm_mat(&in->a, NORM_FROBENIUS, &result);
+        KEEP_RESULT(result);
+    }
+}
+
+/* Matrix size read at run time, so the generic loops cannot be specialized */
+static volatile int generic_size = 4;
+
+static void bench_unrolled_add(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) {
+        ADD_4X4(in->c.matrix, in->a.matrix, in->b.matrix);
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_generic_add(kernel_inputs *in, long iterations) {
+    int n = generic_size, row, col;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        for (row = 0; row < n; row++) {
+            for (col = 0; col < n; col++) {
+                in->c.matrix[row][col] = in->a.matrix[row][col] + in->b.matrix[row][col];
+            }
+        }
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_unrolled_mul(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) {
+        MUL_4X4(in->c.matrix, in->a.matrix, in->b.matrix);
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_generic_mul(kernel_inputs *in, long iterations) {
+    int n = generic_size, row, col, k;
+    double sum;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        for (row = 0; row < n; row++) {
+            for (col = 0; col < n; col++) {
+                sum = 0;
+                for (k = 0; k < n; k++) sum += in->a.matrix[row][k] * in->b.matrix[k][col];
+                in->c.matrix[row][col] = sum;
+            }
+        }
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_unrolled_scale(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) {
+        SCALE_4X4(in->c.matrix, in->a.matrix, 1.5);
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_generic_scale(kernel_inputs *in, long iterations) {
+    int n = generic_size, row, col;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        for (row = 0; row < n; row++) {
+            for (col = 0; col < n; col++) in->c.matrix[row][col] = in->a.matrix[row][col] * 1.5;
+        }
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_unrolled_trans(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) {
+        TRANS_4X4(in->c.matrix, in->a.matrix);
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_generic_trans(kernel_inputs *in, long iterations) {
+    int n = generic_size, row, col;
+    long i;
+    for (i = 0; i < iterations; i++) {
+        for (row = 0; row < n; row++) {
+            for (col = 0; col < n; col++) in->c.matrix[col][row] = in->a.matrix[row][col];
+        }
+        KEEP_RESULT(in->c);
+    }
+}
+
+static void bench_read_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) read_mat(in->read_args, &in->c);
+}
+
+static void bench_load_npy(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) load_mat_file(in->npy_path, &in->c);
+}
+
+static void bench_load_raw(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) load_mat_file(in->raw_path, &in->c);
+}
+
+/* MAT a has no version stamp, so every call formats the matrix */
+static void bench_print_mat(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) print_mat(&in->a);
+}
+
+/* MAT b is stamped and unchanged, so calls after the first copy the cached text */
+static void bench_print_mat_cached(kernel_inputs *in, long iterations) {
+    long i;
+    for (i = 0; i < iterations; i++) print_mat(&in->b);
+}
+
+/* Formatting 16 values the way print_mat did before format_fixed2 */
+static void bench_format_printf(kernel_inputs *in, long iterations) {
+    char text[FORMATTED_VALUE_MAX + 1];
+    long i;
+    int n;
+
+    for (i = 0; i < iterations; i++) {
+        for (n = 0; n < 16; n++) sprintf(text, "%8.2f ", in->a.matrix[n / 4][n % 4]);
+    }
+}
+
+static void bench_format_fixed2(kernel_inputs *in, long iterations) {
+    char text[FORMATTED_VALUE_MAX + 1];
+    long i;
+    int n, length;
+
+    for (i = 0; i < iterations; i++) {
+        for (n = 0; n < 16; n++) {
+            length = format_fixed2(in->a.matrix[n / 4][n % 4], text);
+            text[length] = ' ';
+        }
+    }
+}
+
+static void bench_parse_line(kernel_inputs *in, long iterations) {
+    arg_list *args;
+    char *name;
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        args = create_arg_list();
+        name = parse_line(in->parse_text, args);
+        free(name);
+        free_arg_list(args);
+    }
+}
+
+/* Structure naming one benchmark */
+typedef struct kernel_bench {
+    const char *name;
+    bench_body body;
+} kernel_bench;
+
+static const kernel_bench BENCHMARKS[] = {
+    { "add_mat", bench_add_mat },
+    { "add_mat (fp flags)", bench_add_mat_flags },
+    { "sub_mat", bench_sub_mat },
+    { "sub_mat (fp flags)", bench_sub_mat_flags },
+    { "mul_mat", bench_mul_mat },
+    { "mul_mat (fp flags)", bench_mul_mat_flags },
+    { "mul_mat_sw (cutoff 2)", bench_mul_mat_sw },
+    { "mul_mat_sw (cutoff 1)", bench_mul_mat_sw_full },
+    { "mul_scalar", bench_mul_scalar },
+    { "mul_scalar (fp flags)", bench_mul_scalar_flags },
+    { "trans_mat", bench_trans_mat },
+    { "rand_mat", bench_rand_mat },
+    { "ident_mat", bench_ident_mat },
+    { "fill_mat", bench_fill_mat },
+    { "copy_mat", bench_copy_mat },
+    { "sum_mat", bench_sum_mat },
+    { "trace_mat", bench_trace_mat },
+    { "norm_mat (fro)", bench_norm_mat },
+    { "add 4x4 kernel (unrolled)", bench_unrolled_add },
+    { "add 4x4 kernel (generic loop)", bench_generic_add },
+    { "mul 4x4 kernel (unrolled)", bench_unrolled_mul },
+    { "mul 4x4 kernel (generic loop)", bench_generic_mul },
+    { "scale 4x4 kernel (unrolled)", bench_unrolled_scale },
+    { "scale 4x4 kernel (generic loop)", bench_generic_scale },
+    { "trans 4x4 kernel (unrolled)", bench_unrolled_trans },
+    { "trans 4x4 kernel (generic loop)", bench_generic_trans },
+    { "read_mat", bench_read_mat },
+    { "load_mat (.npy)", bench_load_npy },
+    { "load_mat (raw)", bench_load_raw },
+    { "print_mat", bench_print_mat },
+    { "print_mat (cached)", bench_print_mat_cached },
+    { "format_printf (16 values)", bench_format_printf },
+    { "format_fixed2 (16 values)", bench_format_fixed2 },
+    { "parse_line", bench_parse_line }
+};
+
+/* Fill a matrix with deterministic non-trivial values, leaving it unstamped */
+static void fill_inputs(mat *m, double base) {
+    int i, j;
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            m->matrix[i][j] = base + i * 1.25 - j * 0.75;
+        }
+    }
+}
+
+/* Find an iteration count that makes one sample last about SAMPLE_TARGET_NS */
+static long calibrate(bench_body body, kernel_inputs *in) {
+    long iterations = 1;
+    double start, elapsed;
+
+    for (;;) {
+        start = bench_now_ns();
+        body(in, iterations);
+        elapsed = bench_now_ns() - start;
+        if (elapsed >= SAMPLE_TARGET_NS / 4 || iterations > 100000000L) break;
+        iterations *= 2;
+    }
+    return (long)(iterations * (SAMPLE_TARGET_NS / (elapsed > 0 ? elapsed : 1))) + 1;
+}
+
+/* Run one benchmark and add it to the report */
+static void run_benchmark(const kernel_bench *bench, kernel_inputs *in, int samples,
+                          bench_report *report) {
+    double times[BENCH_MAX_SAMPLES];
+    double start;
+    bench_stats stats;
+    long iterations;
+    int i;
+
+    iterations = calibrate(bench->body, in);
+    for (i = 0; i < WARMUP_SAMPLES; i++) {
+        bench->body(in, iterations);
+    }
+    for (i = 0; i < samples; i++) {
+        start = bench_now_ns();
+        bench->body(in, iterations);
+        times[i] = (bench_now_ns() - start) / iterations;
+    }
+
+    bench_summarize(times, samples, &stats);
+    bench_report_add(report, bench->name, "ns/op", &stats, iterations);
+}
+
+/* A product whose error is measured: mul_mat or mul_mat_sw with a cutoff */
+typedef struct error_case {
+    const char *name;
+    void (*multiply)(mat*, mat*, mat*);
+    int sw_cutoff;
+} error_case;
+
+static const error_case ERROR_CASES[] = {
+    { "mul_mat error", mul_mat, SW_CUTOFF_DEFAULT },
+    { "mul_mat_sw (cutoff 2) error", mul_mat_sw, 2 },
+    { "mul_mat_sw (cutoff 1) error", mul_mat_sw, 1 }
+};
+
+/* Largest element error of a product in units of DBL_EPSILON * max|A| * max|B|; the
+ * Strassen-Winograd error bound is normwise, not per element like mul_mat's */
+static double product_error(mat *a, mat *b, mat *product) {
+    double largest_a = 0, largest_b = 0, error, worst = 0;
+    long double exact;
+    int i, j, k;
+
+    for (i = 0; i < 16; i++) {
+        if (fabs(a->matrix[i / 4][i % 4]) > largest_a) largest_a = fabs(a->matrix[i / 4][i % 4]);
+        if (fabs(b->matrix[i / 4][i % 4]) > largest_b) largest_b = fabs(b->matrix[i / 4][i % 4]);
+    }
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            exact = 0;
+            for (k = 0; k < 4; k++) exact += (long double)a->matrix[i][k] * b->matrix[k][j];
+            error = fabs((double)(product->matrix[i][j] - exact));
+            if (error > worst) worst = error;
+        }
+    }
+    return worst / (largest_a * largest_b * DBL_EPSILON);
+}
+
+/* Report the worst error of each error case per sample of ERROR_PRODUCTS random products
+ * with elements in [-1, 1); every case sees the same products */
+static void run_error_cases(int samples, bench_report *report) {
+    double errors[BENCH_MAX_SAMPLES], error;
+    int cutoff = get_sw_cutoff(), c, i, n;
+    mat a, b, product;
+    bench_stats stats;
+    long p;
+
+    for (c = 0; c < (int)(sizeof(ERROR_CASES) / sizeof(ERROR_CASES[0])); c++) {
+        set_sw_cutoff(ERROR_CASES[c].sw_cutoff);
+        for (i = 0; i < samples; i++) {
+            errors[i] = 0;
+            for (p = 0; p < ERROR_PRODUCTS; p++) {
+                rand_mat(2 * (i * ERROR_PRODUCTS + p), &a);
+                rand_mat(2 * (i * ERROR_PRODUCTS + p) + 1, &b);
+                for (n = 0; n < 16; n++) {
+                    a.matrix[n / 4][n % 4] = 2 * a.matrix[n / 4][n % 4] - 1;
+                    b.matrix[n / 4][n % 4] = 2 * b.matrix[n / 4][n % 4] - 1;
+                }
+                ERROR_CASES[c].multiply(&a, &b, &product);
+                error = product_error(&a, &b, &product);
+                if (error > errors[i]) errors[i] = error;
+            }
+        }
+        bench_summarize(errors, samples, &stats);
+        bench_report_add(report, ERROR_CASES[c].name, "eps*max|A|max|B|", &stats, ERROR_PRODUCTS);
+    }
+    set_sw_cutoff(cutoff);
+}
+
+int main(int argc, char *argv[]) {
+    static kernel_inputs in;
+    bench_report report;
+    const char *json_path = NULL, *commit = "";
+    FILE *sink;
+    char number[32];
+    int cpu = 0, samples = DEFAULT_SAMPLES;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--commit") == 0 && i + 1 < argc) {
+            commit = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--cpu N] [--samples N] [--json PATH] [--commit ID]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (samples < 1 || samples > BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "Error: Sample count must be between 1 and %d\n", BENCH_MAX_SAMPLES);
+        return 1;
+    }
+
+    bench_pin_cpu(cpu);
+    if (!init_shared_registers()) return 1;
+
+    /* Kernel output (print_mat, notes) goes to /dev/null */
+    sink = fopen("/dev/null", "w");
+    if (!sink) return 1;
+    set_output_stream(sink);
+
+    fill_inputs(&in.a, 1.5);
+    fill_inputs(&in.b, -2.25);
+    touch_mat(&in.b);
+    in.c = initialize_mat();
+    in.read_args = create_arg_list();
+    add_argument(in.read_args, "MAT_C");
+    for (i = 0; i < 16; i++) {
+        sprintf(number, "%.3f", i * 1.125 - 7.5);
+        add_argument(in.read_args, number);
+    }
+    strcpy(in.parse_text, "read_mat MAT_A, 1, 2.5, -3, 4, 5.25, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16\n");
+    sprintf(in.npy_path, "/tmp/microbench_%d.npy", (int)getpid());
+    sprintf(in.raw_path, "/tmp/microbench_%d.raw", (int)getpid());
+    if (!save_mat_file(in.npy_path, &in.a) || !save_mat_file(in.raw_path, &in.a)) return 1;
+
+    if (!bench_report_open(&report, json_path, "micro", commit, cpu)) return 1;
+
+    for (i = 0; i < (int)(sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0])); i++) {
+        run_benchmark(&BENCHMARKS[i], &in, samples, &report);
+    }
+    run_error_cases(samples, &report);
+
+    bench_report_close(&report);
+    set_output_stream(NULL);
+    fclose(sink);
+    free_arg_list(in.read_args);
+    unlink(in.npy_path);
+    unlink(in.raw_path);
+    free_shared_registers();
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Contention benchmark for shared registers
+ * Reader threads repeatedly read a shared 4x4 matrix while one writer updates
+ * it at a fixed interval. The copy-on-write shared registers are compared with
+ * the same workload protected by a mutex and by a read-write lock.
+ *
+ * Usage: shared_bench [READERS [SECONDS [WRITE_INTERVAL_US]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "../mymat.h"
+#include "../shared.h"
+
+#define DEFAULT_READERS 4
+#define DEFAULT_SECONDS 1.0
+#define DEFAULT_WRITE_INTERVAL_US 100
+
+/* Synchronization scheme under test */
+typedef enum scheme {
+    SCHEME_RCU,
+    SCHEME_MUTEX,
+    SCHEME_RWLOCK
+} scheme;
+
+static const char *scheme_names[] = { "rcu", "mutex", "rwlock" };
+
+/* Structure for the state shared by all benchmark threads */
+typedef struct bench_state {
+    scheme kind;
+    volatile int running;
+    long write_interval_us;
+    mat locked_matrix;                /* Matrix used by the lock-based schemes */
+    pthread_mutex_t mutex;
+    pthread_rwlock_t rwlock;
+} bench_state;
+
+/* Structure for one thread's results */
+typedef struct thread_result {
+    bench_state *state;
+    unsigned long operations;
+    double checksum;
+} thread_result;
+
+/* Current monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sum all elements, standing in for a real read of the matrix */
+static double sum_matrix(const mat *m) {
+    double sum = 0;
+    int i, j;
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            sum += m->matrix[i][j];
+        }
+    }
+    return sum;
+}
+
+/* Reader thread: read the matrix as fast as possible */
+static void* reader_main(void *arg) {
+    thread_result *result = (thread_result*)arg;
+    bench_state *state = result->state;
+
+    while (state->running) {
+        switch (state->kind) {
+            case SCHEME_RCU:
+                shared_read_lock();
+                result->checksum += sum_matrix(shared_snapshot(0));
+                shared_read_unlock();
+                break;
+            case SCHEME_MUTEX:
+                pthread_mutex_lock(&state->mutex);
+                result->checksum += sum_matrix(&state->locked_matrix);
+                pthread_mutex_unlock(&state->mutex);
+                break;
+            case SCHEME_RWLOCK:
+                pthread_rwlock_rdlock(&state->rwlock);
+                result->checksum += sum_matrix(&state->locked_matrix);
+                pthread_rwlock_unlock(&state->rwlock);
+                break;
+        }
+        result->operations++;
+    }
+    return NULL;
+}
+
+/* Writer thread: rewrite the matrix at a fixed interval */
+static void* writer_main(void *arg) {
+    thread_result *result = (thread_result*)arg;
+    bench_state *state = result->state;
+    struct timespec pause;
+    mat *next;
+
+    pause.tv_sec = state->write_interval_us / 1000000;
+    pause.tv_nsec = (state->write_interval_us % 1000000) * 1000;
+
+    while (state->running) {
+        switch (state->kind) {
+            case SCHEME_RCU:
+                next = shared_write_begin(0);
+                next->matrix[0][0] += 1;
+                shared_write_commit(0, next);
+                break;
+            case SCHEME_MUTEX:
+                pthread_mutex_lock(&state->mutex);
+                state->locked_matrix.matrix[0][0] += 1;
+                pthread_mutex_unlock(&state->mutex);
+                break;
+            case SCHEME_RWLOCK:
+                pthread_rwlock_wrlock(&state->rwlock);
+                state->locked_matrix.matrix[0][0] += 1;
+                pthread_rwlock_unlock(&state->rwlock);
+                break;
+        }
+        result->operations++;
+        if (state->write_interval_us > 0) nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+/* Run one scheme and print its throughput */
+static void run_scheme(bench_state *state, scheme kind, int readers, double seconds) {
+    pthread_t *threads;
+    thread_result *results;
+    struct timespec duration;
+    unsigned long reads = 0;
+    double elapsed, start;
+    int i;
+
+    threads = (pthread_t*)calloc(readers + 1, sizeof(pthread_t));
+    results = (thread_result*)calloc(readers + 1, sizeof(thread_result));
+    if (!threads || !results) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(1);
+    }
+
+    state->kind = kind;
+    state->running = 1;
+    duration.tv_sec = (time_t)seconds;
+    duration.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+
+    start = now_seconds();
+    for (i = 0; i <= readers; i++) {
+        results[i].state = state;
+        pthread_create(&threads[i], NULL, i == readers ? writer_main : reader_main, &results[i]);
+    }
+    nanosleep(&duration, NULL);
+    state->running = 0;
+    for (i = 0; i <= readers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = now_seconds() - start;
+
+    for (i = 0; i < readers; i++) {
+        reads += results[i].operations;
+    }
+    printf("%-7s readers: %d  reads/s: %12.0f  writes/s: %9.0f  ns/read/thread: %7.1f\n",
+           scheme_names[kind], readers, reads / elapsed, results[readers].operations / elapsed,
+           reads ? elapsed * 1e9 * readers / reads : 0.0);
+
+    free(threads);
+    free(results);
+}
+
+int main(int argc, char *argv[]) {
+    static bench_state state;
+    int readers = DEFAULT_READERS;
+    double seconds = DEFAULT_SECONDS;
+
+    state.write_interval_us = DEFAULT_WRITE_INTERVAL_US;
+    if (argc > 1) readers = atoi(argv[1]);
+    if (argc > 2) seconds = atof(argv[2]);
+    if (argc > 3) state.write_interval_us = atol(argv[3]);
+    if (readers < 1 || seconds <= 0 || state.write_interval_us < 0) {
+        fprintf(stderr, "Usage: %s [READERS [SECONDS [WRITE_INTERVAL_US]]]\n", argv[0]);
+        return 1;
+    }
+
+    if (!init_shared_registers()) return 1;
+    state.locked_matrix = initialize_mat();
+    pthread_mutex_init(&state.mutex, NULL);
+    pthread_rwlock_init(&state.rwlock, NULL);
+
+    run_scheme(&state, SCHEME_RCU, readers, seconds);
+    run_scheme(&state, SCHEME_MUTEX, readers, seconds);
+    run_scheme(&state, SCHEME_RWLOCK, readers, seconds);
+
+    pthread_mutex_destroy(&state.mutex);
+    pthread_rwlock_destroy(&state.rwlock);
+    free_shared_registers();
+    return 0;
+}
@@ -1,13 +1,15 @@
 #include "commands.h"
+#include "output.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "alloc.h"   /* After the system headers: may redefine malloc and free */
 
 /* Create a new empty command queue */
 command_queue* create_command_queue(void) {
     command_queue *queue = (command_queue*)malloc(sizeof(command_queue));
     if (!queue) {
-        printf("Error: Failed to allocate memory for command queue\n");
+        out_printf("Error: Failed to allocate memory for command queue\n");
         return NULL;
     }
     queue->head = NULL;
@@ -19,7 +21,7 @@ command_queue* create_command_queue(void) {
 arg_list* create_arg_list(void) {
     arg_list *list = (arg_list*)malloc(sizeof(arg_list));
     if (!list) {
-        printf("Error: Failed to allocate memory for argument list\n");
+        out_printf("Error: Failed to allocate memory for argument list\n");
         return NULL;
     }
     list->head = NULL;
@@ -32,25 +34,25 @@ int add_argument(arg_list *list, const char *argument) {
     arg_node *new_node;
     
     if (!list || !argument) {
-        printf("Error: Invalid parameters for add_argument\n");
+        out_printf("Error: Invalid parameters for add_argument\n");
         return 0;
     }
     
     /* Check for excessively long arguments */
     if (strlen(argument) > 1000) {
-        printf("Error: Argument exceeds maximum allowed length\n");
+        out_printf("Error: Argument exceeds maximum allowed length\n");
         return 0;
     }
     
     new_node = (arg_node*)malloc(sizeof(arg_node));
     if (!new_node) {
-        printf("Error: Failed to allocate memory for argument node\n");
+        out_printf("Error: Failed to allocate memory for argument node\n");
         return 0;
     }
     
     new_node->argument = (char*)malloc(strlen(argument) + 1);
     if (!new_node->argument) {
-        printf("Error: Failed to allocate memory for argument string\n");
+        out_printf("Error: Failed to allocate memory for argument string\n");
         free(new_node);
         return 0;
     }
@@ -73,25 +75,25 @@ int enqueue_command(command_queue *queue, const char *command_name, arg_list *ar
     command_node *new_node;
     
     if (!queue || !command_name) {
-        printf("Error: Invalid parameters for enqueue_command\n");
+        out_printf("Error: Invalid parameters for enqueue_command\n");
         return 0;
     }
     
     /* Check for excessively long command names */
     if (strlen(command_name) > 100) {
-        printf("Error: Command name exceeds maximum allowed length\n");
+        out_printf("Error: Command name exceeds maximum allowed length\n");
         return 0;
     }
     
     new_node = (command_node*)malloc(sizeof(command_node));
     if (!new_node) {
-        printf("Error: Failed to allocate memory for command node\n");
+        out_printf("Error: Failed to allocate memory for command node\n");
         return 0;
     }
     
     new_node->command_name = (char*)malloc(strlen(command_name) + 1);
     if (!new_node->command_name) {
-        printf("Error: Failed to allocate memory for command name\n");
+        out_printf("Error: Failed to allocate memory for command name\n");
         free(new_node);
         return 0;
     }
@@ -115,7 +117,7 @@ command_node* dequeue_command(command_queue *queue) {
     command_node *node_to_remove;
     
     if (!queue) {
-        printf("Error: Invalid queue parameter for dequeue_command\n");
+        out_printf("Error: Invalid queue parameter for dequeue_command\n");
         return NULL;
     }
     
@@ -1,10 +1,17 @@
 #include "commands.h"
 #include "mymat.h"
+#include "program.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+#include "points.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <math.h>
+#include <errno.h>
+#include "alloc.h"   /* After the system headers: may redefine malloc and free */
 
 /* Check if a string is a valid number (including decimals) */
 int is_valid_real_number(const char* str) {
@@ -32,13 +39,41 @@ int is_valid_real_number(const char* str) {
     return *endptr == '\0';
 }
 
+/* Parse a non-negative decimal seed that fits an unsigned long */
+int parse_seed(const char* str, unsigned long *seed) {
+    char *endptr;
+
+    if (!str || !seed) return 0;
+
+    /* Skip leading whitespace; strtoul would accept a sign, so require a digit */
+    while (isspace(*str)) str++;
+    if (!isdigit(*str)) return 0;
+
+    errno = 0;
+    *seed = strtoul(str, &endptr, 10);
+    if (errno == ERANGE) return 0;
+
+    /* Skip trailing whitespace */
+    while (isspace(*endptr)) endptr++;
+    return *endptr == '\0';
+}
+
 /* Check if the command name is one we recognize */
 int is_valid_command_name(const char* command) {
     if (!command) return 0;
     return (strcmp(command, "read_mat") == 0 || strcmp(command, "print_mat") == 0 ||
             strcmp(command, "add_mat") == 0 || strcmp(command, "sub_mat") == 0 ||
             strcmp(command, "mul_mat") == 0 || strcmp(command, "mul_scalar") == 0 ||
-            strcmp(command, "trans_mat") == 0 || strcmp(command, "stop") == 0);
+            strcmp(command, "mul_mat_sw") == 0 ||
+            strcmp(command, "trans_mat") == 0 || strcmp(command, "stop") == 0 ||
+            strcmp(command, "rand_mat") == 0 || strcmp(command, "ident_mat") == 0 ||
+            strcmp(command, "fill_mat") == 0 || strcmp(command, "copy_mat") == 0 ||
+            strcmp(command, "stats") == 0 || strcmp(command, "output_mode") == 0 ||
+            strcmp(command, "print_as") == 0 || strcmp(command, "load_mat") == 0 ||
+            strcmp(command, "save_mat") == 0 || strcmp(command, "save_state") == 0 ||
+            strcmp(command, "load_state") == 0 || strcmp(command, "transform_points") == 0 ||
+            strcmp(command, "sum_mat") == 0 || strcmp(command, "trace_mat") == 0 ||
+            strcmp(command, "norm_mat") == 0);
 }
 
 /* Count how many arguments are in the list */
@@ -58,23 +93,24 @@ int validate_command_arguments(const char* command_name, arg_list *args) {
     arg_node *current;
     char *arg_value;
     double test_value;
+    unsigned long seed, threads;
     char *endptr;
     int i;
     
     if (!command_name || !args) {
-        printf("Missing argument\n");
+        out_printf("Missing argument\n");
         return 0;
     }
     
     if (strcmp(command_name, "read_mat") == 0) {
         if (arg_count < 1) {
-            printf("Missing argument\n");
+            out_printf("Missing argument\n");
             return 0;
         }
         current = get_first_argument(args);
         arg_value = get_argument_value(current);
         if (get_matrix_index(arg_value) == -1) {
-            printf("Undefined matrix name\n");
+            out_printf("Undefined matrix name\n");
             return 0;
         }
         /* Check that all remaining arguments are valid real numbers */
@@ -82,13 +118,13 @@ int validate_command_arguments(const char* command_name, arg_list *args) {
         while (current) {
             arg_value = get_argument_value(current);
             if (!is_valid_real_number(arg_value)) {
-                printf("Argument is not a real number\n");
+                out_printf("Argument is not a real number\n");
                 return 0;
             }
             /* Check for numeric overflow */
             test_value = strtod(arg_value, &endptr);
             if (test_value == HUGE_VAL || test_value == -HUGE_VAL) {
-                printf("Error: Numeric overflow in argument '%s'\n", arg_value);
+                out_printf("Error: Numeric overflow in argument '%s'\n", arg_value);
                 return 0;
             }
             current = get_next_argument(current);
@@ -96,33 +132,34 @@ int validate_command_arguments(const char* command_name, arg_list *args) {
     }
     else if (strcmp(command_name, "print_mat") == 0) {
         if (arg_count < 1) {
-            printf("Missing argument\n");
+            out_printf("Missing argument\n");
             return 0;
         }
         current = get_first_argument(args);
         while (current) {
             arg_value = get_argument_value(current);
             if (get_matrix_index(arg_value) == -1) {
-                printf("Undefined matrix name\n");
+                out_printf("Undefined matrix name\n");
                 return 0;
             }
             current = get_next_argument(current);
         }
     }
-    else if (strcmp(command_name, "add_mat") == 0 || strcmp(command_name, "sub_mat") == 0 || strcmp(command_name, "mul_mat") == 0) {
+    else if (strcmp(command_name, "add_mat") == 0 || strcmp(command_name, "sub_mat") == 0 ||
+             strcmp(command_name, "mul_mat") == 0 || strcmp(command_name, "mul_mat_sw") == 0) {
         if (arg_count < 3) {
-            printf("Missing argument\n");
+            out_printf("Missing argument\n");
             return 0;
         }
         if (arg_count > 3) {
-            printf("Extraneous text after end of command\n");
+            out_printf("Extraneous text after end of command\n");
             return 0;
         }
         current = get_first_argument(args);
         for (i = 0; i < 3; i++) {
             arg_value = get_argument_value(current);
             if (get_matrix_index(arg_value) == -1) {
-                printf("Undefined matrix name\n");
+                out_printf("Undefined matrix name\n");
                 return 0;
             }
             current = get_next_argument(current);
@@ -130,63 +167,209 @@ int validate_command_arguments(const char* command_name, arg_list *args) {
     }
     else if (strcmp(command_name, "mul_scalar") == 0) {
         if (arg_count < 3) {
-            printf("Missing argument\n");
+            out_printf("Missing argument\n");
             return 0;
         }
         if (arg_count > 3) {
-            printf("Extraneous text after end of command\n");
+            out_printf("Extraneous text after end of command\n");
             return 0;
         }
         current = get_first_argument(args);
         /* First argument: matrix name */
         arg_value = get_argument_value(current);
         if (get_matrix_index(arg_value) == -1) {
-            printf("Undefined matrix name\n");
+            out_printf("Undefined matrix name\n");
             return 0;
         }
         /* Second argument: scalar */
         current = get_next_argument(current);
         arg_value = get_argument_value(current);
         if (!is_valid_real_number(arg_value)) {
-            printf("Argument is not a scalar\n");
+            out_printf("Argument is not a scalar\n");
             return 0;
         }
         /* Check for numeric overflow in scalar */
         test_value = strtod(arg_value, &endptr);
         if (test_value == HUGE_VAL || test_value == -HUGE_VAL) {
-            printf("Error: Numeric overflow in scalar value '%s'\n", arg_value);
+            out_printf("Error: Numeric overflow in scalar value '%s'\n", arg_value);
             return 0;
         }
         /* Third argument: target matrix */
         current = get_next_argument(current);
         arg_value = get_argument_value(current);
         if (get_matrix_index(arg_value) == -1) {
-            printf("Undefined matrix name\n");
+            out_printf("Undefined matrix name\n");
             return 0;
         }
     }
-    else if (strcmp(command_name, "trans_mat") == 0) {
+    else if (strcmp(command_name, "trans_mat") == 0 || strcmp(command_name, "copy_mat") == 0) {
         if (arg_count < 2) {
-            printf("Missing argument\n");
+            out_printf("Missing argument\n");
             return 0;
         }
         if (arg_count > 2) {
-            printf("Extraneous text after end of command\n");
+            out_printf("Extraneous text after end of command\n");
             return 0;
         }
         current = get_first_argument(args);
         for (i = 0; i < 2; i++) {
             arg_value = get_argument_value(current);
             if (get_matrix_index(arg_value) == -1) {
-                printf("Undefined matrix name\n");
+                out_printf("Undefined matrix name\n");
+                return 0;
+            }
+            current = get_next_argument(current);
+        }
+    }
+    else if (strcmp(command_name, "ident_mat") == 0 || strcmp(command_name, "sum_mat") == 0 ||
+             strcmp(command_name, "trace_mat") == 0) {
+        if (arg_count < 1) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 1) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+        if (get_matrix_index(get_argument_value(get_first_argument(args))) == -1) {
+            out_printf("Undefined matrix name\n");
+            return 0;
+        }
+    }
+    else if (strcmp(command_name, "norm_mat") == 0) {
+        if (arg_count < 1) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 2) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+        current = get_first_argument(args);
+        if (get_matrix_index(get_argument_value(current)) == -1) {
+            out_printf("Undefined matrix name\n");
+            return 0;
+        }
+        if (arg_count == 2 && parse_norm_kind(get_argument_value(get_next_argument(current))) < 0) {
+            out_printf("Undefined norm type\n");
+            return 0;
+        }
+    }
+    else if (strcmp(command_name, "rand_mat") == 0 || strcmp(command_name, "fill_mat") == 0) {
+        if (arg_count < 2) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 2) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+        current = get_first_argument(args);
+        if (get_matrix_index(get_argument_value(current)) == -1) {
+            out_printf("Undefined matrix name\n");
+            return 0;
+        }
+        arg_value = get_argument_value(get_next_argument(current));
+        if (strcmp(command_name, "rand_mat") == 0) {
+            if (!parse_seed(arg_value, &seed)) {
+                out_printf("Argument is not a valid seed\n");
+                return 0;
+            }
+        } else {
+            if (!is_valid_real_number(arg_value)) {
+                out_printf("Argument is not a real number\n");
+                return 0;
+            }
+            /* Check for numeric overflow in the fill value */
+            test_value = strtod(arg_value, &endptr);
+            if (test_value == HUGE_VAL || test_value == -HUGE_VAL) {
+                out_printf("Error: Numeric overflow in argument '%s'\n", arg_value);
+                return 0;
+            }
+        }
+    }
+    else if (strcmp(command_name, "print_as") == 0) {
+        if (arg_count < 2) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        current = get_first_argument(args);
+        if (parse_output_mode(get_argument_value(current)) < 0) {
+            out_printf("Undefined output mode\n");
+            return 0;
+        }
+        current = get_next_argument(current);
+        while (current) {
+            if (get_matrix_index(get_argument_value(current)) == -1) {
+                out_printf("Undefined matrix name\n");
                 return 0;
             }
             current = get_next_argument(current);
         }
     }
-    else if (strcmp(command_name, "stop") == 0) {
+    else if (strcmp(command_name, "load_mat") == 0 || strcmp(command_name, "save_mat") == 0) {
+        if (arg_count < 2) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 2) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+        if (get_matrix_index(get_argument_value(get_first_argument(args))) == -1) {
+            out_printf("Undefined matrix name\n");
+            return 0;
+        }
+    }
+    else if (strcmp(command_name, "save_state") == 0 || strcmp(command_name, "load_state") == 0) {
+        if (arg_count < 1) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 1) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+    }
+    else if (strcmp(command_name, "transform_points") == 0) {
+        if (arg_count < 3) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 4) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+        current = get_first_argument(args);
+        if (get_matrix_index(get_argument_value(current)) == -1) {
+            out_printf("Undefined matrix name\n");
+            return 0;
+        }
+        if (arg_count == 4) {
+            arg_value = get_argument_value(get_next_argument(get_next_argument(get_next_argument(current))));
+            if (!parse_seed(arg_value, &threads) || threads < 1 || threads > MAX_TRANSFORM_THREADS) {
+                out_printf("Thread count must be between 1 and %d\n", MAX_TRANSFORM_THREADS);
+                return 0;
+            }
+        }
+    }
+    else if (strcmp(command_name, "output_mode") == 0) {
+        if (arg_count < 1) {
+            out_printf("Missing argument\n");
+            return 0;
+        }
+        if (arg_count > 1) {
+            out_printf("Extraneous text after end of command\n");
+            return 0;
+        }
+        if (parse_output_mode(get_argument_value(get_first_argument(args))) < 0) {
+            out_printf("Undefined output mode\n");
+            return 0;
+        }
+    }
+    else if (strcmp(command_name, "stop") == 0 || strcmp(command_name, "stats") == 0) {
         if (arg_count > 0) {
-            printf("Extraneous text after end of command\n");
+            out_printf("Extraneous text after end of command\n");
             return 0;
         }
     }
@@ -196,114 +379,50 @@ int validate_command_arguments(const char* command_name, arg_list *args) {
 
 /* Execute all the commands in the queue one by one */
 void execute_queued_commands(command_queue *queue, mat matrices[MAT_COUNT]) {
+    program compiled;
+    int valid;
+    STATS_TIMER(timer);
+    
     if (!queue || is_queue_empty(queue)) {
         return; /* No commands to execute */
     }
     
+    init_program(&compiled);
+    
     while (!is_queue_empty(queue)) {
         command_node *cmd = dequeue_command(queue);
-        arg_node *argument;
-        char *matrix_name, *scalar_str;
-        mat *first_matrix, *second_matrix, *target_matrix;
-        double scalar;
         
         if (!cmd) break;
         
         /* Validate command arguments before execution */
-        if (!validate_command_arguments(cmd->command_name, cmd->arguments)) {
+        STATS_START(timer);
+        TRACE_BEGIN(validate);
+        valid = validate_command_arguments(cmd->command_name, cmd->arguments);
+        TRACE_END(validate);
+        STATS_RECORD(stats_command_index(cmd->command_name), STAGE_VALIDATE, timer);
+        if (!valid) {
             free_command_node(cmd);
             continue; /* Skip execution due to validation error */
         }
         
-        if (strcmp(cmd->command_name, "read_mat") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            if (argument) {
-                matrix_name = get_argument_value(argument);
-                target_matrix = get_matrix_by_name(matrix_name, matrices);
-                
-                if (target_matrix) {
-                    read_mat(cmd->arguments, target_matrix);
-                }
-            }
-        }
-        else if (strcmp(cmd->command_name, "print_mat") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            while (argument) {
-                matrix_name = get_argument_value(argument);
-                target_matrix = get_matrix_by_name(matrix_name, matrices);
-                
-                if (target_matrix) {
-                    print_mat(target_matrix);
-                }
-                
-                argument = get_next_argument(argument);
-            }
-        }
-        else if (strcmp(cmd->command_name, "trans_mat") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            first_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-            
-            argument = get_next_argument(argument);
-            target_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-            
-            trans_mat(first_matrix, target_matrix);
-        }
-        else if (strcmp(cmd->command_name, "add_mat") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            first_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-            
-            argument = get_next_argument(argument);
-            second_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            argument = get_next_argument(argument);
-            target_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            add_mat(first_matrix, second_matrix, target_matrix);
-        }
-        else if (strcmp(cmd->command_name, "sub_mat") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            first_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            argument = get_next_argument(argument);
-            second_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            argument = get_next_argument(argument);
-            target_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            sub_mat(first_matrix, second_matrix, target_matrix);
-        }
-        else if (strcmp(cmd->command_name, "mul_mat") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            first_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            argument = get_next_argument(argument);
-            second_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            argument = get_next_argument(argument);
-            target_matrix = get_matrix_by_name(get_argument_value(argument), matrices);    
-
-            mul_mat(first_matrix, second_matrix, target_matrix);
-        }
-        else if (strcmp(cmd->command_name, "mul_scalar") == 0) {
-            argument = get_first_argument(cmd->arguments);
-            first_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-            
-            argument = get_next_argument(argument);
-            scalar_str = get_argument_value(argument);
-            scalar = strtod(scalar_str, NULL);
-
-            argument = get_next_argument(argument);
-            target_matrix = get_matrix_by_name(get_argument_value(argument), matrices);
-
-            mul_scalar(first_matrix, scalar, target_matrix);
-        }
-        else if (strcmp(cmd->command_name, "stop") == 0) {
+        if (strcmp(cmd->command_name, "stop") == 0) {
             free_command_node(cmd);
-            return; /* Exit the loop */
+            break; /* Exit the loop */
+        }
+        
+        /* Resolve the command once and run it through the shared executor */
+        reset_program(&compiled);
+        STATS_START(timer);
+        valid = compile_command(cmd->command_name, cmd->arguments, &compiled);
+        STATS_RECORD(stats_command_index(cmd->command_name), STAGE_COMPILE, timer);
+        if (valid) {
+            run_program(&compiled, matrices);
         }
         
         free_command_node(cmd);
     }
+    
+    clear_program(&compiled);
 }
 
 /* Parse a line of input and extract the command name and arguments */
@@ -321,7 +440,7 @@ char* parse_line(char *line, arg_list *args) {
     
     /* Check for excessively long input line */
     if (strlen(line) >= 1023 && line[strlen(line)-1] != '\n') {
-        printf("Error: Input line exceeds maximum length limit\n");
+        out_printf("Error: Input line exceeds maximum length limit\n");
         return NULL;
     }
     
@@ -337,7 +456,7 @@ char* parse_line(char *line, arg_list *args) {
     start = ptr;
     while (*start && (*start == ',' || *start == ' ' || *start == '\t')) start++;
     if (!*start || *start == '\n' || *start == '\r') {
-        printf("Please enter a valid command\n");
+        out_printf("Please enter a valid command\n");
         return NULL;
     }
     
@@ -351,41 +470,49 @@ char* parse_line(char *line, arg_list *args) {
     if (len > 0) {
         /* Check for token buffer overflow */
         if (len >= 255) {
-            printf("Error: Command name exceeds maximum length limit\n");
+            out_printf("Error: Command name exceeds maximum length limit\n");
             return NULL;
         }
         
         /* Dynamically allocate memory for command name */
         command_name = (char*)malloc(len + 1);
         if (!command_name) {
-            printf("Error: Memory allocation failed for command name\n");
+            out_printf("Error: Memory allocation failed for command name\n");
             return NULL;
         }
         strncpy(command_name, start, len);
         command_name[len] = '\0';
     } else {
-        printf("Please enter a command\n");
+        out_printf("Please enter a command\n");
         return NULL;
     }
     
     /* Check if command name is valid */
     if (!is_valid_command_name(command_name)) {
-        printf("Undefined command name\n");
+        out_printf("Undefined command name\n");
         free(command_name);
         return NULL;
     }
     
     /* Determine expected number of arguments for this command */
-    if (strcmp(command_name, "stop") == 0) {
+    if (strcmp(command_name, "stop") == 0 || strcmp(command_name, "stats") == 0) {
         expected_args = 0;
-    } else if (strcmp(command_name, "print_mat") == 0) {
+    } else if (strcmp(command_name, "print_mat") == 0 || strcmp(command_name, "print_as") == 0) {
         expected_args = -1; /* Variable number of arguments */
-    } else if (strcmp(command_name, "read_mat") == 0) {
+    } else if (strcmp(command_name, "output_mode") == 0 || strcmp(command_name, "save_state") == 0 ||
+               strcmp(command_name, "load_state") == 0 || strcmp(command_name, "ident_mat") == 0 ||
+               strcmp(command_name, "sum_mat") == 0 || strcmp(command_name, "trace_mat") == 0) {
+        expected_args = 1;
+    } else if (strcmp(command_name, "read_mat") == 0 || strcmp(command_name, "transform_points") == 0 ||
+               strcmp(command_name, "norm_mat") == 0) {
         expected_args = -1; /* Variable number of arguments */
-    } else if (strcmp(command_name, "trans_mat") == 0) {
+    } else if (strcmp(command_name, "trans_mat") == 0 || strcmp(command_name, "load_mat") == 0 ||
+               strcmp(command_name, "save_mat") == 0 || strcmp(command_name, "rand_mat") == 0 ||
+               strcmp(command_name, "fill_mat") == 0 || strcmp(command_name, "copy_mat") == 0) {
         expected_args = 2;
     } else if (strcmp(command_name, "add_mat") == 0 || strcmp(command_name, "sub_mat") == 0 || 
-               strcmp(command_name, "mul_mat") == 0 || strcmp(command_name, "mul_scalar") == 0) {
+               strcmp(command_name, "mul_mat") == 0 || strcmp(command_name, "mul_scalar") == 0 ||
+               strcmp(command_name, "mul_mat_sw") == 0) {
         expected_args = 3;
     } else {
         expected_args = -1;
@@ -396,7 +523,7 @@ char* parse_line(char *line, arg_list *args) {
     
     /* Check for illegal comma immediately after command */
     if (*ptr == ',') {
-        printf("Illegal comma\n");
+        out_printf("Illegal comma\n");
         free(command_name);
         return NULL;
     }
@@ -419,18 +546,18 @@ char* parse_line(char *line, arg_list *args) {
             token_buffer[len] = '\0';
             
             if (!add_argument(args, token_buffer)) {
-                printf("Error: Failed to add argument to list\n");
+                out_printf("Error: Failed to add argument to list\n");
                 free(command_name);
                 return NULL;
             }
         } else if (len == 0) {
             /* Empty argument */
-            printf("Multiple consecutive commas\n");
+            out_printf("Multiple consecutive commas\n");
             free(command_name);
             return NULL;
         } else {
             /* Token too long */
-            printf("Error: Argument exceeds maximum length limit\n");
+            out_printf("Error: Argument exceeds maximum length limit\n");
             free(command_name);
             return NULL;
         }
@@ -441,7 +568,7 @@ char* parse_line(char *line, arg_list *args) {
         /* Check if we have enough arguments and there's still more text */
         if (expected_args > 0 && count_arguments(args) >= expected_args && 
             (*ptr && *ptr != '\n' && *ptr != '\r')) {
-            printf("Extraneous text after end of command\n");
+            out_printf("Extraneous text after end of command\n");
             free(command_name);
             return NULL;
         }
@@ -455,14 +582,14 @@ char* parse_line(char *line, arg_list *args) {
             
             /* Check for another comma (multiple consecutive commas) */
             if (*ptr == ',') {
-                printf("Multiple consecutive commas\n");
+                out_printf("Multiple consecutive commas\n");
                 free(command_name);
                 return NULL;
             }
             
             /* Check if line ends after comma (trailing comma) */
             if (!*ptr || *ptr == '\n' || *ptr == '\r') {
-                printf("Extraneous text after end of command\n");
+                out_printf("Extraneous text after end of command\n");
                 free(command_name);
                 return NULL;
             }
@@ -471,7 +598,7 @@ char* parse_line(char *line, arg_list *args) {
         else if (*ptr && *ptr != '\n' && *ptr != '\r') {
             /* For commands that require commas between arguments, this is an error */
             if (strcmp(command_name, "read_mat") != 0) { /* read_mat can have space-separated numbers */
-                printf("Missing comma\n");
+                out_printf("Missing comma\n");
                 free(command_name);
                 return NULL;
             }
@@ -482,71 +609,132 @@ char* parse_line(char *line, arg_list *args) {
     return command_name; /* Success */
 }
 
+/* Set up the per-session state used by process_line */
+int init_command_session(command_session *session, mat matrices[MAT_COUNT]) {
+    if (!session || !matrices) {
+        out_printf("Error: Invalid parameters for init_command_session\n");
+        return 0;
+    }
+    
+    /* Initialize command queue */
+    session->queue = create_command_queue();
+    if (!session->queue) {
+        out_printf("Error: Failed to create command queue\n");
+        return 0;
+    }
+    
+    session->matrices = matrices;
+    init_script_state(&session->script);
+    return 1;
+}
+
+/* Release the per-session state */
+void free_command_session(command_session *session) {
+    if (!session) return;
+    
+    free_script_state(&session->script);
+    free_command_queue(session->queue);
+    session->queue = NULL;
+}
+
+#ifdef MYMAT_ALLOC_PROFILE
+/* Command type of a line from its first word, so parsing is attributed to the command too */
+static stats_command line_command(const char *line) {
+    char word[24];
+    int length = 0;
+
+    while (isspace((unsigned char)*line)) line++;
+    while (line[length] && line[length] != ',' && !isspace((unsigned char)line[length]) &&
+           length < (int)sizeof(word) - 1) {
+        word[length] = line[length];
+        length++;
+    }
+    word[length] = '\0';
+    return stats_command_index(word);
+}
+#endif
+
+/* Parse and execute a single input line */
+int process_line(command_session *session, char *line) {
+    char *command_name;
+    arg_list *current_args;
+    STATS_TIMER(timer);
+    
+    ALLOC_COMMAND(line_command(line));
+    
+    /* Block constructs (repeat, macro, call) are compiled separately */
+    if (handle_script_line(&session->script, line, session->matrices)) {
+        return 1;
+    }
+    
+    /* Create argument list for this command */
+    current_args = create_arg_list();
+    if (!current_args) {
+        out_printf("Error: Failed to create argument list\n");
+        return 1;
+    }
+    
+    /* Parse the line dynamically - extracts command and populates args directly */
+    STATS_START(timer);
+    TRACE_BEGIN(parse);
+    command_name = parse_line(line, current_args);
+    TRACE_END(parse);
+    STATS_RECORD(stats_command_index(command_name), STAGE_PARSE, timer);
+    if (!command_name) {
+        /* Parsing failed - error message already printed by parse_line */
+        free_arg_list(current_args);
+        return 1;
+    }
+    
+    /* Check if command is "stop" */
+    if (strcmp(command_name, "stop") == 0) {
+        free_arg_list(current_args);
+        free(command_name);
+        return 0;
+    }
+    
+    /* Enqueue the command with its arguments; the queue then owns the arg_list */
+    if (enqueue_command(session->queue, command_name, current_args)) {
+        /* Execute immediately */
+        execute_queued_commands(session->queue, session->matrices);
+    } else {
+        out_printf("Error: Failed to enqueue command '%s'\n", command_name);
+        free_arg_list(current_args);
+    }
+    free(command_name);
+    return 1;
+}
+
 /* Main function that reads user input and processes matrix commands */
 void process_commands(mat matrices[MAT_COUNT]) {
+    process_stream(stdin, matrices);
+}
+
+/* Read and execute command lines from a stream until stop or end of input */
+void process_stream(FILE *input, mat matrices[MAT_COUNT]) {
     /* Variable declarations - all at the beginning for C90 compliance */
     char line[1024];
-    char *command_name;
-    command_queue *queue;
-    arg_list *current_args = NULL;
-    int queue_size = 0;
-    const int MAX_QUEUE_SIZE = 1000; /* Prevent queue overflow */
+    command_session session;
+    STATS_TIMER(timer);
 
-    /* Initialize command queue */
-    queue = create_command_queue();
-
-    if (!queue) {
-        printf("Error: Failed to create command queue\n");
+    if (!init_command_session(&session, matrices)) {
         return;
     }
 
-    while (fgets(line, sizeof(line), stdin)) {
-        /* Check for queue overflow */
-        if (queue_size >= MAX_QUEUE_SIZE) {
-            printf("Error: Command queue overflow - too many pending commands\n");
-            continue;
-        }
-        
-        /* Create argument list for this command */
-        current_args = create_arg_list();
-        if (!current_args) {
-            printf("Error: Failed to create argument list\n");
-            continue;
-        }
-        
-        /* Parse the line dynamically - extracts command and populates args directly */
-        command_name = parse_line(line, current_args);
-        if (command_name) {
-            /* Check if command is "stop" */
-            if (strcmp(command_name, "stop") == 0) {
-                free_arg_list(current_args);
-                free(command_name);
-                break;
-            }
-            
-            /* Enqueue the command with its arguments */
-            if (enqueue_command(queue, command_name, current_args)) {
-                /* Queue now owns the arg_list, so we don't free it */
-                current_args = NULL;
-                queue_size++;
-                
-                /* Execute immediately */
-                execute_queued_commands(queue, matrices);
-                queue_size = 0; /* Reset after execution */
-            } else {
-                printf("Error: Failed to enqueue command '%s'\n", command_name);
-                free_arg_list(current_args);
-                current_args = NULL;
-            }
-            free(command_name);
-        } else {
-            /* Parsing failed - error message already printed by parse_line */
-            free_arg_list(current_args);
-            current_args = NULL;
-        }
+    /* The command is not known yet while reading, so reads count as "other" */
+    STATS_START(timer);
+    while (fgets(line, sizeof(line), input)) {
+        STATS_RECORD(STATS_OTHER, STAGE_READ, timer);
+        TRACE_BEGIN(line);
+        if (!process_line(&session, line)) {
+            TRACE_END(line);
+            break; /* "stop" command */
+        }
+        TRACE_END(line);
+        STATS_START(timer);
     }
 
     /* Clean up */
-    free_command_queue(queue);
+    ALLOC_COMMAND(STATS_OTHER);
+    free_command_session(&session);
 }
-
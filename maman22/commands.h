@@ -3,16 +3,57 @@
 
 #include "mymat.h"
 #include "command_queue.h"
+#include "program.h"
+
+/* Structure for the state of one command session (stdin or a client connection) */
+typedef struct command_session {
+    mat *matrices;                /* Registers MAT_A through MAT_F of this session */
+    command_queue *queue;         /* Queue used to execute parsed commands */
+    script_state script;          /* Block collection state and macros */
+} command_session;
 
 /**
  * @brief Main command processing function that reads and executes commands from stdin
  * @param matrices Array of matrices (MAT_A through MAT_F) for command operations
  * @note Processes commands line by line until "stop" command or EOF is encountered
  * @note Uses a command queue for sequential command execution
+ * @note Lines belonging to repeat and macro blocks are handled by handle_script_line
  * @warning Function will continue until explicit "stop" command is received
  */
 void process_commands(mat matrices[MAT_COUNT]);
 
+/**
+ * @brief Reads and executes command lines from a stream, like process_commands does for stdin
+ * @param input Stream the commands are read from
+ * @param matrices Array of matrices (MAT_A through MAT_F) for command operations
+ * @note Output goes to the calling thread's output stream
+ */
+void process_stream(FILE *input, mat matrices[MAT_COUNT]);
+
+/**
+ * @brief Initializes a command session operating on the given matrices
+ * @param session Session to initialize
+ * @param matrices Array of matrices (MAT_A through MAT_F) owned by the caller
+ * @return 1 on success, 0 on allocation failure
+ */
+int init_command_session(command_session *session, mat matrices[MAT_COUNT]);
+
+/**
+ * @brief Frees the queue, pending block and macros of a command session
+ * @param session Session to clean up
+ * @note The matrices are owned by the caller and are not freed
+ */
+void free_command_session(command_session *session);
+
+/**
+ * @brief Parses and executes a single input line within a session
+ * @param session Session whose registers and macros are used
+ * @param line Input line as read by fgets
+ * @return 0 if the line was a "stop" command, 1 otherwise
+ * @note Errors are reported on the calling thread's output stream and do not end the session
+ */
+int process_line(command_session *session, char *line);
+
 /**
  * @brief Dynamic parsing function that extracts command name and arguments from input line
  * @param line Input line containing command and arguments
@@ -33,11 +74,22 @@ char* parse_line(char *line, arg_list *args);
  */
 int is_valid_real_number(const char* str);
 
+/**
+ * @brief Parses a rand_mat seed
+ * @param str Decimal digits, optionally surrounded by whitespace
+ * @param seed Receives the value
+ * @return 1 if the string is a non-negative integer that fits an unsigned long, 0 otherwise
+ */
+int parse_seed(const char* str, unsigned long *seed);
+
 /**
  * @brief Validates if a command name is recognized by the system
  * @param command Command name string to be validated
  * @return 1 if command name is valid, 0 otherwise
- * @note Valid commands: read_mat, print_mat, add_mat, sub_mat, mul_mat, mul_scalar, trans_mat, stop
+ * @note Valid commands: read_mat, print_mat, add_mat, sub_mat, mul_mat, mul_mat_sw, mul_scalar,
+ *       trans_mat, rand_mat, ident_mat, fill_mat, copy_mat, print_as, output_mode, load_mat,
+ *       save_mat, save_state, load_state, transform_points, sum_mat, trace_mat, norm_mat,
+ *       stats, stop
  * @warning Returns 0 for NULL command names
  */
 int is_valid_command_name(const char* command);
@@ -67,6 +119,7 @@ int validate_command_arguments(const char* command_name, arg_list *args);
  * @param queue Command queue containing commands to execute
  * @param matrices Array of matrices (MAT_A through MAT_F) for command operations
  * @note Validates each command before execution and skips invalid commands
+ * @note Commands are compiled with compile_command and executed by run_program
  * @note Frees command nodes after execution to prevent memory leaks
  * @warning Stops execution immediately when "stop" command is encountered
  */
@@ -0,0 +1,211 @@
+#include "libmymat.h"
+#include "mat_kernels.h"
+#include <math.h>
+
+/* The kernel macros take writable arrays; the operands are only read through them */
+#define OPERAND(matrix) ((double (*)[4])(matrix)->values)
+
+/* Check that every element is finite without a branch per element: value * 0 is 0 for
+ * finite values and NaN for infinities and NaN, and NaN survives the sums. One sum per
+ * column keeps the additions independent. */
+static int is_finite_matrix(const mymat_matrix *matrix) {
+    double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        sum0 += matrix->values[i][0] * 0.0;
+        sum1 += matrix->values[i][1] * 0.0;
+        sum2 += matrix->values[i][2] * 0.0;
+        sum3 += matrix->values[i][3] * 0.0;
+    }
+    sum0 += sum1 + sum2 + sum3;
+    return sum0 == sum0;
+}
+
+/* Get the library version */
+int mymat_version(void) {
+    return LIBMYMAT_VERSION_MAJOR * 100 + LIBMYMAT_VERSION_MINOR;
+}
+
+/* Describe a status code */
+const char* mymat_status_string(int status) {
+    switch (status) {
+        case MYMAT_OK:
+            return "success";
+        case MYMAT_ERR_NULL:
+            return "null pointer argument";
+        case MYMAT_ERR_INVALID_INPUT:
+            return "invalid value (NaN or infinity)";
+        case MYMAT_ERR_OVERFLOW:
+            return "numeric overflow";
+        default:
+            return "unknown status";
+    }
+}
+
+/* Set every element to zero */
+int mymat_zero(mymat_matrix *target) {
+    int n;
+
+    if (!target) return MYMAT_ERR_NULL;
+    for (n = 0; n < 16; n++) {
+        target->values[n / 4][n % 4] = 0.0;
+    }
+    return MYMAT_OK;
+}
+
+/* Store values row by row, leaving the target unchanged if any is not finite */
+int mymat_set_values(mymat_matrix *target, const double *values, size_t count) {
+    size_t n;
+
+    if (!target || (!values && count > 0)) return MYMAT_ERR_NULL;
+    if (count > 16) count = 16;
+
+    for (n = 0; n < count; n++) {
+        if (isnan(values[n]) || isinf(values[n])) return MYMAT_ERR_INVALID_INPUT;
+    }
+    for (n = 0; n < count; n++) {
+        target->values[n / 4][n % 4] = values[n];
+    }
+    return MYMAT_OK;
+}
+
+/* Add two matrices */
+int mymat_add(const mymat_matrix *left, const mymat_matrix *right, mymat_matrix *result) {
+    mymat_matrix sum;
+
+    if (!left || !right || !result) return MYMAT_ERR_NULL;
+    if (!is_finite_matrix(left) || !is_finite_matrix(right)) return MYMAT_ERR_INVALID_INPUT;
+
+    ADD_4X4(sum.values, OPERAND(left), OPERAND(right));
+    if (!is_finite_matrix(&sum)) return MYMAT_ERR_OVERFLOW;
+    *result = sum;
+    return MYMAT_OK;
+}
+
+/* Subtract the right matrix from the left one */
+int mymat_sub(const mymat_matrix *left, const mymat_matrix *right, mymat_matrix *result) {
+    mymat_matrix difference;
+
+    if (!left || !right || !result) return MYMAT_ERR_NULL;
+    if (!is_finite_matrix(left) || !is_finite_matrix(right)) return MYMAT_ERR_INVALID_INPUT;
+
+    SUB_4X4(difference.values, OPERAND(left), OPERAND(right));
+    if (!is_finite_matrix(&difference)) return MYMAT_ERR_OVERFLOW;
+    *result = difference;
+    return MYMAT_OK;
+}
+
+/* Multiply two matrices */
+int mymat_mul(const mymat_matrix *left, const mymat_matrix *right, mymat_matrix *result) {
+    mymat_matrix product;
+
+    if (!left || !right || !result) return MYMAT_ERR_NULL;
+    if (!is_finite_matrix(left) || !is_finite_matrix(right)) return MYMAT_ERR_INVALID_INPUT;
+
+    MUL_4X4(product.values, OPERAND(left), OPERAND(right));
+    if (!is_finite_matrix(&product)) return MYMAT_ERR_OVERFLOW;
+    *result = product;
+    return MYMAT_OK;
+}
+
+/* Multiply every element by a scalar */
+int mymat_mul_scalar(const mymat_matrix *source, double scalar, mymat_matrix *result) {
+    mymat_matrix scaled;
+
+    if (!source || !result) return MYMAT_ERR_NULL;
+    if (!is_finite_matrix(source) || isnan(scalar) || isinf(scalar)) return MYMAT_ERR_INVALID_INPUT;
+
+    SCALE_4X4(scaled.values, OPERAND(source), scalar);
+    if (!is_finite_matrix(&scaled)) return MYMAT_ERR_OVERFLOW;
+    *result = scaled;
+    return MYMAT_OK;
+}
+
+/* Transpose a matrix */
+int mymat_trans(const mymat_matrix *source, mymat_matrix *result) {
+    mymat_matrix transposed;
+
+    if (!source || !result) return MYMAT_ERR_NULL;
+    if (!is_finite_matrix(source)) return MYMAT_ERR_INVALID_INPUT;
+
+    TRANS_4X4(transposed.values, OPERAND(source));
+    *result = transposed;
+    return MYMAT_OK;
+}
+
+/* One of the two-operand library operations */
+typedef int (*binary_operation)(const mymat_matrix*, const mymat_matrix*, mymat_matrix*);
+
+/* Run a binary operation over caller-owned arrays, stopping at the first failure */
+static int run_binary_batch(binary_operation operation, const mymat_matrix *left,
+                            const mymat_matrix *right, mymat_matrix *result,
+                            size_t count, size_t *done) {
+    size_t i;
+    int status = MYMAT_OK;
+
+    if (!left || !right || !result) {
+        count = 0;
+        status = MYMAT_ERR_NULL;
+    }
+    for (i = 0; i < count; i++) {
+        status = operation(&left[i], &right[i], &result[i]);
+        if (status != MYMAT_OK) break;
+    }
+    if (done) *done = i;
+    return status;
+}
+
+/* Add pairs of matrices */
+int mymat_add_batch(const mymat_matrix *left, const mymat_matrix *right,
+                    mymat_matrix *result, size_t count, size_t *done) {
+    return run_binary_batch(mymat_add, left, right, result, count, done);
+}
+
+/* Subtract pairs of matrices */
+int mymat_sub_batch(const mymat_matrix *left, const mymat_matrix *right,
+                    mymat_matrix *result, size_t count, size_t *done) {
+    return run_binary_batch(mymat_sub, left, right, result, count, done);
+}
+
+/* Multiply pairs of matrices */
+int mymat_mul_batch(const mymat_matrix *left, const mymat_matrix *right,
+                    mymat_matrix *result, size_t count, size_t *done) {
+    return run_binary_batch(mymat_mul, left, right, result, count, done);
+}
+
+/* Scale matrices by one scalar */
+int mymat_mul_scalar_batch(const mymat_matrix *source, double scalar,
+                           mymat_matrix *result, size_t count, size_t *done) {
+    size_t i;
+    int status = MYMAT_OK;
+
+    if (!source || !result) {
+        count = 0;
+        status = MYMAT_ERR_NULL;
+    }
+    for (i = 0; i < count; i++) {
+        status = mymat_mul_scalar(&source[i], scalar, &result[i]);
+        if (status != MYMAT_OK) break;
+    }
+    if (done) *done = i;
+    return status;
+}
+
+/* Transpose matrices */
+int mymat_trans_batch(const mymat_matrix *source, mymat_matrix *result,
+                      size_t count, size_t *done) {
+    size_t i;
+    int status = MYMAT_OK;
+
+    if (!source || !result) {
+        count = 0;
+        status = MYMAT_ERR_NULL;
+    }
+    for (i = 0; i < count; i++) {
+        status = mymat_trans(&source[i], &result[i]);
+        if (status != MYMAT_OK) break;
+    }
+    if (done) *done = i;
+    return status;
+}
@@ -0,0 +1,145 @@
+#ifndef LIBMYMAT_H
+#define LIBMYMAT_H
+
+/*
+ * libmymat - the 4x4 matrix kernels of the matrix calculator as a C library
+ * Link with -lmymat (libmymat.a or libmymat.so) and -lm. The library never prints;
+ * every function reports errors through its return value. Matrices are plain caller-owned
+ * values, so the functions are safe to call from any number of threads at once.
+ */
+
+#include <stddef.h>
+
+#define LIBMYMAT_VERSION_MAJOR 1   /* Incremented for incompatible API or ABI changes */
+#define LIBMYMAT_VERSION_MINOR 0   /* Incremented for compatible additions */
+
+/* A 4x4 matrix, stored row by row */
+typedef struct mymat_matrix {
+    double values[4][4];
+} mymat_matrix;
+
+/* Status codes returned by the library functions */
+typedef enum mymat_status {
+    MYMAT_OK = 0,                   /* Success */
+    MYMAT_ERR_NULL = -1,            /* A required pointer argument is NULL */
+    MYMAT_ERR_INVALID_INPUT = -2,   /* An operand or scalar is NaN or infinite */
+    MYMAT_ERR_OVERFLOW = -3         /* The result is not finite; the target is unchanged */
+} mymat_status;
+
+/**
+ * @brief Gets the version of the library that is linked in
+ * @return LIBMYMAT_VERSION_MAJOR * 100 + LIBMYMAT_VERSION_MINOR of the library build;
+ *         compare it with the header's values to detect a mismatched shared library
+ */
+int mymat_version(void);
+
+/**
+ * @brief Gets a description of a status code
+ * @param status Value returned by a library function
+ * @return Static English text, such as "numeric overflow"
+ */
+const char* mymat_status_string(int status);
+
+/**
+ * @brief Sets every element of a matrix to zero
+ * @param target Matrix to clear
+ * @return MYMAT_OK, or MYMAT_ERR_NULL
+ */
+int mymat_zero(mymat_matrix *target);
+
+/**
+ * @brief Stores values row by row, like the read_mat command
+ * @param target Matrix receiving the values
+ * @param values Values to store
+ * @param count Number of values; elements past count keep their value and values past
+ *        the 16th are ignored
+ * @return MYMAT_OK, MYMAT_ERR_NULL, or MYMAT_ERR_INVALID_INPUT if any of the stored
+ *         values is NaN or infinite (the target is unchanged)
+ */
+int mymat_set_values(mymat_matrix *target, const double *values, size_t count);
+
+/**
+ * @brief Computes left + right
+ * @param left First operand
+ * @param right Second operand
+ * @param result Receives the sum; may be one of the operands
+ * @return MYMAT_OK, MYMAT_ERR_NULL, MYMAT_ERR_INVALID_INPUT or MYMAT_ERR_OVERFLOW;
+ *         the result is only written on success
+ */
+int mymat_add(const mymat_matrix *left, const mymat_matrix *right, mymat_matrix *result);
+
+/**
+ * @brief Computes left - right
+ * @param left Matrix subtracted from
+ * @param right Matrix subtracted
+ * @param result Receives the difference; may be one of the operands
+ * @return As for mymat_add
+ */
+int mymat_sub(const mymat_matrix *left, const mymat_matrix *right, mymat_matrix *result);
+
+/**
+ * @brief Computes the matrix product left * right
+ * @param left Left operand
+ * @param right Right operand
+ * @param result Receives the product; may be one of the operands
+ * @return As for mymat_add
+ */
+int mymat_mul(const mymat_matrix *left, const mymat_matrix *right, mymat_matrix *result);
+
+/**
+ * @brief Multiplies every element by a scalar
+ * @param source Matrix to scale
+ * @param scalar Factor
+ * @param result Receives the scaled matrix; may be the source
+ * @return As for mymat_add
+ */
+int mymat_mul_scalar(const mymat_matrix *source, double scalar, mymat_matrix *result);
+
+/**
+ * @brief Transposes a matrix
+ * @param source Matrix to transpose
+ * @param result Receives the transpose; may be the source
+ * @return MYMAT_OK, MYMAT_ERR_NULL or MYMAT_ERR_INVALID_INPUT
+ */
+int mymat_trans(const mymat_matrix *source, mymat_matrix *result);
+
+/* Batch entry points: element i of each caller-owned array forms one operation. They
+ * stop at the first operation that fails, return its status and store the number of
+ * operations completed in *done (if done is not NULL). */
+
+/**
+ * @brief Computes result[i] = left[i] + right[i] for count matrices
+ * @return MYMAT_OK if all succeeded, else the status of the first failure
+ */
+int mymat_add_batch(const mymat_matrix *left, const mymat_matrix *right,
+                    mymat_matrix *result, size_t count, size_t *done);
+
+/**
+ * @brief Computes result[i] = left[i] - right[i] for count matrices
+ * @return MYMAT_OK if all succeeded, else the status of the first failure
+ */
+int mymat_sub_batch(const mymat_matrix *left, const mymat_matrix *right,
+                    mymat_matrix *result, size_t count, size_t *done);
+
+/**
+ * @brief Computes result[i] = left[i] * right[i] for count matrices
+ * @return MYMAT_OK if all succeeded, else the status of the first failure
+ */
+int mymat_mul_batch(const mymat_matrix *left, const mymat_matrix *right,
+                    mymat_matrix *result, size_t count, size_t *done);
+
+/**
+ * @brief Computes result[i] = source[i] * scalar for count matrices
+ * @return MYMAT_OK if all succeeded, else the status of the first failure
+ */
+int mymat_mul_scalar_batch(const mymat_matrix *source, double scalar,
+                           mymat_matrix *result, size_t count, size_t *done);
+
+/**
+ * @brief Computes result[i] = transpose(source[i]) for count matrices
+ * @return MYMAT_OK if all succeeded, else the status of the first failure
+ */
+int mymat_trans_batch(const mymat_matrix *source, mymat_matrix *result,
+                      size_t count, size_t *done);
+
+#endif /* LIBMYMAT_H */
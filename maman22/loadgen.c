@@ -0,0 +1,200 @@
+/*
+ * Load generator for the matrix calculator server
+ * Opens concurrent client sessions against "mainmat --serve" and measures
+ * request throughput and latency percentiles.
+ *
+ * Usage: loadgen SOCKET [CLIENTS [REQUESTS_PER_CLIENT]]
+ *
+ * Each request is "mul_mat MAT_A, MAT_B, MAT_C" followed by "print_mat MAT_C";
+ * a request is complete when the 5 output lines of print_mat have arrived.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_CLIENTS 8
+#define DEFAULT_REQUESTS 10000
+#define RESPONSE_LINES 5   /* "Matrix contents:" plus 4 rows */
+
+static const char SETUP[] =
+    "read_mat MAT_A, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16\n"
+    "read_mat MAT_B, 0.5, 0, 0, 0, 0, 0.5, 0, 0, 0, 0, 0.5, 0, 0, 0, 0, 0.5\n";
+static const char REQUEST[] =
+    "mul_mat MAT_A, MAT_B, MAT_C\n"
+    "print_mat MAT_C\n";
+static const char STOP[] = "stop\n";
+
+/* Structure for the work and results of one client thread */
+typedef struct client_job {
+    const char *socket_path;
+    int requests;             /* Requests to send */
+    double *latencies;        /* Latency of each request in microseconds */
+    int completed;            /* Requests that received a full response */
+} client_job;
+
+/* Current monotonic time in microseconds */
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Connect to the server socket */
+static int connect_server(const char *socket_path) {
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) return -1;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Write the whole buffer */
+static int write_all(int fd, const char *data, size_t length) {
+    ssize_t written;
+
+    while (length > 0) {
+        written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += written;
+        length -= written;
+    }
+    return 1;
+}
+
+/* Read until the given number of newlines arrived */
+static int read_lines(int fd, int lines) {
+    char buffer[512];
+    ssize_t received, i;
+
+    while (lines > 0) {
+        received = read(fd, buffer, sizeof(buffer));
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return 0;
+        for (i = 0; i < received; i++) {
+            if (buffer[i] == '\n') lines--;
+        }
+    }
+    return 1;
+}
+
+/* Client thread: one session issuing requests back to back */
+static void* client_main(void *arg) {
+    client_job *job = (client_job*)arg;
+    double start;
+    int fd, i;
+
+    fd = connect_server(job->socket_path);
+    if (fd < 0) {
+        perror("connect");
+        return NULL;
+    }
+
+    if (!write_all(fd, SETUP, sizeof(SETUP) - 1)) {
+        close(fd);
+        return NULL;
+    }
+
+    for (i = 0; i < job->requests; i++) {
+        start = now_us();
+        if (!write_all(fd, REQUEST, sizeof(REQUEST) - 1) || !read_lines(fd, RESPONSE_LINES)) {
+            break;
+        }
+        job->latencies[i] = now_us() - start;
+        job->completed++;
+    }
+
+    write_all(fd, STOP, sizeof(STOP) - 1);
+    close(fd);
+    return NULL;
+}
+
+/* qsort comparator for doubles */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Value at the given percentile of a sorted array */
+static double percentile(const double *sorted, int count, double p) {
+    int index = (int)(p / 100.0 * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+int main(int argc, char *argv[]) {
+    client_job *jobs;
+    pthread_t *threads;
+    double *all, start, elapsed;
+    int clients = DEFAULT_CLIENTS, requests = DEFAULT_REQUESTS;
+    int i, j, total = 0;
+
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s SOCKET [CLIENTS [REQUESTS_PER_CLIENT]]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2) clients = atoi(argv[2]);
+    if (argc > 3) requests = atoi(argv[3]);
+    if (clients < 1 || requests < 1) {
+        fprintf(stderr, "Error: Client and request counts must be positive\n");
+        return 1;
+    }
+
+    jobs = (client_job*)calloc(clients, sizeof(client_job));
+    threads = (pthread_t*)calloc(clients, sizeof(pthread_t));
+    all = (double*)malloc((size_t)clients * requests * sizeof(double));
+    if (!jobs || !threads || !all) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return 1;
+    }
+
+    start = now_us();
+    for (i = 0; i < clients; i++) {
+        jobs[i].socket_path = argv[1];
+        jobs[i].requests = requests;
+        jobs[i].latencies = all + (size_t)i * requests;
+        pthread_create(&threads[i], NULL, client_main, &jobs[i]);
+    }
+    for (i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = now_us() - start;
+
+    /* Compact the completed latencies and sort them for percentiles */
+    for (i = 0; i < clients; i++) {
+        for (j = 0; j < jobs[i].completed; j++) {
+            all[total++] = jobs[i].latencies[j];
+        }
+    }
+    if (total == 0) {
+        fprintf(stderr, "Error: No request completed\n");
+        return 1;
+    }
+    qsort(all, total, sizeof(double), compare_doubles);
+
+    printf("clients: %d, requests: %d, elapsed: %.3f s\n", clients, total, elapsed / 1e6);
+    printf("throughput: %.0f requests/s\n", total / (elapsed / 1e6));
+    printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           percentile(all, total, 50), percentile(all, total, 99), all[total - 1]);
+
+    free(jobs);
+    free(threads);
+    free(all);
+    return total == clients * requests ? 0 : 1;
+}
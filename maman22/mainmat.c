@@ -1,11 +1,52 @@
 /*
  * Matrix Calculator Program
  * A simple command-line calculator for 4x4 matrix operations
+ *
+ * Usage: mainmat                                 read commands from standard input
+ *        mainmat --serve PATH [--workers N]      serve sessions on a Unix domain socket
+ *        mainmat [--workers N] --batch PATH...   run many script files concurrently
+ *
+ * Option --trace FILE writes a Chrome trace-event JSON of the run to FILE
+ * (requires a build with -DMYMAT_TRACE).
+ * Option --restore FILE starts from a snapshot written by save_state; in server and
+ * batch mode only the shared registers are restored, since sessions start empty.
+ * Option --record FILE writes every executed command to a binary command trace,
+ * and --replay FILE executes such a trace instead of reading standard input.
+ * Option --watch FILE runs a script file and re-runs it incrementally after every
+ * change to the file.
+ * Option --fp-flags makes the arithmetic kernels detect overflow with one test of the
+ * floating-point exception flags per command instead of a test per element.
+ * Option --batch PATH... (the last option) runs script files, and the scripts in
+ * directories, concurrently on --workers threads; each writes PATH.out.
+ * Option --tune benchmarks the tunable kernel and batch settings on this machine and
+ * writes the fastest to the tuning file, which every later run loads at startup. The
+ * file is $MAINMAT_TUNE, or mainmat.tune in the current directory; without it the
+ * built-in defaults are used.
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "mymat.h"
 #include "commands.h"
+#include "server.h"
+#include "shared.h"
+#include "stats.h"
+#include "trace.h"
+#include "output.h"
+#include "matfile.h"
+#include "replay.h"
+#include "watch.h"
+#include "batch.h"
+#include "tune.h"
+#include "alloc.h"
+
+/* Print command-line usage */
+static void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [--serve PATH [--workers N]] [--trace FILE] [--restore FILE] [--fp-flags]\n"
+            "       [--record FILE | --replay FILE | --watch FILE | --batch PATH...]\n"
+            "       %s --tune\n", program_name, program_name);
+}
 
 /* Main program - sets up matrices and starts the calculator */
 int main(int argc, char *argv[]) {
@@ -15,6 +56,100 @@ int main(int argc, char *argv[]) {
     /* Create an array of these matrices to maintain compatibility with existing functions */
     mat matrices[MAT_COUNT];
     
+    const char *serve_path = NULL, *trace_path = NULL, *restore_path = NULL;
+    const char *record_path = NULL, *replay_path = NULL, *watch_path = NULL;
+    int worker_count = DEFAULT_WORKER_COUNT;
+    int batch_first = 0, batch_count = 0;
+    int i;
+    
+    /* Settings tuned for this machine; an invalid file leaves the defaults in place */
+    load_tune_file(tune_file_path());
+    
+    /* Parse command-line options */
+    for (i = 1; i < argc; i++) {
+        if (argc == 2 && strcmp(argv[i], "--tune") == 0) {
+            return run_autotune(tune_file_path()) ? 0 : 1;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            worker_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watch_path = argv[++i];
+        } else if (strcmp(argv[i], "--fp-flags") == 0) {
+            set_fp_check_mode(FP_CHECK_FLAGS);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            /* All remaining arguments are scripts or directories */
+            batch_first = i + 1;
+            batch_count = argc - batch_first;
+            break;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    /* Recording and replaying are single-session features */
+    if ((record_path || replay_path) && serve_path) {
+        fprintf(stderr, "Error: --record and --replay cannot be used with --serve\n");
+        return 1;
+    }
+    
+    if (batch_count && (serve_path || record_path || replay_path || watch_path)) {
+        fprintf(stderr, "Error: --batch cannot be combined with --serve, --record, --replay or --watch\n");
+        return 1;
+    }
+    
+    /* Watch mode owns the registers and the instruction hook for all its runs */
+    if (watch_path && (serve_path || record_path || replay_path || restore_path)) {
+        fprintf(stderr, "Error: --watch cannot be combined with --serve, --record, --replay or --restore\n");
+        return 1;
+    }
+    
+    if (trace_path && !trace_start(trace_path)) {
+        return 1;
+    }
+    
+    /* Per-stage timing histograms are printed on exit in MYMAT_STATS builds */
+    stats_dump_at_exit();
+    /* So are allocation counts, peak and leaks in MYMAT_ALLOC_PROFILE builds */
+    alloc_report_at_exit();
+    
+    /* Shared registers SHR_A through SHR_F are visible to every session */
+    if (!init_shared_registers()) {
+        return 1;
+    }
+    
+    if (watch_path) {
+        i = watch_file(watch_path);
+        trace_finish();
+        free_shared_registers();
+        return i ? 0 : 1;
+    }
+    
+    /* Server and batch mode: every client session or script has its own registers */
+    if (serve_path || batch_count) {
+        if (restore_path && !load_state_file(restore_path, NULL)) {
+            free_shared_registers();
+            return 1;
+        }
+        if (serve_path) {
+            i = run_server(serve_path, worker_count) ? 0 : 1;
+        } else {
+            i = run_batch(argv + batch_first, batch_count, worker_count) ? 0 : 1;
+        }
+        trace_finish();
+        free_shared_registers();
+        return i;
+    }
+    
     /* Initialize all individual matrices to zero */
     MAT_A = initialize_mat();
     MAT_B = initialize_mat();
@@ -31,8 +166,29 @@ int main(int argc, char *argv[]) {
     matrices[4] = MAT_E;  /* MAT_E */
     matrices[5] = MAT_F;  /* MAT_F */
 
-    /* Start processing user commands */
-    process_commands(matrices);
+    if (restore_path && !load_state_file(restore_path, matrices)) {
+        free_shared_registers();
+        return 1;
+    }
+
+    /* Redirected output is written in large blocks */
+    configure_output_buffer(stdout);
+    
+    if (record_path && !record_start(record_path)) {
+        free_shared_registers();
+        return 1;
+    }
+    
+    /* Start processing user commands, or execute a recorded command trace */
+    i = 0;
+    if (replay_path) {
+        i = replay_file(replay_path, matrices) ? 0 : 1;
+    } else {
+        process_commands(matrices);
+    }
 
-    return 0;
+    record_finish();
+    trace_finish();
+    free_shared_registers();
+    return i;
 }
@@ -0,0 +1,62 @@
+#ifndef MAT_KERNELS_H
+#define MAT_KERNELS_H
+
+/*
+ * Fully unrolled 4x4 kernel bodies
+ * Each macro expands to straight-line code over double[4][4] arrays with no loops
+ * and no branches, so the compiler can keep operands in registers and vectorize.
+ * Results are bit-for-bit those of the equivalent loops; in particular dot products
+ * are summed from 0.0 in index order, like "sum = 0; sum += ...".
+ */
+
+/* Expand STEP(i, j) for every element, row by row */
+#define UNROLL_ROW(STEP, i) STEP(i, 0) STEP(i, 1) STEP(i, 2) STEP(i, 3)
+#define UNROLL_4X4(STEP) UNROLL_ROW(STEP, 0) UNROLL_ROW(STEP, 1) UNROLL_ROW(STEP, 2) UNROLL_ROW(STEP, 3)
+
+/* Row i of left times column j of right */
+#define DOT_4(left, right, i, j) \
+    (0.0 + (left)[i][0] * (right)[0][j] + (left)[i][1] * (right)[1][j] + \
+     (left)[i][2] * (right)[2][j] + (left)[i][3] * (right)[3][j])
+
+/* result = first + second */
+#define ADD_4X4(result, first, second) do { \
+    double (*kernel_r)[4] = (result); \
+    double (*kernel_a)[4] = (first), (*kernel_b)[4] = (second); \
+    UNROLL_4X4(ADD_ELEMENT_) \
+} while (0)
+#define ADD_ELEMENT_(i, j) kernel_r[i][j] = kernel_a[i][j] + kernel_b[i][j];
+
+/* result = left - right */
+#define SUB_4X4(result, left, right) do { \
+    double (*kernel_r)[4] = (result); \
+    double (*kernel_a)[4] = (left), (*kernel_b)[4] = (right); \
+    UNROLL_4X4(SUB_ELEMENT_) \
+} while (0)
+#define SUB_ELEMENT_(i, j) kernel_r[i][j] = kernel_a[i][j] - kernel_b[i][j];
+
+/* result = source * scalar */
+#define SCALE_4X4(result, source, scalar) do { \
+    double (*kernel_r)[4] = (result); \
+    double (*kernel_a)[4] = (source); \
+    double kernel_s = (scalar); \
+    UNROLL_4X4(SCALE_ELEMENT_) \
+} while (0)
+#define SCALE_ELEMENT_(i, j) kernel_r[i][j] = kernel_a[i][j] * kernel_s;
+
+/* result = left * right; result must not be one of the operands */
+#define MUL_4X4(result, left, right) do { \
+    double (*kernel_r)[4] = (result); \
+    double (*kernel_a)[4] = (left), (*kernel_b)[4] = (right); \
+    UNROLL_4X4(MUL_ELEMENT_) \
+} while (0)
+#define MUL_ELEMENT_(i, j) kernel_r[i][j] = DOT_4(kernel_a, kernel_b, i, j);
+
+/* result = transpose(source); result must not be the source */
+#define TRANS_4X4(result, source) do { \
+    double (*kernel_r)[4] = (result); \
+    double (*kernel_a)[4] = (source); \
+    UNROLL_4X4(TRANS_ELEMENT_) \
+} while (0)
+#define TRANS_ELEMENT_(i, j) kernel_r[j][i] = kernel_a[i][j];
+
+#endif /* MAT_KERNELS_H */
@@ -0,0 +1,481 @@
+#include "matfile.h"
+#include "output.h"
+#include "shared.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NPY_MAGIC "\x93NUMPY"
+#define NPY_MAGIC_LENGTH 6
+#define NPY_ALIGNMENT 64         /* Header plus preamble is padded to this many bytes */
+#define SMALL_FILE_BYTES 4096    /* Files up to this size are read, larger ones mapped */
+#define STATE_MAGIC "MATSNAP"    /* Snapshot magic, stored with its terminator */
+#define STATE_MAGIC_LENGTH 8
+#define STATE_HEADER_BYTES 24    /* Magic, version, register count, checksum, rows, columns, padding */
+#define STATE_NAME_BYTES 8       /* Zero-padded register name */
+#define STATE_RECORD_BYTES (STATE_NAME_BYTES + RAW_MAT_BYTES)
+
+/* Contents of a file being loaded */
+typedef struct file_data {
+    unsigned char *bytes;        /* File contents, either small or a mapping */
+    size_t size;
+    int mapped;                  /* bytes is an mmap of the file */
+    unsigned char small[SMALL_FILE_BYTES];
+} file_data;
+
+/* Layout of the values found in a file */
+typedef struct value_layout {
+    const unsigned char *data;   /* First element */
+    int big_endian;              /* Elements are stored most significant byte first */
+    int fortran_order;           /* Elements are stored column by column */
+} value_layout;
+
+/* Check whether the host stores doubles little-endian */
+static int host_is_little_endian(void) {
+    static const double PROBE = 1.0;   /* Sign and exponent live in the last byte on little-endian */
+    return ((const unsigned char*)&PROBE)[sizeof(double) - 1] != 0;
+}
+
+/* Read one double stored with the given byte order */
+static double get_double(const unsigned char *bytes, int big_endian) {
+    unsigned char swapped[sizeof(double)];
+    double value;
+    int i;
+
+    if (big_endian == !host_is_little_endian()) {
+        memcpy(&value, bytes, sizeof(double));
+        return value;
+    }
+    for (i = 0; i < (int)sizeof(double); i++) {
+        swapped[i] = bytes[sizeof(double) - 1 - i];
+    }
+    memcpy(&value, swapped, sizeof(double));
+    return value;
+}
+
+/* Store one double as 8 little-endian bytes */
+static void put_double(double value, unsigned char *dest) {
+    const unsigned char *bytes = (const unsigned char*)&value;
+    int little = host_is_little_endian();
+    int i;
+
+    for (i = 0; i < (int)sizeof(double); i++) {
+        dest[i] = little ? bytes[i] : bytes[sizeof(double) - 1 - i];
+    }
+}
+
+/* Read a little-endian 32-bit unsigned integer */
+static unsigned long get_uint32(const unsigned char *bytes) {
+    return bytes[0] | (unsigned long)bytes[1] << 8 | (unsigned long)bytes[2] << 16 |
+           (unsigned long)bytes[3] << 24;
+}
+
+/* Store a little-endian 32-bit unsigned integer */
+static void put_uint32(unsigned long value, unsigned char *dest) {
+    dest[0] = (unsigned char)(value & 0xff);
+    dest[1] = (unsigned char)(value >> 8 & 0xff);
+    dest[2] = (unsigned char)(value >> 16 & 0xff);
+    dest[3] = (unsigned char)(value >> 24 & 0xff);
+}
+
+/* Get the contents of a file: small files are read, larger ones mapped */
+static int open_file_data(const char *path, file_data *data) {
+    struct stat info;
+    int fd, ok;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0 || info.st_size == 0) {
+        out_printf("Error: Cannot read file '%s'\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    /* A mapping costs more system calls and a page fault, so small files are just read */
+    data->size = info.st_size;
+    data->mapped = info.st_size > SMALL_FILE_BYTES;
+    if (data->mapped) {
+        data->bytes = (unsigned char*)mmap(NULL, data->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = data->bytes != MAP_FAILED;
+    } else {
+        data->bytes = data->small;
+        ok = read(fd, data->small, data->size) == (ssize_t)data->size;
+    }
+    close(fd);
+    if (!ok) {
+        out_printf("Error: Cannot read file '%s'\n", path);
+    }
+    return ok;
+}
+
+/* Release the contents obtained with open_file_data */
+static void close_file_data(file_data *data) {
+    if (data->mapped) munmap(data->bytes, data->size);
+}
+
+/* Write a buffer to a file, replacing it atomically through a temporary file */
+static int write_file(const char *path, const unsigned char *buffer, size_t length) {
+    char *temporary = (char*)malloc(strlen(path) + 5);
+    FILE *file;
+    int ok;
+
+    if (!temporary) {
+        out_printf("Error: Cannot write file '%s'\n", path);
+        return 0;
+    }
+    sprintf(temporary, "%s.tmp", path);
+
+    file = fopen(temporary, "wb");
+    ok = file != NULL;
+    if (file) {
+        ok = fwrite(buffer, 1, length, file) == length;
+        if (fclose(file) != 0) ok = 0;
+    }
+    if (ok) ok = rename(temporary, path) == 0;
+    if (!ok) {
+        remove(temporary);
+        out_printf("Error: Cannot write file '%s'\n", path);
+    }
+    free(temporary);
+    return ok;
+}
+
+/* Find the value text following 'key': in a .npy header dictionary */
+static const char* find_header_value(const char *header, size_t length, const char *key) {
+    size_t key_length = strlen(key), i;
+
+    for (i = 0; i + key_length + 2 < length; i++) {
+        if (header[i] == '\'' && strncmp(header + i + 1, key, key_length) == 0 &&
+            header[i + 1 + key_length] == '\'') {
+            i += key_length + 2;
+            while (i < length && (header[i] == ' ' || header[i] == ':')) i++;
+            return i < length ? header + i : NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Number of dimensions of a shape tuple that is "(4, 4)" or "(16,)", the only shapes of
+ * a 4x4 matrix; 0 for any other shape */
+static int matrix_shape_rank(const char *shape, const char *end) {
+    long dimensions[2];
+    int count = 0;
+
+    if (shape >= end || *shape != '(') return 0;
+    shape++;
+    while (shape < end && *shape != ')') {
+        while (shape < end && (*shape == ' ' || *shape == ',')) shape++;
+        if (shape < end && *shape == ')') break;
+        if (count == 2 || shape >= end || !isdigit((unsigned char)*shape)) return 0;
+        /* Digits are parsed by hand: the header is not terminated, so strtol could
+         * read past its end */
+        dimensions[count] = 0;
+        while (shape < end && isdigit((unsigned char)*shape)) {
+            if (dimensions[count] > 16) return 0;
+            dimensions[count] = dimensions[count] * 10 + (*shape - '0');
+            shape++;
+        }
+        count++;
+    }
+    if (shape >= end) return 0;
+    if (count == 2 && dimensions[0] == 4 && dimensions[1] == 4) return 2;
+    if (count == 1 && dimensions[0] == 16) return 1;
+    return 0;
+}
+
+/* Check that a header value starts with text, without reading past the header's end */
+static int header_value_is(const char *value, const char *end, const char *text) {
+    size_t length = strlen(text);
+    return (size_t)(end - value) >= length && memcmp(value, text, length) == 0;
+}
+
+/* Parse a .npy header and locate the elements */
+static int parse_npy(const unsigned char *file, size_t size, value_layout *layout) {
+    const char *header, *descr, *order, *shape;
+    size_t header_length, offset;
+    int rank;
+
+    if (size < 10) return 0;
+    if (file[6] == 1) {
+        header_length = file[8] | (size_t)file[9] << 8;
+        offset = 10;
+    } else if ((file[6] == 2 || file[6] == 3) && size >= 12) {
+        header_length = file[8] | (size_t)file[9] << 8 | (size_t)file[10] << 16 | (size_t)file[11] << 24;
+        offset = 12;
+    } else {
+        out_printf("Error: Unsupported .npy version %d\n", file[6]);
+        return 0;
+    }
+    if (header_length > size - offset) {
+        out_printf("Error: Truncated .npy header\n");
+        return 0;
+    }
+
+    header = (const char*)file + offset;
+    descr = find_header_value(header, header_length, "descr");
+    order = find_header_value(header, header_length, "fortran_order");
+    shape = find_header_value(header, header_length, "shape");
+    if (!descr || !order || !shape) {
+        out_printf("Error: Malformed .npy header\n");
+        return 0;
+    }
+
+    if (header_value_is(descr, header + header_length, "'<f8'")) {
+        layout->big_endian = 0;
+    } else if (header_value_is(descr, header + header_length, "'>f8'")) {
+        layout->big_endian = 1;
+    } else {
+        out_printf("Error: Unsupported .npy dtype, expected float64\n");
+        return 0;
+    }
+    rank = matrix_shape_rank(shape, header + header_length);
+    if (rank == 0) {
+        out_printf("Error: .npy array must have shape (4, 4) or (16,)\n");
+        return 0;
+    }
+    /* A one-dimensional array has the same layout in either order */
+    layout->fortran_order = rank == 2 && header_value_is(order, header + header_length, "True");
+
+    offset += header_length;
+    if (size - offset < RAW_MAT_BYTES) {
+        out_printf("Error: Truncated .npy data\n");
+        return 0;
+    }
+    layout->data = file + offset;
+    return 1;
+}
+
+/* Load a matrix from a .npy or raw file */
+int load_mat_file(const char *path, mat *target_matrix) {
+    file_data file;
+    value_layout layout;
+    double values[16];
+    int ok, n, position;
+
+    if (!path || !target_matrix) {
+        out_printf("Error: Invalid arguments for load_mat\n");
+        return 0;
+    }
+    if (!open_file_data(path, &file)) {
+        return 0;
+    }
+
+    if (file.size >= NPY_MAGIC_LENGTH && memcmp(file.bytes, NPY_MAGIC, NPY_MAGIC_LENGTH) == 0) {
+        ok = parse_npy(file.bytes, file.size, &layout);
+    } else if (file.size == RAW_MAT_BYTES) {
+        layout.data = file.bytes;
+        layout.big_endian = 0;
+        layout.fortran_order = 0;
+        ok = 1;
+    } else {
+        out_printf("Error: '%s' is neither a .npy file nor %d bytes of raw doubles\n", path, RAW_MAT_BYTES);
+        ok = 0;
+    }
+
+    /* Elements are read in place from the file data; nothing is stored until all are valid */
+    for (n = 0; ok && n < 16; n++) {
+        position = layout.fortran_order ? (n % 4) * 4 + n / 4 : n;
+        values[position] = get_double(layout.data + n * sizeof(double), layout.big_endian);
+        if (isnan(values[position]) || isinf(values[position])) {
+            out_printf("Error: File contains invalid values (NaN or infinity)\n");
+            ok = 0;
+        }
+    }
+    close_file_data(&file);
+
+    if (ok) {
+        touch_mat(target_matrix);
+        for (n = 0; n < 16; n++) {
+            target_matrix->matrix[n / 4][n % 4] = values[n];
+        }
+    }
+    return ok;
+}
+
+/* Save a matrix as a .npy or raw file */
+int save_mat_file(const char *path, const mat *source_matrix) {
+    static const char DICT[] = "{'descr': '<f8', 'fortran_order': False, 'shape': (4, 4), }";
+    unsigned char buffer[NPY_ALIGNMENT * 2 + RAW_MAT_BYTES];
+    size_t length = 0, path_length, header_length, i;
+    int n;
+
+    if (!path || !source_matrix) {
+        out_printf("Error: Invalid arguments for save_mat\n");
+        return 0;
+    }
+
+    path_length = strlen(path);
+    if (path_length > 4 && strcmp(path + path_length - 4, ".npy") == 0) {
+        /* Version 1.0 header, space padded and newline terminated to the alignment */
+        header_length = sizeof(DICT) - 1 + 1;
+        header_length += (NPY_ALIGNMENT - (10 + header_length) % NPY_ALIGNMENT) % NPY_ALIGNMENT;
+        memcpy(buffer, NPY_MAGIC, NPY_MAGIC_LENGTH);
+        buffer[6] = 1;
+        buffer[7] = 0;
+        buffer[8] = (unsigned char)(header_length & 0xff);
+        buffer[9] = (unsigned char)(header_length >> 8);
+        memcpy(buffer + 10, DICT, sizeof(DICT) - 1);
+        for (i = 10 + sizeof(DICT) - 1; i < 10 + header_length - 1; i++) buffer[i] = ' ';
+        buffer[10 + header_length - 1] = '\n';
+        length = 10 + header_length;
+    }
+
+    for (n = 0; n < 16; n++) {
+        put_double(source_matrix->matrix[n / 4][n % 4], buffer + length);
+        length += sizeof(double);
+    }
+
+    return write_file(path, buffer, length);
+}
+
+/* FNV-1a hash of the snapshot records */
+static unsigned long state_checksum(const unsigned char *bytes, size_t length) {
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash = ((hash ^ bytes[i]) * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+/* Save all registers to a snapshot file */
+int save_state_file(const char *path, mat matrices[MAT_COUNT]) {
+    unsigned char buffer[STATE_HEADER_BYTES + REGISTER_COUNT * STATE_RECORD_BYTES];
+    unsigned char *record;
+    const mat *source;
+    int index, n;
+
+    if (!path || !matrices) {
+        out_printf("Error: Invalid arguments for save_state\n");
+        return 0;
+    }
+
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, STATE_MAGIC, STATE_MAGIC_LENGTH);
+    put_uint32(STATE_FORMAT_VERSION, buffer + 8);
+    put_uint32(REGISTER_COUNT, buffer + 12);
+    buffer[20] = 4;
+    buffer[21] = 4;
+
+    /* Shared registers are copied from one consistent snapshot each */
+    shared_read_lock();
+    for (index = 0; index < REGISTER_COUNT; index++) {
+        record = buffer + STATE_HEADER_BYTES + index * STATE_RECORD_BYTES;
+        source = index < MAT_COUNT ? &matrices[index] : shared_snapshot(index - MAT_COUNT);
+        strcpy((char*)record, get_matrix_name(index));
+        for (n = 0; n < 16; n++) {
+            put_double(source->matrix[n / 4][n % 4], record + STATE_NAME_BYTES + n * sizeof(double));
+        }
+    }
+    shared_read_unlock();
+
+    put_uint32(state_checksum(buffer + STATE_HEADER_BYTES, REGISTER_COUNT * STATE_RECORD_BYTES),
+               buffer + 16);
+    return write_file(path, buffer, sizeof(buffer));
+}
+
+/* Check a snapshot header and its records, storing the register index of each record */
+static int check_state(const char *path, const file_data *file, int indices[REGISTER_COUNT],
+                       unsigned long *count) {
+    const unsigned char *record;
+    char name[STATE_NAME_BYTES + 1];
+    unsigned long i, seen = 0;   /* Bit per register index already listed */
+    double value;
+    int n;
+
+    if (file->size < STATE_HEADER_BYTES || memcmp(file->bytes, STATE_MAGIC, STATE_MAGIC_LENGTH) != 0) {
+        out_printf("Error: '%s' is not a state snapshot\n", path);
+        return 0;
+    }
+    if (get_uint32(file->bytes + 8) != STATE_FORMAT_VERSION) {
+        out_printf("Error: Unsupported snapshot version %lu\n", get_uint32(file->bytes + 8));
+        return 0;
+    }
+
+    *count = get_uint32(file->bytes + 12);
+    if (*count > REGISTER_COUNT || file->bytes[20] != 4 || file->bytes[21] != 4 ||
+        file->size != STATE_HEADER_BYTES + *count * STATE_RECORD_BYTES) {
+        out_printf("Error: Snapshot '%s' has an invalid layout\n", path);
+        return 0;
+    }
+    if (get_uint32(file->bytes + 16) !=
+        state_checksum(file->bytes + STATE_HEADER_BYTES, *count * STATE_RECORD_BYTES)) {
+        out_printf("Error: Snapshot '%s' is corrupted (checksum mismatch)\n", path);
+        return 0;
+    }
+
+    for (i = 0; i < *count; i++) {
+        record = file->bytes + STATE_HEADER_BYTES + i * STATE_RECORD_BYTES;
+        memcpy(name, record, STATE_NAME_BYTES);
+        name[STATE_NAME_BYTES] = '\0';
+        indices[i] = get_matrix_index(name);
+        if (indices[i] < 0) {
+            out_printf("Error: Snapshot '%s' contains an unknown register\n", path);
+            return 0;
+        }
+        if (seen & 1UL << indices[i]) {
+            out_printf("Error: Snapshot '%s' lists register %s more than once\n", path, name);
+            return 0;
+        }
+        seen |= 1UL << indices[i];
+        for (n = 0; n < 16; n++) {
+            value = get_double(record + STATE_NAME_BYTES + n * sizeof(double), 0);
+            if (isnan(value) || isinf(value)) {
+                out_printf("Error: File contains invalid values (NaN or infinity)\n");
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Restore registers from a snapshot file */
+int load_state_file(const char *path, mat matrices[MAT_COUNT]) {
+    file_data file;
+    int indices[REGISTER_COUNT];
+    const unsigned char *record;
+    unsigned long count, i;
+    mat *target;
+    int n, ok;
+
+    if (!path) {
+        out_printf("Error: Invalid arguments for load_state\n");
+        return 0;
+    }
+    if (!open_file_data(path, &file)) {
+        return 0;
+    }
+
+    /* Nothing is stored unless the whole snapshot is valid */
+    ok = check_state(path, &file, indices, &count);
+    for (i = 0; ok && i < count; i++) {
+        if (indices[i] < MAT_COUNT) {
+            if (!matrices) continue;
+            target = &matrices[indices[i]];
+        } else {
+            target = shared_write_begin(indices[i] - MAT_COUNT);
+            if (!target) {
+                ok = 0;
+                break;
+            }
+        }
+
+        touch_mat(target);
+        record = file.bytes + STATE_HEADER_BYTES + i * STATE_RECORD_BYTES;
+        for (n = 0; n < 16; n++) {
+            target->matrix[n / 4][n % 4] = get_double(record + STATE_NAME_BYTES + n * sizeof(double), 0);
+        }
+
+        if (indices[i] >= MAT_COUNT) {
+            shared_write_commit(indices[i] - MAT_COUNT, target);
+        }
+    }
+    close_file_data(&file);
+    return ok;
+}
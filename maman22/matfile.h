@@ -0,0 +1,60 @@
+#ifndef MATFILE_H
+#define MATFILE_H
+
+#include "mymat.h"
+
+#define RAW_MAT_BYTES (16 * 8)   /* Raw file: 16 little-endian doubles, row-major */
+#define STATE_FORMAT_VERSION 1   /* Version written to state snapshots */
+
+/**
+ * @brief Loads a matrix from a NumPy .npy file or a raw binary file
+ * @param path File to load; files starting with the .npy magic are parsed as .npy,
+ *        anything else must be exactly RAW_MAT_BYTES of little-endian doubles
+ * @param target_matrix Matrix receiving the values
+ * @return 1 on success, 0 on failure (the matrix is left unchanged)
+ * @note Elements are decoded straight from the file data without text conversion; files
+ *       larger than a page (.npy files with long headers) are mapped with mmap instead of read
+ * @note Accepted .npy arrays are float64 ('<f8' or '>f8') of shape (4, 4) or (16,),
+ *       in C or Fortran order
+ * @warning Prints an error message for unreadable files, unsupported formats and
+ *          NaN or infinite values
+ */
+int load_mat_file(const char *path, mat *target_matrix);
+
+/**
+ * @brief Saves a matrix as a NumPy .npy file or a raw binary file
+ * @param path Output file; a name ending in ".npy" gets a version 1.0 .npy header
+ *        (dtype '<f8', shape (4, 4)), any other name gets the raw format
+ * @param source_matrix Matrix to save
+ * @return 1 on success, 0 on failure
+ * @warning Prints an error message if the file cannot be written
+ */
+int save_mat_file(const char *path, const mat *source_matrix);
+
+/**
+ * @brief Saves every private and shared register to a snapshot file
+ * @param path Output file, replaced atomically
+ * @param matrices Array of matrices (MAT_A through MAT_F)
+ * @return 1 on success, 0 on failure
+ * @note Format (all integers little-endian): "MATSNAP\0", format version (uint32),
+ *       register count (uint32), FNV-1a checksum of the records (uint32), rows (1 byte),
+ *       columns (1 byte), 2 zero bytes; then per register its zero-padded name (8 bytes)
+ *       followed by its elements row by row as little-endian doubles
+ * @warning Prints an error message if the file cannot be written
+ */
+int save_state_file(const char *path, mat matrices[MAT_COUNT]);
+
+/**
+ * @brief Restores the registers stored in a snapshot file
+ * @param path Snapshot written by save_state_file
+ * @param matrices Array of matrices (MAT_A through MAT_F), or NULL to restore only
+ *        the shared registers
+ * @return 1 on success, 0 on failure (no register is changed)
+ * @note The records are decoded in place from the file data, like load_mat_file;
+ *       registers missing from the snapshot keep their values
+ * @warning Prints an error message for unreadable, truncated or corrupted snapshots,
+ *          including one that lists a register more than once
+ */
+int load_state_file(const char *path, mat matrices[MAT_COUNT]);
+
+#endif /* MATFILE_H */
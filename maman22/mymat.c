@@ -1,8 +1,162 @@
 #include "mymat.h"
 #include "command_queue.h"
+#include "output.h"
+#include "shared.h"
+#include "mat_kernels.h"
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
+#include <fenv.h>
+#include <limits.h>
+#include <pthread.h>
+#include "alloc.h"   /* After the system headers: may redefine malloc and free */
+
+#define RESULT_EXCEPTIONS (FE_OVERFLOW | FE_INVALID)   /* Flags meaning a result is not finite */
+
+/* Philox4x32-10 counter-based generator used by rand_mat (Salmon et al., SC'11) */
+#define PHILOX_M0 0xD2511F53UL
+#define PHILOX_M1 0xCD9E8D57UL
+#define PHILOX_W0 0x9E3779B9UL
+#define PHILOX_W1 0xBB67AE85UL
+#define PHILOX_ROUNDS 10
+#define RAND_BLOCKS 8                 /* Philox outputs per matrix: 4 words make 2 elements */
+#define WORD_MASK 0xffffffffUL
+
+static const char *NORM_NAMES[] = { "fro", "1", "inf" };   /* Indexed by norm_kind */
+
+/* Workspace of mul_mat_sw: 15 blocks (S1-S4, T1-T4, M1-M7) per recursion level,
+ * for the 2x2 blocks of the 4x4 step and the 1x1 blocks of the 2x2 step */
+#define SW_WORKSPACE (15 * (2 * 2 + 1 * 1))
+
+/* Keep a result computed in memory before the exception flags are read; the compiler
+ * does not know that fetestexcept observes floating-point operations */
+#ifdef __GNUC__
+#define COMPLETE_RESULT(result) __asm__ __volatile__("" : : "m"(result) : "memory")
+#else
+#define COMPLETE_RESULT(result) ((void)0)
+#endif
+
+/* One rendered matrix, valid for the matrix contents with the given version */
+typedef struct print_cache_entry {
+    unsigned long version;
+    size_t length;
+    char text[PRINT_CACHE_TEXT];
+} print_cache_entry;
+
+static unsigned long last_version = 0;
+static fp_check_mode fp_checks = FP_CHECK_ELEMENTS;
+static int mul_unroll = MUL_UNROLL_DEFAULT;
+static int sw_cutoff = SW_CUTOFF_DEFAULT;
+static pthread_key_t print_cache_key;
+static pthread_once_t print_cache_once = PTHREAD_ONCE_INIT;
+
+/* Free a thread's print cache when the thread exits */
+static void free_print_cache(void *cache) {
+    free(cache);
+}
+
+/* Create the thread-specific key holding each thread's print cache */
+static void create_print_cache_key(void) {
+    pthread_key_create(&print_cache_key, free_print_cache);
+}
+
+/* Get the calling thread's print cache, allocating it on first use */
+static print_cache_entry* get_print_cache(void) {
+    print_cache_entry *cache;
+
+    pthread_once(&print_cache_once, create_print_cache_key);
+    cache = (print_cache_entry*)pthread_getspecific(print_cache_key);
+    if (!cache) {
+        cache = (print_cache_entry*)calloc(PRINT_CACHE_ENTRIES, sizeof(print_cache_entry));
+        if (cache) pthread_setspecific(print_cache_key, cache);
+    }
+    return cache;
+}
+
+/* Select how kernels detect overflow */
+void set_fp_check_mode(fp_check_mode mode) {
+    fp_checks = mode;
+}
+
+/* Get the overflow detection used by the kernels */
+fp_check_mode get_fp_check_mode(void) {
+    return fp_checks;
+}
+
+/* Select the mul_mat kernel; unsupported factors are rejected */
+int set_mul_unroll(int factor) {
+    if (factor != 1 && factor != 4 && factor != 16) return 0;
+    mul_unroll = factor;
+    return 1;
+}
+
+/* Get the unroll factor of the mul_mat kernel */
+int get_mul_unroll(void) {
+    return mul_unroll;
+}
+
+/* Select where the mul_mat_sw recursion stops; unsupported cutoffs are rejected */
+int set_sw_cutoff(int cutoff) {
+    if (cutoff != 1 && cutoff != 2 && cutoff != 4) return 0;
+    sw_cutoff = cutoff;
+    return 1;
+}
+
+/* Get the cutoff of the mul_mat_sw recursion */
+int get_sw_cutoff(void) {
+    return sw_cutoff;
+}
+
+/* Clear the flags checked by result_overflowed; clearing is much slower than testing
+ * (glibc also rewrites the x87 environment), and the flags stay clear until a result
+ * overflows, so they are only cleared when set */
+static void clear_result_exceptions(void) {
+    if (fetestexcept(RESULT_EXCEPTIONS)) {
+        feclearexcept(RESULT_EXCEPTIONS);
+    }
+}
+
+/* Check the exception flags after a result was computed with the flags cleared */
+static int result_overflowed(mat *result) {
+    COMPLETE_RESULT(*result);
+    return fetestexcept(RESULT_EXCEPTIONS) != 0;
+}
+
+/* Store a kernel result into the target, reporting a result that is not finite.
+ * In FP_CHECK_FLAGS mode the target is only written if the flags stay clear. In
+ * FP_CHECK_ELEMENTS mode the elements are stored in order up to the first that is not
+ * finite, which is stored too if store_failed is set, matching the per-element loops. */
+static void store_checked(mat *result, mat *target_matrix, int store_failed, const char *error) {
+    double value;
+    int n;
+
+    if (fp_checks == FP_CHECK_FLAGS) {
+        if (result_overflowed(result)) {
+            out_printf("%s", error);
+            return;
+        }
+        touch_mat(target_matrix);
+        memcpy(target_matrix->matrix, result->matrix, sizeof(target_matrix->matrix));
+        return;
+    }
+
+    touch_mat(target_matrix);
+    for (n = 0; n < 16; n++) {
+        value = result->matrix[n / 4][n % 4];
+        if (isnan(value) || isinf(value)) {
+            if (store_failed) target_matrix->matrix[n / 4][n % 4] = value;
+            out_printf("%s", error);
+            return;
+        }
+        target_matrix->matrix[n / 4][n % 4] = value;
+    }
+}
+
+/* Give a matrix a new version stamp; stamps are unique across all threads */
+void touch_mat(mat *MAT) {
+    MAT->version = __atomic_add_fetch(&last_version, 1, __ATOMIC_RELAXED);
+}
 
 /* Initialize a matrix with all zeros */
 mat initialize_mat(void) {
@@ -13,28 +167,41 @@ mat initialize_mat(void) {
             MAT.matrix[i][j] = 0;
         }
     }
+    touch_mat(&MAT);
     return MAT;
 }
 
-/* Convert matrix name like "MAT_A" to array index (0-5) */
+/* Convert matrix name like "MAT_A" to array index (0-5), "SHR_A" to a shared index */
 int get_matrix_index(const char *name) {
     if (!name) return -1;
     
-    /* Check if name follows "MAT_X" pattern where X is A-F */
-    if (strlen(name) == 5 && 
-        name[0] == 'M' && name[1] == 'A' && name[2] == 'T' && name[3] == '_') {
+    /* Check if name follows "MAT_X" or "SHR_X" pattern where X is A-F */
+    if (strlen(name) == 5 && name[3] == '_' && name[4] >= 'A' && name[4] <= 'F') {
         
         char matrix_letter = name[4];  /* Extract the last character */
         
-        /* Check if it's a valid matrix letter (A-F) */
-        if (matrix_letter >= 'A' && matrix_letter <= 'F') {
+        if (name[0] == 'M' && name[1] == 'A' && name[2] == 'T') {
             return matrix_letter - 'A';  /* ASCII arithmetic: A=0, B=1, C=2, etc. */
         }
+        if (name[0] == 'S' && name[1] == 'H' && name[2] == 'R') {
+            return MAT_COUNT + (matrix_letter - 'A');  /* Shared registers follow MAT_F */
+        }
     }
     
     return -1;  /* Invalid matrix name */
 }
 
+/* Get the name of a register from its index */
+const char* get_matrix_name(int index) {
+    static const char *NAMES[REGISTER_COUNT] = {
+        "MAT_A", "MAT_B", "MAT_C", "MAT_D", "MAT_E", "MAT_F",
+        "SHR_A", "SHR_B", "SHR_C", "SHR_D", "SHR_E", "SHR_F"
+    };
+    
+    if (index < 0 || index >= REGISTER_COUNT) return NULL;
+    return NAMES[index];
+}
+
 /* Get a pointer to the matrix by its name */
 mat* get_matrix_by_name(const char *name, mat matrices[MAT_COUNT]) {
     int index = get_matrix_index(name);
@@ -42,6 +209,9 @@ mat* get_matrix_by_name(const char *name, mat matrices[MAT_COUNT]) {
     if (index >= 0 && index < MAT_COUNT) {
         return &matrices[index];
     }
+    if (index >= MAT_COUNT && index < REGISTER_COUNT) {
+        return shared_snapshot(index - MAT_COUNT);
+    }
     
     return NULL;  /* Invalid matrix name */
 }
@@ -62,36 +232,28 @@ int is_matrix_valid(mat *matrix) {
     return 1;
 }
 
-/* Read numbers from command arguments and fill the matrix */
-void read_mat(arg_list *args, mat *target_matrix) {
+/* Parse the numbers that follow the matrix name in a read_mat argument list */
+int collect_mat_values(arg_list *args, double values[16], int *value_count, int *has_extra) {
     arg_node *current;
-    int i, j, num_count;
+    int num_count;
     double value;
     char *arg_value, *endptr;
     char *arg_copy; /* For safe string manipulation */
     
-    if (!args || !target_matrix) {
-        printf("Error: Invalid arguments for read_mat\n");
-        return;
-    }
+    *value_count = 0;
+    *has_extra = 0;
     
     current = get_first_argument(args);
     if (!current) {
-        printf("Error: Matrix name missing for read_mat\n");
-        return;
+        out_printf("Error: Matrix name missing for read_mat\n");
+        return 0;
     }
     
     /* Skip matrix name, get numbers */
     current = get_next_argument(current);
     num_count = 0;
     
-    /* Check if no numbers provided */
-    if (!current) {
-        printf("Note: No numbers provided - matrix remains unchanged\n");
-        return;
-    }
-    
-    /* Parse numbers and fill matrix sequentially */
+    /* Parse numbers in order, stopping after 16 */
     while (current && num_count < 16) {
         arg_value = get_argument_value(current);
         
@@ -99,8 +261,8 @@ void read_mat(arg_list *args, mat *target_matrix) {
         if (arg_value && strlen(arg_value) > 0) {
             arg_copy = (char*)malloc(strlen(arg_value) + 1);
             if (!arg_copy) {
-                printf("Error: Memory allocation failed during matrix reading\n");
-                return;
+                out_printf("Error: Memory allocation failed during matrix reading\n");
+                return 0;
             }
             strcpy(arg_copy, arg_value);
             
@@ -111,30 +273,28 @@ void read_mat(arg_list *args, mat *target_matrix) {
             
             value = strtod(arg_copy, &endptr);
             if (*endptr != '\0') {
-                printf("Error: Invalid number '%s' in read_mat\n", arg_copy);
+                out_printf("Error: Invalid number '%s' in read_mat\n", arg_copy);
                 free(arg_copy);
-                return;
+                return 0;
             }
             
             /* Check for overflow/underflow */
             if (value == HUGE_VAL || value == -HUGE_VAL) {
-                printf("Error: Numeric overflow in value '%s'\n", arg_copy);
+                out_printf("Error: Numeric overflow in value '%s'\n", arg_copy);
                 free(arg_copy);
-                return;
+                return 0;
             }
             
             /* Check for NaN or infinity */
             if (isnan(value) || isinf(value)) {
-                printf("Error: Invalid numeric value (NaN or infinity) in '%s'\n", arg_copy);
+                out_printf("Error: Invalid numeric value (NaN or infinity) in '%s'\n", arg_copy);
                 free(arg_copy);
-                return;
+                return 0;
             }
             
-            /* Fill matrix position by position (row by row) */
-            i = num_count / 4;  /* Row index */
-            j = num_count % 4;  /* Column index */
-            target_matrix->matrix[i][j] = value;
+            values[num_count] = value;
             num_count++;
+            *value_count = num_count;
             
             free(arg_copy);
         }
@@ -142,244 +302,755 @@ void read_mat(arg_list *args, mat *target_matrix) {
         current = get_next_argument(current);
     }
     
+    /* More than 16 arguments provided */
+    *has_extra = (current != NULL);
+    return 1;
+}
+
+/* Fill the matrix row by row from already parsed values */
+void fill_mat_values(mat *target_matrix, const double *values, int value_count, int has_extra) {
+    int n;
+    
+    if (!target_matrix || !values) {
+        out_printf("Error: Invalid arguments for read_mat\n");
+        return;
+    }
+    
+    /* Check if no numbers provided */
+    if (value_count == 0) {
+        out_printf("Note: No numbers provided - matrix remains unchanged\n");
+        return;
+    }
+    
+    /* Fill matrix position by position (row by row) */
+    touch_mat(target_matrix);
+    for (n = 0; n < value_count && n < 16; n++) {
+        target_matrix->matrix[n / 4][n % 4] = values[n];
+    }
+    
     /* Provide feedback about matrix filling */
-    if (num_count == 0) {
-        printf("Note: No valid numbers provided - matrix remains unchanged\n");
-    } else if (num_count < 16) {
-        printf("Note: Only %d out of 16 values provided - remaining positions unchanged\n", num_count);
-    } else if (current != NULL) {
-        /* More than 16 arguments provided */
-        printf("Note: Extra values beyond 16 were ignored\n");
+    if (value_count < 16) {
+        out_printf("Note: Only %d out of 16 values provided - remaining positions unchanged\n", value_count);
+    } else if (has_extra) {
+        out_printf("Note: Extra values beyond 16 were ignored\n");
     }
 }
 
+/* Read numbers from command arguments and fill the matrix */
+void read_mat(arg_list *args, mat *target_matrix) {
+    double values[16];
+    int value_count, has_extra, n;
+    
+    if (!args || !target_matrix) {
+        out_printf("Error: Invalid arguments for read_mat\n");
+        return;
+    }
+    
+    if (!collect_mat_values(args, values, &value_count, &has_extra)) {
+        /* Values parsed before the error are still stored */
+        touch_mat(target_matrix);
+        for (n = 0; n < value_count; n++) {
+            target_matrix->matrix[n / 4][n % 4] = values[n];
+        }
+        return;
+    }
+    
+    fill_mat_values(target_matrix, values, value_count, has_extra);
+}
+
 /* Print the matrix in a nice 4x4 format */
 void print_mat(mat *MAT) {
+    static const char HEADER[] = "Matrix contents:\n";
+    char text[sizeof(HEADER) + 16 * FORMATTED_VALUE_MAX + 4];
+    print_cache_entry *cache, *entry = NULL;
+    size_t length;
     int i, j;
     
     if (!MAT) {
-        printf("Error: Invalid matrix pointer for print_mat\n");
+        out_printf("Error: Invalid matrix pointer for print_mat\n");
         return;
     }
     
+    /* Unchanged matrix: copy the text rendered for this version */
+    cache = MAT->version ? get_print_cache() : NULL;
+    if (cache) {
+        entry = &cache[MAT->version % PRINT_CACHE_ENTRIES];
+        if (entry->version == MAT->version) {
+            out_write(entry->text, entry->length);
+            return;
+        }
+    }
+    
     /* Check for invalid values before printing */
     if (!is_matrix_valid(MAT)) {
-        printf("Error: Matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     
-    printf("Matrix contents:\n");
+    /* Format the whole matrix and write it at once */
+    memcpy(text, HEADER, sizeof(HEADER) - 1);
+    length = sizeof(HEADER) - 1;
     for (i = 0; i < 4; i++) {
         for (j = 0; j < 4; j++) {
-            printf("%8.2f ", MAT->matrix[i][j]);
+            length += format_fixed2(MAT->matrix[i][j], text + length);
+            text[length++] = ' ';
+        }
+        text[length++] = '\n';
+    }
+    out_write(text, length);
+    
+    if (entry && length <= PRINT_CACHE_TEXT) {
+        memcpy(entry->text, text, length);
+        entry->length = length;
+        entry->version = MAT->version;
+    }
+}
+
+/* Write a double as 8 little-endian bytes regardless of the host byte order */
+static void put_little_endian(double value, unsigned char *dest) {
+    static const double PROBE = 1.0;   /* Sign and exponent live in the last byte on little-endian */
+    unsigned char bytes[sizeof(double)];
+    int little = ((const unsigned char*)&PROBE)[sizeof(double) - 1] != 0;
+    int i;
+    
+    memcpy(bytes, &value, sizeof(double));
+    for (i = 0; i < (int)sizeof(double); i++) {
+        dest[i] = little ? bytes[i] : bytes[sizeof(double) - 1 - i];
+    }
+}
+
+/* Print a matrix in text, binary or exact mode */
+void print_mat_as(mat *MAT, const char *name, output_mode mode) {
+    char text[8 + 16 * ROUND_TRIP_VALUE_MAX + 2];
+    unsigned char *bytes = (unsigned char*)text;
+    size_t length = 0, name_length;
+    int n;
+    
+    if (mode == OUTPUT_TEXT) {
+        print_mat(MAT);
+        return;
+    }
+    
+    if (!MAT || !name) {
+        out_printf("Error: Invalid matrix pointer for print_mat\n");
+        return;
+    }
+    if (!is_matrix_valid(MAT)) {
+        out_printf("Error: Matrix contains invalid values (NaN or infinity)\n");
+        return;
+    }
+    
+    name_length = strlen(name);
+    if (mode == OUTPUT_BINARY) {
+        memcpy(bytes, "MATB", 4);
+        bytes[4] = 4;
+        bytes[5] = 4;
+        bytes[6] = (unsigned char)name_length;
+        memcpy(bytes + 7, name, name_length);
+        length = 7 + name_length;
+        for (n = 0; n < 16; n++) {
+            put_little_endian(MAT->matrix[n / 4][n % 4], bytes + length);
+            length += sizeof(double);
+        }
+    } else {
+        memcpy(text, name, name_length);
+        length = name_length;
+        for (n = 0; n < 16; n++) {
+            text[length++] = ' ';
+            length += format_round_trip(MAT->matrix[n / 4][n % 4], text + length);
+        }
+        text[length++] = '\n';
+    }
+    out_write(text, length);
+}
+
+/* Print a scalar result in text, binary or exact mode */
+void print_scalar_as(double value, const char *label, output_mode mode) {
+    char text[256 + ROUND_TRIP_VALUE_MAX + 8];
+    unsigned char *bytes = (unsigned char*)text;
+    size_t length, label_length = strlen(label);
+
+    if (label_length > 255) label_length = 255;
+    if (mode == OUTPUT_BINARY) {
+        /* A 1x1 frame in the print_mat_as format */
+        memcpy(bytes, "MATB", 4);
+        bytes[4] = 1;
+        bytes[5] = 1;
+        bytes[6] = (unsigned char)label_length;
+        memcpy(bytes + 7, label, label_length);
+        length = 7 + label_length;
+        put_little_endian(value, bytes + length);
+        length += sizeof(double);
+    } else {
+        memcpy(text, label, label_length);
+        length = label_length;
+        if (mode == OUTPUT_TEXT) {
+            memcpy(text + length, " =", 2);
+            length += 2;
         }
-        printf("\n");
+        text[length++] = ' ';
+        length += format_round_trip(value, text + length);
+        text[length++] = '\n';
     }
+    out_write(text, length);
 }
 
 /* Add two matrices together */
 void add_mat(mat *first_matrix, mat *second_matrix, mat *target_matrix) {
-    int i, j;
+    mat result;
     
     if (!first_matrix || !second_matrix || !target_matrix) {
-        printf("Error: Invalid matrix pointers for add_mat\n");
+        out_printf("Error: Invalid matrix pointers for add_mat\n");
         return;
     }
     
     /* Check for invalid values in source matrices */
     if (!is_matrix_valid(first_matrix)) {
-        printf("Error: First matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: First matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     if (!is_matrix_valid(second_matrix)) {
-        printf("Error: Second matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Second matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     
-    /* Matrix addition: dest[i][j] = first[i][j] + second[i][j] */
-    /* Safe to do in-place since addition doesn't depend on previous results */
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < 4; j++) {
-            target_matrix->matrix[i][j] = first_matrix->matrix[i][j] + second_matrix->matrix[i][j];
-            
-            /* Check for overflow in result */
-            if (isnan(target_matrix->matrix[i][j]) || isinf(target_matrix->matrix[i][j])) {
-                printf("Error: Numeric overflow occurred during matrix addition\n");
-                return;
-            }
-        }
-    }
+    /* Matrix addition: dest[i][j] = first[i][j] + second[i][j], computed into a
+     * local result so that in-place operation is safe */
+    if (fp_checks == FP_CHECK_FLAGS) clear_result_exceptions();
+    ADD_4X4(result.matrix, first_matrix->matrix, second_matrix->matrix);
+    store_checked(&result, target_matrix, 1,
+                  "Error: Numeric overflow occurred during matrix addition\n");
 }
 
 /* Subtract right matrix from left matrix */
 void sub_mat(mat *left_matrix, mat *right_matrix, mat *target_matrix) {
+    mat result;
+    int n;
     
     if (!left_matrix || !right_matrix || !target_matrix) {
-        printf("Error: Invalid matrix pointers for sub_mat\n");
+        out_printf("Error: Invalid matrix pointers for sub_mat\n");
         return;
     }
 
     /* Check for invalid values in source matrices */
     if (!is_matrix_valid(left_matrix)) {
-        printf("Error: Left matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Left matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     if (!is_matrix_valid(right_matrix)) {
-        printf("Error: Right matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Right matrix contains invalid values (NaN or infinity)\n");
         return;
     }
 
-    /* Step 1: temp_matrix = right_matrix * (-1) */
-    mul_scalar(right_matrix, -1, target_matrix);
-    
-    /* Step 2: target_matrix = left_matrix + temp_matrix */
-    /*         which equals: target_matrix = left_matrix - right_matrix */
-    add_mat(left_matrix, target_matrix, target_matrix);
+    /* left - right equals left + (right * -1) exactly, and overflows like that addition */
+    if (fp_checks == FP_CHECK_FLAGS) clear_result_exceptions();
+    SUB_4X4(result.matrix, left_matrix->matrix, right_matrix->matrix);
+
+    /* Per-element checks stop at the first overflow; the elements after it keep the
+     * negated right matrix, as computing right * -1 into the target first did */
+    if (fp_checks == FP_CHECK_ELEMENTS && !is_matrix_valid(&result)) {
+        for (n = 0; n < 16; n++) {
+            target_matrix->matrix[n / 4][n % 4] = -right_matrix->matrix[n / 4][n % 4];
+        }
+    }
+    store_checked(&result, target_matrix, 1,
+                  "Error: Numeric overflow occurred during matrix addition\n");
 }
 
-/* Multiply two matrices using standard matrix multiplication */
-void mul_mat(mat *left_matrix, mat *right_matrix, mat *target_matrix) {
-    mat temp_matrix;
+/* Matrix product with the loops over rows, columns and the dot product kept */
+static void mul_kernel_loops(double result[4][4], double left[4][4], double right[4][4]) {
+    double sum;
     int i, j, k;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            sum = 0;
+            for (k = 0; k < 4; k++) {
+                sum += left[i][k] * right[k][j];
+            }
+            result[i][j] = sum;
+        }
+    }
+}
+
+/* Matrix product with every dot product unrolled */
+static void mul_kernel_dots(double result[4][4], double left[4][4], double right[4][4]) {
+    int i, j;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            result[i][j] = DOT_4(left, right, i, j);
+        }
+    }
+}
+
+/* Compute a matrix product with the kernel selected by set_mul_unroll */
+static void mul_kernel(double result[4][4], double left[4][4], double right[4][4]) {
+    switch (mul_unroll) {
+        case 1:
+            mul_kernel_loops(result, left, right);
+            break;
+        case 4:
+            mul_kernel_dots(result, left, right);
+            break;
+        default:
+            MUL_4X4(result, left, right);
+            break;
+    }
+}
+
+/* A product kernel: mul_kernel or sw_kernel */
+typedef void (*mul_kernel_fn)(double result[4][4], double left[4][4], double right[4][4]);
+
+/* Sum of two n x n blocks of row-major arrays with leading dimensions lda, ldb, ldc */
+static void block_add(int n, const double *a, int lda, const double *b, int ldb, double *c, int ldc) {
+    int i, j;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) c[i * ldc + j] = a[i * lda + j] + b[i * ldb + j];
+    }
+}
+
+/* Difference of two n x n blocks */
+static void block_sub(int n, const double *a, int lda, const double *b, int ldb, double *c, int ldc) {
+    int i, j;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) c[i * ldc + j] = a[i * lda + j] - b[i * ldb + j];
+    }
+}
+
+/* Classic product of two n x n blocks, summed like mul_mat */
+static void block_mul(int n, const double *a, int lda, const double *b, int ldb, double *c, int ldc) {
     double sum;
+    int i, j, k;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            sum = 0;
+            for (k = 0; k < n; k++) sum += a[i * lda + k] * b[k * ldb + j];
+            c[i * ldc + j] = sum;
+        }
+    }
+}
+
+/* Strassen-Winograd product of n x n blocks: 7 half-size products and 15 additions.
+ * The half-size operands and products live in work, followed by the workspace of the
+ * next level, so the recursion never allocates. */
+static void sw_multiply(int n, const double *a, int lda, const double *b, int ldb,
+                        double *c, int ldc, double *work) {
+    int h = n / 2, size = h * h;
+    const double *a11 = a, *a12 = a + h, *a21 = a + h * lda, *a22 = a + h * lda + h;
+    const double *b11 = b, *b12 = b + h, *b21 = b + h * ldb, *b22 = b + h * ldb + h;
+    double *c11 = c, *c12 = c + h, *c21 = c + h * ldc, *c22 = c + h * ldc + h;
+    double *s1 = work, *s2 = s1 + size, *s3 = s2 + size, *s4 = s3 + size;
+    double *t1 = s4 + size, *t2 = t1 + size, *t3 = t2 + size, *t4 = t3 + size;
+    double *m1 = t4 + size, *m2 = m1 + size, *m3 = m2 + size, *m4 = m3 + size;
+    double *m5 = m4 + size, *m6 = m5 + size, *m7 = m6 + size, *next = m7 + size;
+
+    if (n <= sw_cutoff) {
+        block_mul(n, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    block_add(h, a21, lda, a22, lda, s1, h);
+    block_sub(h, s1, h, a11, lda, s2, h);
+    block_sub(h, a11, lda, a21, lda, s3, h);
+    block_sub(h, a12, lda, s2, h, s4, h);
+    block_sub(h, b12, ldb, b11, ldb, t1, h);
+    block_sub(h, b22, ldb, t1, h, t2, h);
+    block_sub(h, b22, ldb, b12, ldb, t3, h);
+    block_sub(h, t2, h, b21, ldb, t4, h);
+
+    sw_multiply(h, a11, lda, b11, ldb, m1, h, next);
+    sw_multiply(h, a12, lda, b21, ldb, m2, h, next);
+    sw_multiply(h, s4, h, b22, ldb, m3, h, next);
+    sw_multiply(h, a22, lda, t4, h, m4, h, next);
+    sw_multiply(h, s1, h, t1, h, m5, h, next);
+    sw_multiply(h, s2, h, t2, h, m6, h, next);
+    sw_multiply(h, s3, h, t3, h, m7, h, next);
+
+    /* U2 = M1 + M6, U3 = U2 + M7 and U4 = U2 + M5 reuse the storage of M6 and M7 */
+    block_add(h, m1, h, m2, h, c11, ldc);
+    block_add(h, m1, h, m6, h, m6, h);
+    block_add(h, m6, h, m7, h, m7, h);
+    block_add(h, m6, h, m5, h, m6, h);
+    block_add(h, m6, h, m3, h, c12, ldc);
+    block_sub(h, m7, h, m4, h, c21, ldc);
+    block_add(h, m7, h, m5, h, c22, ldc);
+}
+
+/* Compute a matrix product with Strassen-Winograd down to the set_sw_cutoff size */
+static void sw_kernel(double result[4][4], double left[4][4], double right[4][4]) {
+    double work[SW_WORKSPACE];
+
+    if (sw_cutoff >= 4) {
+        mul_kernel(result, left, right);
+        return;
+    }
+    sw_multiply(4, &left[0][0], 4, &right[0][0], 4, &result[0][0], 4, work);
+}
+
+/* Validate the operands of a product, compute it with the kernel and store it */
+static void mul_checked(mat *left_matrix, mat *right_matrix, mat *target_matrix,
+                        mul_kernel_fn kernel, const char *command_name) {
+    mat result;
     
     if (!left_matrix || !right_matrix || !target_matrix) {
-        printf("Error: Invalid matrix pointers for mul_mat\n");
+        out_printf("Error: Invalid matrix pointers for %s\n", command_name);
         return;
     }
     
     /* Check for invalid values in source matrices */
     if (!is_matrix_valid(left_matrix)) {
-        printf("Error: Left matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Left matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     if (!is_matrix_valid(right_matrix)) {
-        printf("Error: Right matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Right matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     
-    /* For matrix multiplication, we need to handle in-place operations carefully
-     * since each result element depends on entire rows and columns from source matrices.
-     * Use temporary matrix if destination overlaps with any source matrix. */
-    if (target_matrix == left_matrix || target_matrix == right_matrix) {
-        /* In-place operation: use temporary matrix to avoid data corruption */
-        
-        /* Perform multiplication into temporary matrix */
-        for (i = 0; i < 4; i++) {
-            for (j = 0; j < 4; j++) {
-                sum = 0;
-                for (k = 0; k < 4; k++) {
-                    sum += left_matrix->matrix[i][k] * right_matrix->matrix[k][j];
-                }
-                
-                /* Check for overflow in intermediate result */
-                if (isnan(sum) || isinf(sum)) {
-                    printf("Error: Numeric overflow occurred during matrix multiplication\n");
-                    return;
-                }
-                
-                temp_matrix.matrix[i][j] = sum;
-            }
-        }
-        
-        /* Copy result back to destination matrix */
-        for (i = 0; i < 4; i++) {
-            for (j = 0; j < 4; j++) {
-                target_matrix->matrix[i][j] = temp_matrix.matrix[i][j];
-            }
-        }
-    } else {
-        /* Different matrices: direct multiplication */
-        for (i = 0; i < 4; i++) {
-            for (j = 0; j < 4; j++) {
-                sum = 0;
-                for (k = 0; k < 4; k++) {
-                    sum += left_matrix->matrix[i][k] * right_matrix->matrix[k][j];
-                }
-                
-                /* Check for overflow in result */
-                if (isnan(sum) || isinf(sum)) {
-                    printf("Error: Numeric overflow occurred during matrix multiplication\n");
-                    return;
-                }
-                
-                target_matrix->matrix[i][j] = sum;
-            }
-        }
+    /* Each result element depends on a whole row and column of the sources, so the
+     * product is always computed into a local result first */
+    if (fp_checks == FP_CHECK_FLAGS) clear_result_exceptions();
+    kernel(result.matrix, left_matrix->matrix, right_matrix->matrix);
+
+    /* An in-place product used to be copied back only once complete */
+    if (fp_checks == FP_CHECK_ELEMENTS &&
+        (target_matrix == left_matrix || target_matrix == right_matrix) && !is_matrix_valid(&result)) {
+        touch_mat(target_matrix);
+        out_printf("Error: Numeric overflow occurred during matrix multiplication\n");
+        return;
     }
+    store_checked(&result, target_matrix, 0,
+                  "Error: Numeric overflow occurred during matrix multiplication\n");
+}
+
+/* Multiply two matrices using standard matrix multiplication */
+void mul_mat(mat *left_matrix, mat *right_matrix, mat *target_matrix) {
+    mul_checked(left_matrix, right_matrix, target_matrix, mul_kernel, "mul_mat");
+}
+
+/* Multiply two matrices using the Strassen-Winograd algorithm */
+void mul_mat_sw(mat *left_matrix, mat *right_matrix, mat *target_matrix) {
+    mul_checked(left_matrix, right_matrix, target_matrix, sw_kernel, "mul_mat_sw");
 }
 
 /* Multiply every element in the matrix by a scalar value */
 void mul_scalar(mat *source_matrix, double scalar, mat *target_matrix) {
-    int i, j;
-    double result;
+    mat result;
     
     if (!source_matrix || !target_matrix) {
-        printf("Error: Invalid matrix pointers for mul_scalar\n");
+        out_printf("Error: Invalid matrix pointers for mul_scalar\n");
         return;
     }
     
     /* Check for invalid values in source matrix */
     if (!is_matrix_valid(source_matrix)) {
-        printf("Error: Source matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Source matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     
     /* Check for invalid scalar */
     if (isnan(scalar) || isinf(scalar)) {
-        printf("Error: Invalid scalar value (NaN or infinity)\n");
+        out_printf("Error: Invalid scalar value (NaN or infinity)\n");
         return;
     }
     
     /* Scalar multiplication: dest[i][j] = source[i][j] * scalar */
-    /* Safe to do in-place since each element is independent */
-    for (i = 0; i < 4; i++) {
-        for (j = 0; j < 4; j++) {
-            result = source_matrix->matrix[i][j] * scalar;
-            
-            /* Check for overflow in result */
-            if (isnan(result) || isinf(result)) {
-                printf("Error: Numeric overflow occurred during scalar multiplication\n");
-                return;
-            }
-            
-            target_matrix->matrix[i][j] = result;
-        }
-    }
+    if (fp_checks == FP_CHECK_FLAGS) clear_result_exceptions();
+    SCALE_4X4(result.matrix, source_matrix->matrix, scalar);
+    store_checked(&result, target_matrix, 0,
+                  "Error: Numeric overflow occurred during scalar multiplication\n");
 }
 
 /* Transpose the matrix (flip it along the diagonal) */
 void trans_mat(mat *source_matrix, mat *target_matrix) {
-    int i, j;
-    double temp;
+    mat result;
     
     if (!source_matrix || !target_matrix) {
-        printf("Error: Invalid matrix pointers for trans_mat\n");
+        out_printf("Error: Invalid matrix pointers for trans_mat\n");
         return;
     }
     
     /* Check for invalid values in source matrix */
     if (!is_matrix_valid(source_matrix)) {
-        printf("Error: Source matrix contains invalid values (NaN or infinity)\n");
+        out_printf("Error: Source matrix contains invalid values (NaN or infinity)\n");
         return;
     }
     
-    if (source_matrix == target_matrix) {
-        /* In-place transpose: swap symmetric elements */
-        for (i = 0; i < 4; i++) {
-            for (j = i + 1; j < 4; j++) {
-                /* Swap matrix[i][j] with matrix[j][i] */
-                temp = source_matrix->matrix[i][j];
-                source_matrix->matrix[i][j] = source_matrix->matrix[j][i];
-                source_matrix->matrix[j][i] = temp;
-            }
+    /* Transposing through a local result also covers the in-place case */
+    TRANS_4X4(result.matrix, source_matrix->matrix);
+    touch_mat(target_matrix);
+    memcpy(target_matrix->matrix, result.matrix, sizeof(target_matrix->matrix));
+}
+
+/* Low 32 bits of the product of two 32-bit words, storing the high 32 bits in hi */
+static unsigned long mulhilo32(unsigned long a, unsigned long b, unsigned long *hi) {
+#if ULONG_MAX > WORD_MASK
+    unsigned long product = a * b;
+    *hi = product >> 32;
+    return product & WORD_MASK;
+#else
+    /* 32-bit long: assemble the high word from 16-bit partial products */
+    unsigned long low_low = (a & 0xffff) * (b & 0xffff);
+    unsigned long low_high = (a & 0xffff) * (b >> 16);
+    unsigned long high_low = (a >> 16) * (b & 0xffff);
+    unsigned long middle = (low_low >> 16) + (low_high & 0xffff) + (high_low & 0xffff);
+    *hi = (a >> 16) * (b >> 16) + (low_high >> 16) + (high_low >> 16) + (middle >> 16);
+    return a * b;
+#endif
+}
+
+/* Philox4x32-10 output for the counter (block, 0, 0, 0) and the given key. The counter
+ * is kept in locals so it stays in registers; the blocks of a matrix do not depend on
+ * each other, so the multiplications of consecutive blocks overlap in the pipeline. */
+static void philox4x32(unsigned long block, unsigned long key0, unsigned long key1,
+                       unsigned long words[4]) {
+    unsigned long word0 = block, word1 = 0, word2 = 0, word3 = 0;
+    unsigned long high0, high1, low0, low1;
+    int round;
+
+    for (round = 0; round < PHILOX_ROUNDS; round++) {
+        low0 = mulhilo32(PHILOX_M0, word0, &high0);
+        low1 = mulhilo32(PHILOX_M1, word2, &high1);
+        word0 = (high1 ^ word1 ^ key0) & WORD_MASK;
+        word2 = (high0 ^ word3 ^ key1) & WORD_MASK;
+        word1 = low1;
+        word3 = low0;
+        key0 = (key0 + PHILOX_W0) & WORD_MASK;
+        key1 = (key1 + PHILOX_W1) & WORD_MASK;
+    }
+    words[0] = word0;
+    words[1] = word1;
+    words[2] = word2;
+    words[3] = word3;
+}
+
+/* Fill the matrix with uniform random values in [0, 1) determined by the seed */
+void rand_mat(unsigned long seed, mat *target_matrix) {
+    unsigned long words[RAND_BLOCKS][4];
+    int block, n;
+
+    if (!target_matrix) {
+        out_printf("Error: Invalid matrix pointer for rand_mat\n");
+        return;
+    }
+
+    /* Block k of two elements is generated from counter k alone; the seed is the key */
+    for (block = 0; block < RAND_BLOCKS; block++) {
+        philox4x32((unsigned long)block, seed & WORD_MASK, (seed >> 16 >> 16) & WORD_MASK, words[block]);
+    }
+
+    /* 53 random bits per element, from 27 bits of one word and 26 of the next */
+    touch_mat(target_matrix);
+    for (n = 0; n < 16; n++) {
+        target_matrix->matrix[n / 4][n % 4] =
+            ((words[n / 2][n % 2 * 2] >> 5) * 67108864.0 + (words[n / 2][n % 2 * 2 + 1] >> 6)) *
+            (1.0 / 9007199254740992.0);
+    }
+}
+
+/* Set the matrix to the identity matrix */
+void ident_mat(mat *target_matrix) {
+    int n;
+
+    if (!target_matrix) {
+        out_printf("Error: Invalid matrix pointer for ident_mat\n");
+        return;
+    }
+
+    touch_mat(target_matrix);
+    for (n = 0; n < 16; n++) {
+        target_matrix->matrix[n / 4][n % 4] = n / 4 == n % 4 ? 1.0 : 0.0;
+    }
+}
+
+/* Set every element of the matrix to one value */
+void fill_mat(double value, mat *target_matrix) {
+    int n;
+
+    if (!target_matrix) {
+        out_printf("Error: Invalid matrix pointer for fill_mat\n");
+        return;
+    }
+
+    if (isnan(value) || isinf(value)) {
+        out_printf("Error: Invalid fill value (NaN or infinity)\n");
+        return;
+    }
+
+    touch_mat(target_matrix);
+    for (n = 0; n < 16; n++) {
+        target_matrix->matrix[n / 4][n % 4] = value;
+    }
+}
+
+/* Copy the elements of one matrix into another */
+void copy_mat(mat *source_matrix, mat *target_matrix) {
+    if (!source_matrix || !target_matrix) {
+        out_printf("Error: Invalid matrix pointers for copy_mat\n");
+        return;
+    }
+
+    touch_mat(target_matrix);
+    if (source_matrix != target_matrix) {
+        memcpy(target_matrix->matrix, source_matrix->matrix, sizeof(target_matrix->matrix));
+    }
+}
+
+/* Add a value to a Neumaier-compensated sum. The low-order bits lost by the addition go
+ * to the compensation whichever operand is larger; selects instead of a branch let the
+ * callers' independent lanes be vectorized. */
+static void neumaier_add(double *sum, double *compensation, double value) {
+    double total = *sum + value;
+    int sum_larger = fabs(*sum) >= fabs(value);
+    double larger = sum_larger ? *sum : value;
+    double smaller = sum_larger ? value : *sum;
+
+    *compensation += (larger - total) + smaller;
+    *sum = total;
+}
+
+/* Combine four compensated lanes into one value */
+static double combine_lanes(double sums[4], double compensations[4]) {
+    double total = 0, compensation = 0;
+    int lane;
+
+    for (lane = 0; lane < 4; lane++) {
+        neumaier_add(&total, &compensation, sums[lane]);
+        compensation += compensations[lane];
+    }
+    return total + compensation;
+}
+
+/* Check a reduction's source, printing an error if it cannot be reduced */
+static int reduction_source_valid(mat *source_matrix, double *result, const char *command_name) {
+    if (!source_matrix || !result) {
+        out_printf("Error: Invalid matrix pointer for %s\n", command_name);
+        return 0;
+    }
+    if (!is_matrix_valid(source_matrix)) {
+        out_printf("Error: Matrix contains invalid values (NaN or infinity)\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Store a reduction's value, printing an error if it overflowed */
+static int store_reduction(double value, double *result, const char *operation) {
+    if (isnan(value) || isinf(value)) {
+        out_printf("Error: Numeric overflow occurred during %s\n", operation);
+        return 0;
+    }
+    *result = value;
+    return 1;
+}
+
+/* Sum all elements with one compensated lane per column */
+int sum_mat(mat *source_matrix, double *result) {
+    double sums[4] = { 0, 0, 0, 0 }, compensations[4] = { 0, 0, 0, 0 };
+    int i, j;
+
+    if (!reduction_source_valid(source_matrix, result, "sum_mat")) return 0;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            neumaier_add(&sums[j], &compensations[j], source_matrix->matrix[i][j]);
         }
-    } else {
-        /* Different matrices: direct transpose */
-        for (i = 0; i < 4; i++) {
-            for (j = 0; j < 4; j++) {
-                target_matrix->matrix[j][i] = source_matrix->matrix[i][j];
-            }
+    }
+    return store_reduction(combine_lanes(sums, compensations), result, "matrix sum");
+}
+
+/* Sum the diagonal elements with compensation */
+int trace_mat(mat *source_matrix, double *result) {
+    double sum = 0, compensation = 0;
+    int i;
+
+    if (!reduction_source_valid(source_matrix, result, "trace_mat")) return 0;
+
+    for (i = 0; i < 4; i++) {
+        neumaier_add(&sum, &compensation, source_matrix->matrix[i][i]);
+    }
+    return store_reduction(sum + compensation, result, "matrix trace");
+}
+
+/* Compensated sum of the squared elements divided by scale, with the largest magnitude */
+static double sum_of_squares(mat *source_matrix, double scale, double *largest) {
+    double sums[4] = { 0, 0, 0, 0 }, compensations[4] = { 0, 0, 0, 0 };
+    double maxima[4] = { 0, 0, 0, 0 }, scaled;
+    int i, j;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            scaled = source_matrix->matrix[i][j] / scale;
+            neumaier_add(&sums[j], &compensations[j], scaled * scaled);
+            maxima[j] = fabs(source_matrix->matrix[i][j]) > maxima[j] ?
+                        fabs(source_matrix->matrix[i][j]) : maxima[j];
         }
     }
+    *largest = maxima[0];
+    for (j = 1; j < 4; j++) {
+        if (maxima[j] > *largest) *largest = maxima[j];
+    }
+    return combine_lanes(sums, compensations);
+}
+
+/* Largest compensated sum of magnitudes over the columns (by_rows 0) or rows (by_rows 1) */
+static double largest_abs_sum(mat *source_matrix, int by_rows) {
+    double sums[4] = { 0, 0, 0, 0 }, compensations[4] = { 0, 0, 0, 0 }, largest, total;
+    int i, j;
+
+    /* Lane j accumulates column j, or row j when by_rows is set */
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            neumaier_add(&sums[j], &compensations[j],
+                         fabs(by_rows ? source_matrix->matrix[j][i] : source_matrix->matrix[i][j]));
+        }
+    }
+    largest = sums[0] + compensations[0];
+    for (j = 1; j < 4; j++) {
+        total = sums[j] + compensations[j];
+        if (total > largest) largest = total;
+    }
+    return largest;
+}
+
+/* Compute the Frobenius, 1- or infinity norm */
+int norm_mat(mat *source_matrix, norm_kind kind, double *result) {
+    double squares, largest, scale = 1.0;
+
+    if (!reduction_source_valid(source_matrix, result, "norm_mat")) return 0;
+
+    if (kind == NORM_ONE) {
+        return store_reduction(largest_abs_sum(source_matrix, 0), result, "matrix norm");
+    }
+    if (kind == NORM_INF) {
+        return store_reduction(largest_abs_sum(source_matrix, 1), result, "matrix norm");
+    }
+
+    /* One pass normally; squares that overflow (leaving an infinite or NaN sum) or
+     * underflow are summed again scaled by the largest magnitude, which keeps every
+     * scaled square at most 1 */
+    squares = sum_of_squares(source_matrix, 1.0, &largest);
+    if (largest > 0 && !(squares >= DBL_MIN && squares <= DBL_MAX)) {
+        scale = largest;
+        squares = sum_of_squares(source_matrix, scale, &largest);
+    }
+    return store_reduction(scale * sqrt(squares), result, "matrix norm");
+}
+
+/* Convert a norm name to a norm kind */
+int parse_norm_kind(const char *name) {
+    int kind;
+
+    if (!name) return -1;
+    for (kind = 0; kind < (int)(sizeof(NORM_NAMES) / sizeof(NORM_NAMES[0])); kind++) {
+        if (strcmp(name, NORM_NAMES[kind]) == 0) return kind;
+    }
+    return -1;
+}
+
+/* Get the name of a norm kind */
+const char* get_norm_name(norm_kind kind) {
+    return NORM_NAMES[kind];
 }
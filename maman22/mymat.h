@@ -3,13 +3,34 @@
 
 #include <stdio.h>
 #include "command_queue.h"
+#include "output.h"
 
 #define MAT_COUNT 6  /* Number of matrices (A through F) */
+#define SHARED_COUNT 6  /* Number of shared registers (SHR_A through SHR_F) */
+#define REGISTER_COUNT (MAT_COUNT + SHARED_COUNT)  /* Private and shared register indices */
+#define MUL_UNROLL_DEFAULT 16  /* mul_mat kernel used until set_mul_unroll is called */
+#define SW_CUTOFF_DEFAULT 2    /* mul_mat_sw cutoff used until set_sw_cutoff is called */
 
 typedef struct mat {
     double matrix[4][4];
+    unsigned long version;  /* Unique stamp of the current contents, 0 if unknown */
 } mat;
 
+/* Norms computed by norm_mat */
+typedef enum norm_kind {
+    NORM_FROBENIUS,   /* "fro": square root of the sum of squared elements */
+    NORM_ONE,         /* "1": largest sum of magnitudes over the columns */
+    NORM_INF          /* "inf": largest sum of magnitudes over the rows */
+} norm_kind;
+
+/* How add_mat, sub_mat, mul_mat and mul_scalar detect a result that is not finite */
+typedef enum fp_check_mode {
+    FP_CHECK_ELEMENTS,      /* Test every element as it is computed; stops at the first bad one */
+    FP_CHECK_FLAGS          /* Clear the FE_OVERFLOW and FE_INVALID flags, compute all elements
+                               without branches and test the flags once; the target is left
+                               unmodified on error */
+} fp_check_mode;
+
 /* Matrix management functions */
 
 /**
@@ -19,20 +40,81 @@ typedef struct mat {
  */
 mat initialize_mat(void);
 
+/**
+ * @brief Gives a matrix a new unique version stamp after its contents changed
+ * @param MAT Matrix that was modified
+ * @note Every write through the kernels and read_mat calls this; code that writes
+ *       matrix elements directly must call it too, or set version to 0
+ */
+void touch_mat(mat *MAT);
+
+/**
+ * @brief Selects how the arithmetic kernels detect overflow, for all threads
+ * @param mode FP_CHECK_ELEMENTS (the default) or FP_CHECK_FLAGS
+ * @note Both modes print the same error messages; set the mode before any kernel runs
+ */
+void set_fp_check_mode(fp_check_mode mode);
+
+/**
+ * @brief Gets the overflow detection used by the arithmetic kernels
+ * @return The mode set with set_fp_check_mode
+ */
+fp_check_mode get_fp_check_mode(void);
+
+/**
+ * @brief Selects the mul_mat kernel, for all threads
+ * @param factor Unrolling: 1 (plain loops), 4 (each dot product of 4 terms unrolled)
+ *        or 16 (all 16 dot products unrolled into straight-line code, the default)
+ * @return 1 on success, 0 for an unsupported factor (the kernel is unchanged)
+ * @note Every kernel sums each dot product in the same order, so results are identical;
+ *       only the speed differs between machines. Set it before any kernel runs.
+ */
+int set_mul_unroll(int factor);
+
+/**
+ * @brief Gets the unroll factor of the mul_mat kernel
+ * @return The factor set with set_mul_unroll
+ */
+int get_mul_unroll(void);
+
+/**
+ * @brief Selects where the mul_mat_sw recursion stops, for all threads
+ * @param cutoff Largest block size multiplied classically: 4 (no recursion, the
+ *        mul_mat kernel), 2 (one Strassen-Winograd step, the default) or 1 (two steps)
+ * @return 1 on success, 0 for an unsupported cutoff (the setting is unchanged)
+ * @note Set it before any kernel runs
+ */
+int set_sw_cutoff(int cutoff);
+
+/**
+ * @brief Gets the cutoff of the mul_mat_sw recursion
+ * @return The cutoff set with set_sw_cutoff
+ */
+int get_sw_cutoff(void);
+
 /**
  * @brief Converts matrix name to array index using ASCII arithmetic
- * @param name Matrix name in format "MAT_X" where X is A-F
- * @return Index (0-5) for valid matrix names, -1 for invalid names
+ * @param name Matrix name in format "MAT_X" or "SHR_X" where X is A-F
+ * @return Index (0-5) for MAT_X, MAT_COUNT + (0-5) for shared SHR_X, -1 for invalid names
  * @note Provides O(1) lookup time using ASCII arithmetic
  * @warning Returns -1 if name is NULL or doesn't follow the expected format
  */
 int get_matrix_index(const char *name);
 
+/**
+ * @brief Gets the name of a register
+ * @param index Register index as returned by get_matrix_index
+ * @return Name such as "MAT_A" or "SHR_C", or NULL for an invalid index
+ */
+const char* get_matrix_name(int index);
+
 /**
  * @brief Gets a matrix pointer by name from the matrices array
- * @param name Matrix name in format "MAT_X" where X is A-F
+ * @param name Matrix name in format "MAT_X" or "SHR_X" where X is A-F
  * @param matrices Array of matrices (MAT_A through MAT_F)
  * @return Pointer to the requested matrix, or NULL if name is invalid
+ * @note For a shared register this is the current read-only snapshot, valid only
+ *       inside a shared_read_lock section; updates go through shared_write_begin
  * @warning Returns NULL if name is invalid or index is out of bounds
  */
 mat* get_matrix_by_name(const char *name, mat matrices[MAT_COUNT]);
@@ -56,6 +138,27 @@ int is_matrix_valid(mat *matrix);
  */
 void read_mat(arg_list *args, mat *MAT);
 
+/**
+ * @brief Parses the numeric arguments of a read_mat command without touching any matrix
+ * @param args Argument list containing matrix name and up to 16 numeric values
+ * @param values Output array receiving the parsed values in row-major order
+ * @param value_count Output: number of values successfully parsed
+ * @param has_extra Output: non-zero if more than 16 values were supplied
+ * @return 1 on success, 0 if a value could not be parsed (values before it remain valid)
+ * @warning Prints error messages for invalid numbers or missing matrix name
+ */
+int collect_mat_values(arg_list *args, double values[16], int *value_count, int *has_extra);
+
+/**
+ * @brief Fills the target matrix row by row from already parsed values
+ * @param target_matrix Matrix to be filled
+ * @param values Parsed values in row-major order
+ * @param value_count Number of values to store (at most 16 are used)
+ * @param has_extra Non-zero if more than 16 values were originally supplied
+ * @note Prints the same notes as read_mat about missing or extra values
+ */
+void fill_mat_values(mat *target_matrix, const double *values, int value_count, int has_extra);
+
 /**
  * @brief Prints matrix contents in formatted output
  * @param MAT Pointer to matrix to be printed
@@ -64,6 +167,32 @@ void read_mat(arg_list *args, mat *MAT);
  */
 void print_mat(mat *MAT);
 
+/**
+ * @brief Prints a matrix in the given output mode
+ * @param MAT Pointer to the matrix to print
+ * @param name Register name written by the binary and exact modes
+ * @param mode OUTPUT_TEXT prints exactly like print_mat; OUTPUT_EXACT prints one line
+ *        "NAME v1 ... v16" with shortest round-trip decimals; OUTPUT_BINARY writes the
+ *        bytes "MATB", rows (1 byte), columns (1 byte), name length (1 byte), the name,
+ *        then the elements row by row as little-endian IEEE 754 doubles
+ * @note Errors are reported as text in every mode
+ */
+void print_mat_as(mat *MAT, const char *name, output_mode mode);
+
+/**
+ * @brief Prints a scalar result in the given output mode
+ * @param value Finite value to print
+ * @param label Name of the value, such as "sum(MAT_A)"
+ * @param mode OUTPUT_TEXT prints "LABEL = VALUE" and OUTPUT_EXACT prints "LABEL VALUE",
+ *        both with the shortest round-trip decimal; OUTPUT_BINARY writes a 1x1 frame in
+ *        the print_mat_as format with the label as its name
+ */
+void print_scalar_as(double value, const char *label, output_mode mode);
+
+/* Rendered print_mat texts kept per thread, looked up by version stamp */
+#define PRINT_CACHE_ENTRIES 16
+#define PRINT_CACHE_TEXT 192    /* Longer renderings are not cached */
+
 /**
  * @brief Performs matrix addition: dest_matrix = first_matrix + second_matrix
  * @param first_matrix First input matrix for addition
@@ -95,6 +224,20 @@ void sub_mat(mat *left_matrix, mat *right_matrix, mat *dest_matrix);
  */
 void mul_mat(mat *left_matrix, mat *right_matrix, mat *dest_matrix);
 
+/**
+ * @brief Performs matrix multiplication with the Strassen-Winograd algorithm
+ * @param left_matrix Left operand matrix for multiplication
+ * @param right_matrix Right operand matrix for multiplication
+ * @param dest_matrix Result matrix (can be same as input for in-place operation)
+ * @note Splits the operands into 2x2 blocks and forms the product from 7 block
+ *       products and 15 block additions, recursing down to the set_sw_cutoff size
+ * @note Not bit-identical to mul_mat: the error bound grows with each recursion step
+ *       (see the error rows of bench/microbench). Overflow is reported like mul_mat,
+ *       but the intermediate sums can overflow for results that mul_mat can represent.
+ * @warning Prints error message if any matrix pointer is NULL
+ */
+void mul_mat_sw(mat *left_matrix, mat *right_matrix, mat *dest_matrix);
+
 /**
  * @brief Performs scalar multiplication: dest_matrix = source_matrix * scalar
  * @param source_matrix Input matrix to be multiplied by scalar
@@ -115,5 +258,85 @@ void mul_scalar(mat *source_matrix, double scalar, mat *dest_matrix);
  */
 void trans_mat(mat *source_matrix, mat *dest_matrix);
 
+/**
+ * @brief Fills a matrix with uniform pseudo-random values in [0, 1)
+ * @param seed Seed; the same seed always gives the same matrix, on every platform
+ * @param dest_matrix Matrix to fill
+ * @note Values come from the counter-based Philox4x32-10 generator keyed with the
+ *       seed: element pair k is generated from counter k alone, so the blocks are
+ *       independent and need no generator state between commands
+ * @warning Prints error message if the matrix pointer is NULL
+ */
+void rand_mat(unsigned long seed, mat *dest_matrix);
+
+/**
+ * @brief Sets a matrix to the identity matrix
+ * @param dest_matrix Matrix to set
+ * @warning Prints error message if the matrix pointer is NULL
+ */
+void ident_mat(mat *dest_matrix);
+
+/**
+ * @brief Sets every element of a matrix to the same value
+ * @param value Value to store
+ * @param dest_matrix Matrix to fill (left unchanged if value is NaN or infinite)
+ * @warning Prints error message if the matrix pointer is NULL or the value is not finite
+ */
+void fill_mat(double value, mat *dest_matrix);
+
+/**
+ * @brief Copies a matrix: dest_matrix = source_matrix
+ * @param source_matrix Matrix to copy
+ * @param dest_matrix Matrix receiving the elements (can be the source)
+ * @note The elements are copied with one memcpy, without validation or conversion
+ * @warning Prints error message if any matrix pointer is NULL
+ */
+void copy_mat(mat *source_matrix, mat *dest_matrix);
+
+/* Reductions: one pass over the elements in four independent lanes, each a Neumaier
+ * (improved Kahan) compensated sum, so the result carries almost no rounding error. */
+
+/**
+ * @brief Sums all elements of a matrix
+ * @param source_matrix Matrix to sum
+ * @param result Receives the sum
+ * @return 1 on success, 0 after printing an error for a NULL pointer, an element that is
+ *         NaN or infinite, or a sum that overflows
+ */
+int sum_mat(mat *source_matrix, double *result);
+
+/**
+ * @brief Sums the diagonal elements of a matrix
+ * @param source_matrix Matrix whose trace is computed
+ * @param result Receives the trace
+ * @return As for sum_mat
+ */
+int trace_mat(mat *source_matrix, double *result);
+
+/**
+ * @brief Computes a norm of a matrix
+ * @param source_matrix Matrix whose norm is computed
+ * @param kind NORM_FROBENIUS, NORM_ONE or NORM_INF
+ * @param result Receives the norm
+ * @return As for sum_mat
+ * @note The Frobenius norm is rescaled by the largest magnitude when the squares overflow
+ *       or underflow, so it is accurate for every matrix whose norm is representable
+ */
+int norm_mat(mat *source_matrix, norm_kind kind, double *result);
+
+/**
+ * @brief Converts a norm name ("fro", "1" or "inf") to a norm kind
+ * @param name Norm name
+ * @return The norm kind, or -1 if the name is not a norm
+ */
+int parse_norm_kind(const char *name);
+
+/**
+ * @brief Gets the name of a norm kind
+ * @param kind Norm kind
+ * @return "fro", "1" or "inf"
+ */
+const char* get_norm_name(norm_kind kind);
+
 #endif /* MYMAT_H */
 
@@ -0,0 +1,152 @@
+#include "output.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define FIXED2_FAST_LIMIT 4e7     /* Above this, value * 100 may not fit an unsigned long */
+#define FIXED2_WIDTH 8            /* Field width of "%8.2f" */
+
+static const char *MODE_NAMES[] = { "text", "binary", "exact" };
+static const output_mode MODES[] = { OUTPUT_TEXT, OUTPUT_BINARY, OUTPUT_EXACT };
+
+static pthread_key_t output_key;
+static pthread_key_t mode_key;     /* Points into MODES, NULL for OUTPUT_TEXT */
+static pthread_once_t output_key_once = PTHREAD_ONCE_INIT;
+
+/* Create the thread-specific keys holding each thread's output stream and mode */
+static void create_output_key(void) {
+    pthread_key_create(&output_key, NULL);
+    pthread_key_create(&mode_key, NULL);
+}
+
+/* Set the output stream of the calling thread */
+void set_output_stream(FILE *stream) {
+    pthread_once(&output_key_once, create_output_key);
+    pthread_setspecific(output_key, stream);
+}
+
+/* Get the output stream of the calling thread, stdout by default */
+FILE* get_output_stream(void) {
+    FILE *stream;
+
+    pthread_once(&output_key_once, create_output_key);
+    stream = (FILE*)pthread_getspecific(output_key);
+    return stream ? stream : stdout;
+}
+
+/* Convert an output mode name to a mode */
+int parse_output_mode(const char *name) {
+    int i;
+
+    if (!name) return -1;
+    for (i = 0; i < (int)(sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0])); i++) {
+        if (strcmp(name, MODE_NAMES[i]) == 0) return (int)MODES[i];
+    }
+    return -1;
+}
+
+/* Set the print mode of the calling thread */
+void set_output_mode(output_mode mode) {
+    pthread_once(&output_key_once, create_output_key);
+    pthread_setspecific(mode_key, &MODES[mode]);
+}
+
+/* Get the print mode of the calling thread, text by default */
+output_mode get_output_mode(void) {
+    const output_mode *mode;
+
+    pthread_once(&output_key_once, create_output_key);
+    mode = (const output_mode*)pthread_getspecific(mode_key);
+    return mode ? *mode : OUTPUT_TEXT;
+}
+
+/* Print formatted text to the calling thread's output stream */
+void out_printf(const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(get_output_stream(), format, args);
+    va_end(args);
+}
+
+/* Write raw text to the calling thread's output stream */
+void out_write(const char *data, size_t length) {
+    fwrite(data, 1, length, get_output_stream());
+}
+
+/* Format a value like "%8.2f" using integer arithmetic */
+int format_fixed2(double value, char *dest) {
+    char digits[16];
+    double magnitude, scaled, error, whole, fraction;
+    unsigned long cents;
+    int negative, count = 0, length = 0, i;
+
+    magnitude = fabs(value);
+    if (!(magnitude < FIXED2_FAST_LIMIT)) {
+        return sprintf(dest, "%8.2f", value);
+    }
+
+    /* scaled + error is exactly magnitude * 100 */
+    scaled = magnitude * 100.0;
+    error = fma(magnitude, 100.0, -scaled);
+    whole = floor(scaled);
+    fraction = scaled - whole;
+
+    /* Round to nearest; only an exact tie looks at the parity (half-to-even like printf) */
+    cents = (unsigned long)whole;
+    if (fraction > 0.5 || (fraction == 0.5 && (error > 0 || (error == 0 && (cents & 1))))) {
+        cents++;
+    }
+
+    /* Digits in reverse order, at least "0.00" */
+    digits[count++] = (char)('0' + cents % 10);
+    digits[count++] = (char)('0' + cents / 10 % 10);
+    digits[count++] = '.';
+    cents /= 100;
+    do {
+        digits[count++] = (char)('0' + cents % 10);
+        cents /= 10;
+    } while (cents > 0);
+
+    /* printf keeps the sign of -0.0 and of negative values that round to zero */
+    negative = signbit(value) != 0;
+    if (negative) digits[count++] = '-';
+
+    while (length + count < FIXED2_WIDTH) dest[length++] = ' ';
+    for (i = count - 1; i >= 0; i--) dest[length++] = digits[i];
+    dest[length] = '\0';
+    return length;
+}
+
+/* Format a value with the shortest decimal that converts back to the same double */
+int format_round_trip(double value, char *dest) {
+    int low = 1, high = 17, middle, exponent;
+
+    /* If p significant digits round-trip, so do p + 1, so the shortest can be bisected */
+    while (low < high) {
+        middle = (low + high) / 2;
+        sprintf(dest, "%.*g", middle, value);
+        if (strtod(dest, NULL) == value) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    /* %g switches to an exponent once it exceeds the precision; write such values in full */
+    sprintf(dest, "%.*e", low - 1, value);
+    exponent = atoi(strchr(dest, 'e') + 1);
+    if (exponent >= low && exponent < 17) {
+        low = exponent + 1;
+    }
+    return sprintf(dest, "%.*g", low, value);
+}
+
+/* Use a large buffer for redirected output; terminals stay line buffered */
+void configure_output_buffer(FILE *stream) {
+    if (!isatty(fileno(stream))) {
+        setvbuf(stream, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+}
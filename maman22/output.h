@@ -0,0 +1,92 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+
+#define OUTPUT_BUFFER_SIZE 65536  /* stdio buffer for non-interactive standard output */
+#define FORMATTED_VALUE_MAX 320   /* Longest "%8.2f" text of a finite double, plus terminator */
+#define ROUND_TRIP_VALUE_MAX 32   /* Longest shortest-round-trip text of a double, plus terminator */
+
+/* Ways print_mat can render a matrix */
+typedef enum output_mode {
+    OUTPUT_TEXT,      /* "Matrix contents:" and four rows of "%8.2f " */
+    OUTPUT_BINARY,    /* Header and 16 little-endian IEEE doubles */
+    OUTPUT_EXACT      /* One line: register name and 16 shortest round-trip decimals */
+} output_mode;
+
+/**
+ * @brief Prints formatted text to the output stream of the calling thread
+ * @param format printf-style format string
+ * @note All calculator output goes through this function so that each thread
+ *       (for example a server worker handling one client session) can direct it
+ *       to its own stream
+ */
+void out_printf(const char *format, ...);
+
+/**
+ * @brief Writes raw text to the output stream of the calling thread
+ * @param data Text to write
+ * @param length Number of bytes to write
+ */
+void out_write(const char *data, size_t length);
+
+/**
+ * @brief Formats a value exactly like printf("%8.2f") without parsing a format string
+ * @param value Finite value to format
+ * @param dest Buffer of at least FORMATTED_VALUE_MAX bytes
+ * @return Number of characters written, excluding the terminator
+ * @note Rounds the exact binary value half-to-even like glibc and keeps the sign of
+ *       negative zero and of negative values that round to zero; very large values
+ *       fall back to snprintf
+ */
+int format_fixed2(double value, char *dest);
+
+/**
+ * @brief Formats a value with the fewest significant digits that read back as the same double
+ * @param value Finite value to format
+ * @param dest Buffer of at least ROUND_TRIP_VALUE_MAX bytes
+ * @return Number of characters written, excluding the terminator
+ * @note Negative zero is written as "-0"; magnitudes below 1e17 are written without an exponent
+ *       when the shortest digits would otherwise need one (10, not 1e+01)
+ */
+int format_round_trip(double value, char *dest);
+
+/**
+ * @brief Converts an output mode name ("text", "binary" or "exact") to a mode
+ * @param name Mode name
+ * @return The mode, or -1 if the name is not a mode
+ */
+int parse_output_mode(const char *name);
+
+/**
+ * @brief Sets the mode print_mat uses on the calling thread
+ * @param mode New output mode
+ */
+void set_output_mode(output_mode mode);
+
+/**
+ * @brief Gets the mode print_mat uses on the calling thread
+ * @return The mode set with set_output_mode, or OUTPUT_TEXT if none was set
+ */
+output_mode get_output_mode(void);
+
+/**
+ * @brief Gives a stream a large fully buffered stdio buffer unless it is a terminal
+ * @param stream Stream to configure, normally stdout before any output
+ * @note Interactive sessions keep line buffering so output appears after each command
+ */
+void configure_output_buffer(FILE *stream);
+
+/**
+ * @brief Sets the output stream used by out_printf on the calling thread
+ * @param stream Output stream, or NULL to restore the default (stdout)
+ */
+void set_output_stream(FILE *stream);
+
+/**
+ * @brief Gets the output stream used by out_printf on the calling thread
+ * @return The stream set with set_output_stream, or stdout if none was set
+ */
+FILE* get_output_stream(void);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,328 @@
+#include "points.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define BLOCK_BYTES ((size_t)POINT_BLOCK_POINTS * POINT_BYTES)
+
+/* One contiguous range of the point file, streamed through two buffers */
+typedef struct point_stream {
+    double transform[4][4];       /* Copy of the matrix, so workers never touch registers */
+    int in_fd;
+    int out_fd;
+    off_t begin;                  /* Byte range of the points handled by this stream */
+    off_t end;
+    double *buffers[2];
+    size_t lengths[2];            /* Bytes in each full buffer; 0 marks the end of the range */
+    int full[2];                  /* Buffer filled by the reader and not yet written */
+    int read_failed;
+    int write_failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} point_stream;
+
+/* Check whether the host stores doubles little-endian */
+static int host_is_little_endian(void) {
+    static const double PROBE = 1.0;   /* Sign and exponent live in the last byte on little-endian */
+    return ((const unsigned char*)&PROBE)[sizeof(double) - 1] != 0;
+}
+
+/* Reverse the bytes of every double, converting between little-endian and host order */
+static void swap_doubles(double *values, size_t count) {
+    unsigned char *bytes, swapped;
+    size_t n;
+    int i;
+
+    for (n = 0; n < count; n++) {
+        bytes = (unsigned char*)&values[n];
+        for (i = 0; i < (int)sizeof(double) / 2; i++) {
+            swapped = bytes[i];
+            bytes[i] = bytes[sizeof(double) - 1 - i];
+            bytes[sizeof(double) - 1 - i] = swapped;
+        }
+    }
+}
+
+/* Transform points in place; the matrix lives in locals so the loop keeps it in registers
+ * and the four independent dot products of a point can be computed side by side */
+static void transform_block(double *points, size_t count, double m[4][4]) {
+    double m00 = m[0][0], m01 = m[0][1], m02 = m[0][2], m03 = m[0][3];
+    double m10 = m[1][0], m11 = m[1][1], m12 = m[1][2], m13 = m[1][3];
+    double m20 = m[2][0], m21 = m[2][1], m22 = m[2][2], m23 = m[2][3];
+    double m30 = m[3][0], m31 = m[3][1], m32 = m[3][2], m33 = m[3][3];
+    double x, y, z, w, *point;
+    size_t n;
+
+    for (n = 0; n < count; n++) {
+        point = points + n * 4;
+        x = point[0];
+        y = point[1];
+        z = point[2];
+        w = point[3];
+        /* Summed from 0.0 in index order, exactly like mul_mat */
+        point[0] = 0.0 + m00 * x + m01 * y + m02 * z + m03 * w;
+        point[1] = 0.0 + m10 * x + m11 * y + m12 * z + m13 * w;
+        point[2] = 0.0 + m20 * x + m21 * y + m22 * z + m23 * w;
+        point[3] = 0.0 + m30 * x + m31 * y + m32 * z + m33 * w;
+    }
+}
+
+/* Read exactly length bytes at offset, retrying short reads */
+static int read_fully(int fd, void *buffer, size_t length, off_t offset) {
+    ssize_t got;
+    size_t done = 0;
+
+    while (done < length) {
+        got = pread(fd, (char*)buffer + done, length - done, offset + (off_t)done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        done += (size_t)got;
+    }
+    return 1;
+}
+
+/* Write exactly length bytes at offset, retrying short writes */
+static int write_fully(int fd, const void *buffer, size_t length, off_t offset) {
+    ssize_t put;
+    size_t done = 0;
+
+    while (done < length) {
+        put = pwrite(fd, (const char*)buffer + done, length - done, offset + (off_t)done);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return 0;
+        done += (size_t)put;
+    }
+    return 1;
+}
+
+/* Reader thread: fill the buffers in turn until the range is exhausted */
+static void* read_blocks(void *arg) {
+    point_stream *stream = (point_stream*)arg;
+    off_t offset = stream->begin;
+    size_t length;
+    int slot = 0, stopped = 0;
+
+    while (!stopped) {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->full[slot] && !stream->write_failed) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        stopped = stream->write_failed;
+        pthread_mutex_unlock(&stream->lock);
+        if (stopped) break;
+
+        length = stream->end - offset < (off_t)BLOCK_BYTES ? (size_t)(stream->end - offset) : BLOCK_BYTES;
+        if (length > 0 && !read_fully(stream->in_fd, stream->buffers[slot], length, offset)) {
+            length = 0;
+            stream->read_failed = 1;
+        }
+        offset += length;
+
+        pthread_mutex_lock(&stream->lock);
+        stream->lengths[slot] = length;
+        stream->full[slot] = 1;
+        pthread_cond_signal(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+
+        stopped = length == 0;
+        slot = 1 - slot;
+    }
+    return NULL;
+}
+
+/* Worker: transform and write the buffers the reader fills, overlapping the next read */
+static void* transform_stream(void *arg) {
+    point_stream *stream = (point_stream*)arg;
+    pthread_t reader;
+    off_t offset = stream->begin;
+    size_t length;
+    int slot = 0, failed;
+
+    if (pthread_create(&reader, NULL, read_blocks, stream) != 0) {
+        stream->read_failed = 1;
+        return NULL;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&stream->lock);
+        while (!stream->full[slot]) {
+            pthread_cond_wait(&stream->changed, &stream->lock);
+        }
+        length = stream->lengths[slot];
+        pthread_mutex_unlock(&stream->lock);
+        if (length == 0) break;
+
+        if (!host_is_little_endian()) swap_doubles(stream->buffers[slot], length / sizeof(double));
+        transform_block(stream->buffers[slot], length / POINT_BYTES, stream->transform);
+        if (!host_is_little_endian()) swap_doubles(stream->buffers[slot], length / sizeof(double));
+
+        failed = !write_fully(stream->out_fd, stream->buffers[slot], length, offset);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->write_failed = failed;
+        stream->full[slot] = 0;
+        pthread_cond_signal(&stream->changed);
+        pthread_mutex_unlock(&stream->lock);
+        if (failed) break;
+
+        offset += length;
+        slot = 1 - slot;
+    }
+
+    pthread_join(reader, NULL);
+    return NULL;
+}
+
+/* Current monotonic time in seconds */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Prepare the streams of the threads, splitting the points into contiguous ranges */
+static int init_streams(point_stream *streams, int thread_count, const mat *transform,
+                        int in_fd, int out_fd, off_t point_count) {
+    off_t first = 0, share;
+    int i, ok = 1;
+
+    memset(streams, 0, thread_count * sizeof(point_stream));
+    for (i = 0; i < thread_count; i++) {
+        memcpy(streams[i].transform, transform->matrix, sizeof(streams[i].transform));
+        streams[i].in_fd = in_fd;
+        streams[i].out_fd = out_fd;
+        share = point_count / thread_count + (i < point_count % thread_count ? 1 : 0);
+        streams[i].begin = first * POINT_BYTES;
+        streams[i].end = (first + share) * POINT_BYTES;
+        first += share;
+        streams[i].buffers[0] = (double*)malloc(BLOCK_BYTES);
+        streams[i].buffers[1] = (double*)malloc(BLOCK_BYTES);
+        ok = ok && streams[i].buffers[0] && streams[i].buffers[1];
+        pthread_mutex_init(&streams[i].lock, NULL);
+        pthread_cond_init(&streams[i].changed, NULL);
+    }
+    return ok;
+}
+
+/* Release the buffers and synchronization of the streams */
+static void free_streams(point_stream *streams, int thread_count) {
+    int i;
+
+    for (i = 0; i < thread_count; i++) {
+        free(streams[i].buffers[0]);
+        free(streams[i].buffers[1]);
+        pthread_mutex_destroy(&streams[i].lock);
+        pthread_cond_destroy(&streams[i].changed);
+    }
+}
+
+/* Run the streams, on worker threads when there is more than one */
+static void run_streams(point_stream *streams, int thread_count) {
+    pthread_t workers[MAX_TRANSFORM_THREADS];
+    int i, started = 0;
+
+    if (thread_count == 1) {
+        transform_stream(&streams[0]);
+        return;
+    }
+    for (i = 0; i < thread_count; i++) {
+        if (pthread_create(&workers[i], NULL, transform_stream, &streams[i]) != 0) break;
+        started++;
+    }
+    /* Ranges whose thread could not be started run on this thread */
+    for (i = started; i < thread_count; i++) {
+        transform_stream(&streams[i]);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+/* Transform a point file into a temporary file and rename it over the output */
+int transform_points(const mat *transform, const char *in_path, const char *out_path,
+                     int thread_count) {
+    point_stream *streams;
+    struct stat info;
+    char *temporary;
+    double start, elapsed;
+    off_t point_count;
+    int in_fd, out_fd, i, ok;
+
+    if (!transform || !in_path || !out_path || thread_count < 1 || thread_count > MAX_TRANSFORM_THREADS) {
+        out_printf("Error: Invalid arguments for transform_points\n");
+        return 0;
+    }
+    if (!is_matrix_valid((mat*)transform)) {
+        out_printf("Error: Transform matrix contains invalid values (NaN or infinity)\n");
+        return 0;
+    }
+
+    in_fd = open(in_path, O_RDONLY);
+    if (in_fd < 0 || fstat(in_fd, &info) != 0) {
+        if (in_fd >= 0) close(in_fd);
+        out_printf("Error: Cannot read file '%s'\n", in_path);
+        return 0;
+    }
+    if (info.st_size % POINT_BYTES != 0) {
+        close(in_fd);
+        out_printf("Error: '%s' is not a whole number of %d-byte points\n", in_path, POINT_BYTES);
+        return 0;
+    }
+    point_count = info.st_size / POINT_BYTES;
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    temporary = (char*)malloc(strlen(out_path) + 5);
+    out_fd = -1;
+    if (temporary) {
+        sprintf(temporary, "%s.tmp", out_path);
+        out_fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (out_fd < 0) {
+        close(in_fd);
+        free(temporary);
+        out_printf("Error: Cannot write file '%s'\n", out_path);
+        return 0;
+    }
+
+    /* Small files are not worth a thread per range */
+    if (point_count < (off_t)thread_count * POINT_BLOCK_POINTS) {
+        thread_count = (int)(point_count / POINT_BLOCK_POINTS) + 1;
+    }
+    streams = (point_stream*)malloc(thread_count * sizeof(point_stream));
+    ok = streams && init_streams(streams, thread_count, transform, in_fd, out_fd, point_count);
+
+    start = now_seconds();
+    if (ok) run_streams(streams, thread_count);
+    elapsed = now_seconds() - start;
+
+    for (i = 0; ok && i < thread_count; i++) {
+        if (streams[i].read_failed) {
+            out_printf("Error: Cannot read file '%s'\n", in_path);
+            ok = 0;
+        } else if (streams[i].write_failed) {
+            ok = 0;
+        }
+    }
+    if (streams) free_streams(streams, thread_count);
+    free(streams);
+    close(in_fd);
+    if (close(out_fd) != 0) ok = 0;
+
+    if (ok && rename(temporary, out_path) != 0) ok = 0;
+    if (!ok) {
+        remove(temporary);
+        out_printf("Error: Cannot write file '%s'\n", out_path);
+    } else {
+        out_printf("Transformed %ld points in %.3f s (%.0f points/s)\n", (long)point_count, elapsed,
+                   elapsed > 0 ? point_count / elapsed : 0.0);
+    }
+    free(temporary);
+    return ok;
+}
@@ -0,0 +1,29 @@
+#ifndef POINTS_H
+#define POINTS_H
+
+#include "mymat.h"
+
+#define POINT_BYTES (4 * 8)         /* One homogeneous point: x, y, z, w as little-endian doubles */
+#define POINT_BLOCK_POINTS 65536    /* Points per I/O buffer (2 MiB) */
+#define MAX_TRANSFORM_THREADS 64    /* Upper bound for the thread count of transform_points */
+
+/**
+ * @brief Transforms every point of a binary point file by a matrix
+ * @param transform Matrix applied to each point as a column vector: out = transform * p
+ * @param in_path Input file: points of POINT_BYTES, one after another
+ * @param out_path Output file in the same format, replaced atomically
+ * @param thread_count Number of threads (1 to MAX_TRANSFORM_THREADS); the file is split
+ *        into that many contiguous ranges
+ * @return 1 on success, 0 on failure (the output file is not replaced)
+ * @note Each range is streamed in blocks of POINT_BLOCK_POINTS with double buffering:
+ *       a reader thread fills one buffer while the other is transformed and written
+ * @note Each output coordinate is summed like mul_mat, so the results equal mul_mat
+ *       with the points as columns
+ * @note Prints the number of points and the throughput in points per second
+ * @warning Prints an error message for unreadable or malformed input, write failures
+ *          and a transform containing NaN or infinite values
+ */
+int transform_points(const mat *transform, const char *in_path, const char *out_path,
+                     int thread_count);
+
+#endif /* POINTS_H */
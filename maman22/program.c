@@ -0,0 +1,935 @@
+#include "program.h"
+#include "commands.h"
+#include "output.h"
+#include "shared.h"
+#include "stats.h"
+#include "trace.h"
+#include "matfile.h"
+#include "points.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "alloc.h"   /* After the system headers: may redefine malloc and free */
+
+#define MAX_WORDS 4    /* Words inspected when classifying a block line */
+#define MAX_WORD 256   /* Maximum word length including terminator */
+
+void (*instruction_hook)(const instruction *instr) = NULL;
+
+/* Kinds of lines recognized by the block handler */
+typedef enum line_kind {
+    LINE_COMMAND,
+    LINE_REPEAT,
+    LINE_MACRO,
+    LINE_END,
+    LINE_CALL
+} line_kind;
+
+/* Whitespace-separated words of a line, used for block syntax */
+typedef struct line_words {
+    char word[MAX_WORDS][MAX_WORD];
+    int count;                    /* Total number of words, may exceed MAX_WORDS */
+} line_words;
+
+/* Split a line into whitespace-separated words */
+static void split_words(const char *line, line_words *words) {
+    const char *start;
+    int len;
+
+    words->count = 0;
+    while (*line) {
+        while (*line && isspace((unsigned char)*line)) line++;
+        if (!*line) break;
+
+        start = line;
+        while (*line && !isspace((unsigned char)*line)) line++;
+        len = line - start;
+
+        if (words->count < MAX_WORDS) {
+            /* Overlong words are truncated, which makes them fail validation later */
+            if (len >= MAX_WORD) len = MAX_WORD - 1;
+            strncpy(words->word[words->count], start, len);
+            words->word[words->count][len] = '\0';
+        }
+        words->count++;
+    }
+}
+
+/* Determine whether a line is a block construct or an ordinary command */
+static line_kind classify_line(const char *line, line_words *words) {
+    split_words(line, words);
+
+    if (words->count == 0) return LINE_COMMAND;
+    if (strcmp(words->word[0], "repeat") == 0) return LINE_REPEAT;
+    if (strcmp(words->word[0], "macro") == 0) return LINE_MACRO;
+    if (strcmp(words->word[0], "}") == 0) return LINE_END;
+    if (strcmp(words->word[0], "call") == 0) return LINE_CALL;
+    return LINE_COMMAND;
+}
+
+/* Check that a line contains nothing but whitespace */
+static int is_blank_line(const char *line) {
+    while (*line) {
+        if (!isspace((unsigned char)*line)) return 0;
+        line++;
+    }
+    return 1;
+}
+
+/* Check that a macro name is an identifier that fits the name buffer */
+static int is_valid_macro_name(const char *name) {
+    int len = strlen(name);
+    int i;
+
+    if (len == 0 || len >= MAX_MACRO_NAME) return 0;
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_') return 0;
+    for (i = 1; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') return 0;
+    }
+    return 1;
+}
+
+/* Find a macro by name */
+static macro_def* find_macro(script_state *state, const char *name) {
+    int i;
+    for (i = 0; i < state->macro_count; i++) {
+        if (strcmp(state->macros[i].name, name) == 0) {
+            return &state->macros[i];
+        }
+    }
+    return NULL;
+}
+
+/* Parse "repeat N {" and return the iteration count */
+static int parse_repeat_header(const line_words *words, long *count) {
+    char *endptr;
+
+    if (words->count != 3 || strcmp(words->word[2], "{") != 0) {
+        out_printf("Error: Invalid block syntax, expected 'repeat N {'\n");
+        return 0;
+    }
+
+    *count = strtol(words->word[1], &endptr, 10);
+    if (*endptr != '\0' || *count < 0 || *count == LONG_MAX) {
+        out_printf("Error: Invalid repeat count '%s'\n", words->word[1]);
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse "macro NAME {" and check that the name is usable */
+static int parse_macro_header(script_state *state, const line_words *words) {
+    if (words->count != 3 || strcmp(words->word[2], "{") != 0) {
+        out_printf("Error: Invalid block syntax, expected 'macro NAME {'\n");
+        return 0;
+    }
+    if (!is_valid_macro_name(words->word[1])) {
+        out_printf("Error: Invalid macro name '%s'\n", words->word[1]);
+        return 0;
+    }
+    if (find_macro(state, words->word[1])) {
+        out_printf("Error: Macro '%s' is already defined\n", words->word[1]);
+        return 0;
+    }
+    if (state->macro_count >= MAX_MACROS) {
+        out_printf("Error: Too many macro definitions\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Parse "call NAME" and look up the macro */
+static macro_def* parse_call(script_state *state, const line_words *words) {
+    macro_def *macro;
+
+    if (words->count < 2) {
+        out_printf("Missing argument\n");
+        return NULL;
+    }
+    if (words->count > 2) {
+        out_printf("Extraneous text after end of command\n");
+        return NULL;
+    }
+
+    macro = find_macro(state, words->word[1]);
+    if (!macro) {
+        out_printf("Error: Undefined macro '%s'\n", words->word[1]);
+    }
+    return macro;
+}
+
+/* Find the index of the "}" matching the opener at index begin */
+static int find_block_end(char **lines, int begin, int end) {
+    line_words words;
+    int depth = 0;
+    int i;
+
+    for (i = begin; i < end; i++) {
+        switch (classify_line(lines[i], &words)) {
+            case LINE_REPEAT:
+            case LINE_MACRO:
+                depth++;
+                break;
+            case LINE_END:
+                depth--;
+                if (depth == 0) return i;
+                break;
+            default:
+                break;
+        }
+    }
+    return -1;
+}
+
+#ifdef MYMAT_STATS
+/* Command type an opcode's time is attributed to */
+static stats_command opcode_command(opcode op) {
+    switch (op) {
+        case OP_READ_MAT: return STATS_READ_MAT;
+        case OP_PRINT_MAT: return STATS_PRINT_MAT;
+        case OP_ADD_MAT: return STATS_ADD_MAT;
+        case OP_SUB_MAT: return STATS_SUB_MAT;
+        case OP_MUL_MAT: return STATS_MUL_MAT;
+        case OP_MUL_SCALAR: return STATS_MUL_SCALAR;
+        case OP_TRANS_MAT: return STATS_TRANS_MAT;
+        case OP_MUL_MAT_SW: return STATS_MUL_MAT_SW;
+        case OP_RAND_MAT: return STATS_RAND_MAT;
+        case OP_IDENT_MAT: return STATS_IDENT_MAT;
+        case OP_FILL_MAT: return STATS_FILL_MAT;
+        case OP_COPY_MAT: return STATS_COPY_MAT;
+        case OP_OUTPUT_MODE: return STATS_OUTPUT_MODE;
+        case OP_LOAD_MAT: return STATS_LOAD_MAT;
+        case OP_SAVE_MAT: return STATS_SAVE_MAT;
+        case OP_SAVE_STATE: return STATS_SAVE_STATE;
+        case OP_LOAD_STATE: return STATS_LOAD_STATE;
+        case OP_TRANSFORM_POINTS: return STATS_TRANSFORM_POINTS;
+        case OP_SUM_MAT: return STATS_SUM_MAT;
+        case OP_TRACE_MAT: return STATS_TRACE_MAT;
+        case OP_NORM_MAT: return STATS_NORM_MAT;
+        case OP_STATS: return STATS_STATS;
+        default: return STATS_OTHER;
+    }
+}
+#endif
+
+/* Append a zeroed instruction to the program */
+static instruction* append_instruction(program *prog) {
+    instruction *grown;
+    int new_capacity;
+
+    if (prog->length == prog->capacity) {
+        new_capacity = prog->capacity ? prog->capacity * 2 : 8;
+        grown = (instruction*)realloc(prog->code, new_capacity * sizeof(instruction));
+        if (!grown) {
+            out_printf("Error: Memory allocation failed for program\n");
+            return NULL;
+        }
+        prog->code = grown;
+        prog->capacity = new_capacity;
+    }
+
+    memset(&prog->code[prog->length], 0, sizeof(instruction));
+    return &prog->code[prog->length++];
+}
+
+/* Give the last appended instruction its own copy of a file name; drop it on failure */
+static int set_instruction_path(program *prog, instruction *instr, const char *path) {
+    instr->path = (char*)malloc(strlen(path) + 1);
+    if (!instr->path) {
+        prog->length--;
+        out_printf("Error: Memory allocation failed for program\n");
+        return 0;
+    }
+    strcpy(instr->path, path);
+    return 1;
+}
+
+/* Reset a program to zero instructions, keeping its allocated storage */
+void reset_program(program *prog) {
+    int i;
+
+    for (i = 0; i < prog->length; i++) {
+        if (prog->code[i].op == OP_REPEAT) {
+            free_program(prog->code[i].body);
+        }
+        free(prog->code[i].path);
+        free(prog->code[i].out_path);
+        prog->code[i].path = NULL;
+        prog->code[i].out_path = NULL;
+    }
+    prog->length = 0;
+}
+
+/* Initialize an empty program */
+void init_program(program *prog) {
+    prog->code = NULL;
+    prog->length = 0;
+    prog->capacity = 0;
+}
+
+/* Free all instructions of a program */
+void clear_program(program *prog) {
+    if (!prog) return;
+
+    reset_program(prog);
+    free(prog->code);
+    init_program(prog);
+}
+
+/* Create a new empty program */
+program* create_program(void) {
+    program *prog = (program*)malloc(sizeof(program));
+    if (!prog) {
+        out_printf("Error: Failed to allocate memory for program\n");
+        return NULL;
+    }
+    init_program(prog);
+    return prog;
+}
+
+/* Free a program and everything it owns */
+void free_program(program *prog) {
+    if (!prog) return;
+
+    clear_program(prog);
+    free(prog);
+}
+
+/* Translate a validated command into instructions */
+int compile_command(const char *command_name, arg_list *args, program *prog) {
+    arg_node *argument;
+    instruction *instr;
+    int i, reg_count, mode;
+
+    if (!command_name || !args || !prog) {
+        out_printf("Error: Invalid parameters for compile_command\n");
+        return 0;
+    }
+
+    /* print_mat and print_as accept any number of matrices, one instruction each */
+    if (strcmp(command_name, "print_mat") == 0 || strcmp(command_name, "print_as") == 0) {
+        argument = get_first_argument(args);
+        mode = -1;
+        if (strcmp(command_name, "print_as") == 0) {
+            mode = parse_output_mode(get_argument_value(argument));
+            argument = get_next_argument(argument);
+        }
+        while (argument) {
+            instr = append_instruction(prog);
+            if (!instr) return 0;
+            instr->op = OP_PRINT_MAT;
+            instr->print_mode = mode;
+            instr->regs[0] = get_matrix_index(get_argument_value(argument));
+            argument = get_next_argument(argument);
+        }
+        return 1;
+    }
+
+    instr = append_instruction(prog);
+    if (!instr) return 0;
+    argument = get_first_argument(args);
+
+    if (strcmp(command_name, "read_mat") == 0) {
+        instr->op = OP_READ_MAT;
+        instr->regs[0] = get_matrix_index(get_argument_value(argument));
+        instr->failed = !collect_mat_values(args, instr->values,
+                                            &instr->value_count, &instr->has_extra);
+        return 1;
+    }
+
+    if (strcmp(command_name, "stats") == 0) {
+        instr->op = OP_STATS;
+        return 1;
+    }
+
+    if (strcmp(command_name, "load_mat") == 0 || strcmp(command_name, "save_mat") == 0) {
+        instr->op = strcmp(command_name, "load_mat") == 0 ? OP_LOAD_MAT : OP_SAVE_MAT;
+        instr->regs[0] = get_matrix_index(get_argument_value(argument));
+        argument = get_next_argument(argument);
+        return set_instruction_path(prog, instr, get_argument_value(argument));
+    }
+
+    if (strcmp(command_name, "save_state") == 0 || strcmp(command_name, "load_state") == 0) {
+        instr->op = strcmp(command_name, "save_state") == 0 ? OP_SAVE_STATE : OP_LOAD_STATE;
+        return set_instruction_path(prog, instr, get_argument_value(argument));
+    }
+
+    if (strcmp(command_name, "transform_points") == 0) {
+        instr->op = OP_TRANSFORM_POINTS;
+        instr->regs[0] = get_matrix_index(get_argument_value(argument));
+        argument = get_next_argument(argument);
+        if (!set_instruction_path(prog, instr, get_argument_value(argument))) return 0;
+        argument = get_next_argument(argument);
+        instr->out_path = (char*)malloc(strlen(get_argument_value(argument)) + 1);
+        if (!instr->out_path) {
+            free(instr->path);
+            prog->length--;
+            out_printf("Error: Memory allocation failed for program\n");
+            return 0;
+        }
+        strcpy(instr->out_path, get_argument_value(argument));
+        argument = get_next_argument(argument);
+        instr->thread_count = 1;
+        if (argument) instr->thread_count = atoi(get_argument_value(argument));
+        return 1;
+    }
+
+    if (strcmp(command_name, "norm_mat") == 0) {
+        instr->op = OP_NORM_MAT;
+        instr->regs[0] = get_matrix_index(get_argument_value(argument));
+        argument = get_next_argument(argument);
+        instr->norm_kind = argument ? parse_norm_kind(get_argument_value(argument)) : NORM_FROBENIUS;
+        return 1;
+    }
+
+    if (strcmp(command_name, "output_mode") == 0) {
+        instr->op = OP_OUTPUT_MODE;
+        instr->print_mode = parse_output_mode(get_argument_value(argument));
+        return 1;
+    }
+
+    if (strcmp(command_name, "mul_scalar") == 0) {
+        instr->op = OP_MUL_SCALAR;
+        instr->regs[0] = get_matrix_index(get_argument_value(argument));
+        argument = get_next_argument(argument);
+        instr->scalar = strtod(get_argument_value(argument), NULL);
+        argument = get_next_argument(argument);
+        instr->regs[1] = get_matrix_index(get_argument_value(argument));
+        return 1;
+    }
+
+    if (strcmp(command_name, "rand_mat") == 0 || strcmp(command_name, "fill_mat") == 0) {
+        instr->regs[0] = get_matrix_index(get_argument_value(argument));
+        argument = get_next_argument(argument);
+        if (strcmp(command_name, "rand_mat") == 0) {
+            instr->op = OP_RAND_MAT;
+            parse_seed(get_argument_value(argument), &instr->seed);
+        } else {
+            instr->op = OP_FILL_MAT;
+            instr->scalar = strtod(get_argument_value(argument), NULL);
+        }
+        return 1;
+    }
+
+    if (strcmp(command_name, "add_mat") == 0) {
+        instr->op = OP_ADD_MAT;
+        reg_count = 3;
+    } else if (strcmp(command_name, "sub_mat") == 0) {
+        instr->op = OP_SUB_MAT;
+        reg_count = 3;
+    } else if (strcmp(command_name, "mul_mat") == 0) {
+        instr->op = OP_MUL_MAT;
+        reg_count = 3;
+    } else if (strcmp(command_name, "mul_mat_sw") == 0) {
+        instr->op = OP_MUL_MAT_SW;
+        reg_count = 3;
+    } else if (strcmp(command_name, "trans_mat") == 0) {
+        instr->op = OP_TRANS_MAT;
+        reg_count = 2;
+    } else if (strcmp(command_name, "copy_mat") == 0) {
+        instr->op = OP_COPY_MAT;
+        reg_count = 2;
+    } else if (strcmp(command_name, "ident_mat") == 0) {
+        instr->op = OP_IDENT_MAT;
+        reg_count = 1;
+    } else if (strcmp(command_name, "sum_mat") == 0) {
+        instr->op = OP_SUM_MAT;
+        reg_count = 1;
+    } else if (strcmp(command_name, "trace_mat") == 0) {
+        instr->op = OP_TRACE_MAT;
+        reg_count = 1;
+    } else {
+        prog->length--;
+        out_printf("Undefined command name\n");
+        return 0;
+    }
+
+    for (i = 0; i < reg_count; i++) {
+        instr->regs[i] = get_matrix_index(get_argument_value(argument));
+        argument = get_next_argument(argument);
+    }
+    return 1;
+}
+
+/* Index of the register an instruction writes, -1 if it writes none */
+static int target_register(const instruction *instr) {
+    switch (instr->op) {
+        case OP_READ_MAT:
+        case OP_LOAD_MAT:
+        case OP_RAND_MAT:
+        case OP_IDENT_MAT:
+        case OP_FILL_MAT:
+            return instr->regs[0];
+        case OP_MUL_SCALAR:
+        case OP_TRANS_MAT:
+        case OP_COPY_MAT:
+            return instr->regs[1];
+        case OP_ADD_MAT:
+        case OP_SUB_MAT:
+        case OP_MUL_MAT:
+        case OP_MUL_MAT_SW:
+            return instr->regs[2];
+        default:
+            return -1;
+    }
+}
+
+/* Check whether an instruction touches any shared register */
+static int uses_shared_registers(const instruction *instr) {
+    return instr->regs[0] >= MAT_COUNT || instr->regs[1] >= MAT_COUNT ||
+           instr->regs[2] >= MAT_COUNT;
+}
+
+/* Resolve a source register; a shared source that is also the target reads the
+ * private copy being written, so in-place operations behave like private registers */
+static mat* source_matrix(int index, int target_index, mat *target, mat matrices[MAT_COUNT]) {
+    if (index < MAT_COUNT) return &matrices[index];
+    if (index == target_index) return target;
+    return shared_snapshot(index - MAT_COUNT);
+}
+
+/* Compute a reduction of a register and print it labelled like "norm_inf(MAT_A)" */
+static void print_reduction(const instruction *instr, mat *source) {
+    char label[32];
+    double value;
+    int ok;
+
+    if (instr->op == OP_SUM_MAT) {
+        ok = sum_mat(source, &value);
+        sprintf(label, "sum(%s)", get_matrix_name(instr->regs[0]));
+    } else if (instr->op == OP_TRACE_MAT) {
+        ok = trace_mat(source, &value);
+        sprintf(label, "trace(%s)", get_matrix_name(instr->regs[0]));
+    } else {
+        ok = norm_mat(source, (norm_kind)instr->norm_kind, &value);
+        sprintf(label, "norm_%s(%s)", get_norm_name((norm_kind)instr->norm_kind),
+                get_matrix_name(instr->regs[0]));
+    }
+    if (ok) print_scalar_as(value, label, get_output_mode());
+}
+
+/* Execute a single non-block instruction */
+static void execute_instruction(const instruction *instr, mat matrices[MAT_COUNT]) {
+    int target_index = target_register(instr);
+    mat *target = NULL;
+    mat *first, *second;
+    int n;
+
+    /* Shared targets are updated copy-on-write and published afterwards */
+    if (target_index >= MAT_COUNT) {
+        target = shared_write_begin(target_index - MAT_COUNT);
+        if (!target) return;
+    } else if (target_index >= 0) {
+        target = &matrices[target_index];
+    }
+
+    first = source_matrix(instr->regs[0], target_index, target, matrices);
+    second = source_matrix(instr->regs[1], target_index, target, matrices);
+
+    switch (instr->op) {
+        case OP_READ_MAT:
+            if (instr->failed) {
+                /* The error was reported at compile time; keep the values before it */
+                touch_mat(target);
+                for (n = 0; n < instr->value_count; n++) {
+                    target->matrix[n / 4][n % 4] = instr->values[n];
+                }
+            } else {
+                fill_mat_values(target, instr->values, instr->value_count, instr->has_extra);
+            }
+            break;
+        case OP_PRINT_MAT:
+            print_mat_as(first, get_matrix_name(instr->regs[0]),
+                         instr->print_mode < 0 ? get_output_mode() : (output_mode)instr->print_mode);
+            break;
+        case OP_ADD_MAT:
+            add_mat(first, second, target);
+            break;
+        case OP_SUB_MAT:
+            sub_mat(first, second, target);
+            break;
+        case OP_MUL_MAT:
+            mul_mat(first, second, target);
+            break;
+        case OP_MUL_MAT_SW:
+            mul_mat_sw(first, second, target);
+            break;
+        case OP_MUL_SCALAR:
+            mul_scalar(first, instr->scalar, target);
+            break;
+        case OP_TRANS_MAT:
+            trans_mat(first, target);
+            break;
+        case OP_RAND_MAT:
+            rand_mat(instr->seed, target);
+            break;
+        case OP_IDENT_MAT:
+            ident_mat(target);
+            break;
+        case OP_FILL_MAT:
+            fill_mat(instr->scalar, target);
+            break;
+        case OP_COPY_MAT:
+            copy_mat(first, target);
+            break;
+        case OP_SUM_MAT:
+        case OP_TRACE_MAT:
+        case OP_NORM_MAT:
+            print_reduction(instr, first);
+            break;
+        case OP_STATS:
+            stats_print();
+            break;
+        case OP_OUTPUT_MODE:
+            set_output_mode((output_mode)instr->print_mode);
+            break;
+        case OP_LOAD_MAT:
+            load_mat_file(instr->path, target);
+            break;
+        case OP_SAVE_MAT:
+            save_mat_file(instr->path, first);
+            break;
+        case OP_SAVE_STATE:
+            save_state_file(instr->path, matrices);
+            break;
+        case OP_LOAD_STATE:
+            load_state_file(instr->path, matrices);
+            break;
+        case OP_TRANSFORM_POINTS:
+            transform_points(first, instr->path, instr->out_path, instr->thread_count);
+            break;
+        default:
+            break;
+    }
+
+    if (target_index >= MAT_COUNT) {
+        shared_write_commit(target_index - MAT_COUNT, target);
+    }
+}
+
+/* Execute compiled instructions in order */
+void run_program(const program *prog, mat matrices[MAT_COUNT]) {
+    const instruction *instr;
+    long iteration;
+    int pc;
+    STATS_TIMER(timer);
+
+    if (!prog) return;
+
+    for (pc = 0; pc < prog->length; pc++) {
+        instr = &prog->code[pc];
+
+        switch (instr->op) {
+            case OP_REPEAT:
+                for (iteration = 0; iteration < instr->repeat_count; iteration++) {
+                    run_program(instr->body, matrices);
+                }
+                break;
+            case OP_CALL:
+                run_program(instr->body, matrices);
+                break;
+            default:
+                if (instruction_hook) instruction_hook(instr);
+                STATS_START(timer);
+                TRACE_BEGIN(kernel);
+                if (uses_shared_registers(instr)) {
+                    /* Snapshots of shared sources stay valid for the whole instruction */
+                    shared_read_lock();
+                    execute_instruction(instr, matrices);
+                    shared_read_unlock();
+                } else {
+                    execute_instruction(instr, matrices);
+                }
+                TRACE_END(kernel);
+                /* Commands that only print are accounted as output, the rest as kernel time */
+                STATS_RECORD(opcode_command(instr->op),
+                             instr->op == OP_PRINT_MAT || instr->op == OP_STATS ? STAGE_OUTPUT : STAGE_EXECUTE,
+                             timer);
+                break;
+        }
+    }
+}
+
+/* Compile the lines in [begin, end) into prog, reporting every error found */
+static int compile_lines(script_state *state, char **lines, int begin, int end,
+                         int depth, program *prog) {
+    line_words words;
+    arg_list *args;
+    char *command_name;
+    instruction *instr;
+    macro_def *macro;
+    program *body;
+    long count;
+    int i, block_end, ok = 1;
+
+    for (i = begin; i < end; i++) {
+        switch (classify_line(lines[i], &words)) {
+            case LINE_REPEAT:
+                block_end = find_block_end(lines, i, end);
+                if (depth >= MAX_BLOCK_DEPTH) {
+                    out_printf("Error: Block nesting exceeds maximum depth of %d\n", MAX_BLOCK_DEPTH);
+                    ok = 0;
+                } else if (parse_repeat_header(&words, &count)) {
+                    body = create_program();
+                    instr = body ? append_instruction(prog) : NULL;
+                    if (!instr) {
+                        free_program(body);
+                        ok = 0;
+                    } else {
+                        instr->op = OP_REPEAT;
+                        instr->repeat_count = count;
+                        instr->body = body;
+                        if (!compile_lines(state, lines, i + 1, block_end, depth + 1, body)) {
+                            ok = 0;
+                        }
+                    }
+                } else {
+                    ok = 0;
+                }
+                i = block_end;
+                break;
+            case LINE_MACRO:
+                out_printf("Error: Macros can only be defined at top level\n");
+                ok = 0;
+                i = find_block_end(lines, i, end);
+                break;
+            case LINE_END:
+                out_printf("Error: Unmatched '}'\n");
+                ok = 0;
+                break;
+            case LINE_CALL:
+                macro = parse_call(state, &words);
+                instr = macro ? append_instruction(prog) : NULL;
+                if (!instr) {
+                    ok = 0;
+                } else {
+                    instr->op = OP_CALL;
+                    instr->body = macro->body;
+                }
+                break;
+            case LINE_COMMAND:
+                if (is_blank_line(lines[i])) break;
+
+                args = create_arg_list();
+                if (!args) {
+                    ok = 0;
+                    break;
+                }
+
+                command_name = parse_line(lines[i], args);
+                if (!command_name) {
+                    ok = 0; /* Error message already printed by parse_line */
+                } else if (strcmp(command_name, "stop") == 0) {
+                    out_printf("Error: stop is not allowed inside a block\n");
+                    ok = 0;
+                } else if (!validate_command_arguments(command_name, args) ||
+                           !compile_command(command_name, args, prog)) {
+                    ok = 0;
+                } else if (prog->code[prog->length - 1].failed) {
+                    ok = 0; /* read_mat error already printed */
+                }
+
+                free(command_name);
+                free_arg_list(args);
+                break;
+        }
+    }
+
+    return ok;
+}
+
+/* Compile and run or store the block that was just closed */
+static void finish_block(script_state *state, mat matrices[MAT_COUNT]) {
+    line_words words;
+    program *prog;
+    macro_def *macro;
+    int ok;
+
+    prog = create_program();
+    if (!prog) return;
+
+    if (classify_line(state->block_lines[0], &words) == LINE_MACRO) {
+        /* Compile the body only, the header names the macro */
+        ok = parse_macro_header(state, &words) &&
+             compile_lines(state, state->block_lines, 1, state->block_length - 1, 1, prog);
+        if (ok) {
+            macro = &state->macros[state->macro_count++];
+            strcpy(macro->name, words.word[1]);
+            macro->body = prog;
+            prog = NULL;
+        }
+    } else {
+        /* Compile the whole repeat block, including its header */
+        ok = compile_lines(state, state->block_lines, 0, state->block_length, 0, prog);
+        if (ok) {
+            run_program(prog, matrices);
+        }
+    }
+
+    if (!ok) {
+        out_printf("Error: Block discarded due to errors\n");
+    }
+    free_program(prog);
+}
+
+/* Free the lines of the block being collected */
+static void clear_block_lines(script_state *state) {
+    int i;
+
+    for (i = 0; i < state->block_length; i++) {
+        free(state->block_lines[i]);
+    }
+    state->block_length = 0;
+    state->depth = 0;
+    state->failed = 0;
+}
+
+/* Store a copy of a line of the block being collected */
+static int append_block_line(script_state *state, const char *line) {
+    char **grown;
+    int new_capacity;
+
+    if (state->block_length == state->block_capacity) {
+        new_capacity = state->block_capacity ? state->block_capacity * 2 : 16;
+        grown = (char**)realloc(state->block_lines, new_capacity * sizeof(char*));
+        if (!grown) {
+            out_printf("Error: Memory allocation failed for block\n");
+            return 0;
+        }
+        state->block_lines = grown;
+        state->block_capacity = new_capacity;
+    }
+
+    state->block_lines[state->block_length] = (char*)malloc(strlen(line) + 1);
+    if (!state->block_lines[state->block_length]) {
+        out_printf("Error: Memory allocation failed for block\n");
+        return 0;
+    }
+    strcpy(state->block_lines[state->block_length], line);
+    state->block_length++;
+    return 1;
+}
+
+/* Initialize block collection state */
+void init_script_state(script_state *state) {
+    state->block_lines = NULL;
+    state->block_length = 0;
+    state->block_capacity = 0;
+    state->depth = 0;
+    state->failed = 0;
+    state->macro_count = 0;
+}
+
+/* Free collected lines and macros */
+void free_script_state(script_state *state) {
+    int i;
+
+    if (!state) return;
+
+    if (state->depth > 0) {
+        out_printf("Error: Unterminated block at end of input\n");
+    }
+    clear_block_lines(state);
+    free(state->block_lines);
+    state->block_lines = NULL;
+    state->block_capacity = 0;
+
+    for (i = 0; i < state->macro_count; i++) {
+        free_program(state->macros[i].body);
+    }
+    state->macro_count = 0;
+}
+
+/* Check whether a line belongs to the block syntax rather than being a command */
+int is_script_line(const char *line) {
+    line_words words;
+    return line && classify_line(line, &words) != LINE_COMMAND;
+}
+
+/* Check the header of a block opener before its block is collected; nested macros are
+ * rejected when the block is compiled, so only their syntax is checked here */
+static int is_valid_opener(script_state *state, line_kind kind, const line_words *words) {
+    long count;
+
+    if (kind == LINE_REPEAT) return parse_repeat_header(words, &count);
+    if (state->depth == 0) return parse_macro_header(state, words);
+    if (words->count != 3 || strcmp(words->word[2], "{") != 0) {
+        out_printf("Error: Invalid block syntax, expected 'macro NAME {'\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* Check whether an opener line ends in '{' and so starts a block, valid or not */
+static int opens_block(const line_words *words) {
+    return words->count > 0 && strcmp(words->word[words->count - 1], "{") == 0;
+}
+
+/* Consume block constructs and lines inside blocks. A block with an error anywhere in
+ * it, including a bad nested opener or closer, is still collected to its matching '}'
+ * so its body never runs at top level, and is then discarded as a whole. */
+int handle_script_line(script_state *state, const char *line, mat matrices[MAT_COUNT]) {
+    line_words words;
+    line_kind kind;
+    macro_def *macro;
+    int valid = 1;
+
+    if (!state || !line) return 0;
+
+    kind = classify_line(line, &words);
+
+    if (kind == LINE_END && words.count > 1) {
+        out_printf("Error: Extraneous text after '}'\n");
+        valid = 0;
+    }
+
+    if (state->depth == 0) {
+        switch (kind) {
+            case LINE_COMMAND:
+                return 0;
+            case LINE_END:
+                if (valid) out_printf("Error: Unmatched '}'\n");
+                return 1;
+            case LINE_CALL:
+                macro = parse_call(state, &words);
+                if (macro) {
+                    run_program(macro->body, matrices);
+                }
+                return 1;
+            default:
+                break; /* Block opener, start collecting */
+        }
+    }
+
+    if (kind == LINE_REPEAT || kind == LINE_MACRO) {
+        valid = is_valid_opener(state, kind, &words);
+        /* An opener without '{' has no body; outside a block it is just an error */
+        if (!opens_block(&words)) {
+            if (state->depth > 0) state->failed = 1;
+            return 1;
+        }
+    }
+    if (!valid) state->failed = 1;
+
+    /* The lines of a failed block are only counted, not stored */
+    if (!state->failed && !append_block_line(state, line)) {
+        state->failed = 1;
+    }
+
+    if (kind == LINE_REPEAT || kind == LINE_MACRO) {
+        state->depth++;
+    } else if (kind == LINE_END) {
+        state->depth--;
+        if (state->depth == 0) {
+            if (state->failed) {
+                out_printf("Error: Block discarded due to errors\n");
+            } else {
+                finish_block(state, matrices);
+            }
+            clear_block_lines(state);
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,173 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "mymat.h"
+#include "command_queue.h"
+
+#define MAX_BLOCK_DEPTH 16   /* Maximum nesting of repeat blocks */
+#define MAX_MACROS 64        /* Maximum number of macro definitions */
+#define MAX_MACRO_NAME 32    /* Maximum macro name length including terminator */
+
+/* Operation codes for compiled commands */
+typedef enum opcode {
+    OP_READ_MAT,
+    OP_PRINT_MAT,
+    OP_ADD_MAT,
+    OP_SUB_MAT,
+    OP_MUL_MAT,
+    OP_MUL_SCALAR,
+    OP_TRANS_MAT,
+    OP_STATS,
+    OP_OUTPUT_MODE,
+    OP_LOAD_MAT,
+    OP_SAVE_MAT,
+    OP_SAVE_STATE,
+    OP_LOAD_STATE,
+    OP_RAND_MAT,
+    OP_IDENT_MAT,
+    OP_FILL_MAT,
+    OP_COPY_MAT,
+    OP_TRANSFORM_POINTS,
+    OP_MUL_MAT_SW,
+    OP_SUM_MAT,
+    OP_TRACE_MAT,
+    OP_NORM_MAT,
+    OP_REPEAT,
+    OP_CALL
+} opcode;
+
+struct program;
+
+/* A validated command with all operands resolved, ready to execute */
+typedef struct instruction {
+    opcode op;                    /* Operation to perform */
+    int regs[3];                  /* Register indices: sources first, target last */
+    double scalar;                /* Scalar operand for mul_scalar, value for fill_mat */
+    unsigned long seed;           /* Seed for rand_mat */
+    int print_mode;               /* output_mode for OP_PRINT_MAT (-1: thread's current mode) and OP_OUTPUT_MODE */
+    double values[16];            /* Parsed values for read_mat */
+    int value_count;              /* Number of valid entries in values */
+    int has_extra;                /* Non-zero if read_mat received more than 16 values */
+    int failed;                   /* Non-zero if read_mat stopped at an invalid value */
+    char *path;                   /* File name for the file operations (owned) */
+    char *out_path;               /* Output file of transform_points (owned) */
+    int thread_count;             /* Threads for transform_points */
+    int norm_kind;                /* norm_kind for OP_NORM_MAT */
+    long repeat_count;            /* Iteration count for OP_REPEAT */
+    struct program *body;         /* Block body for OP_REPEAT (owned) and OP_CALL (borrowed) */
+} instruction;
+
+/* Structure for a compiled sequence of instructions */
+typedef struct program {
+    instruction *code;            /* Dynamic array of instructions */
+    int length;                   /* Number of instructions in use */
+    int capacity;                 /* Allocated number of instructions */
+} program;
+
+/* Structure for a named macro */
+typedef struct macro_def {
+    char name[MAX_MACRO_NAME];    /* Macro name used by "call" */
+    program *body;                /* Compiled macro body */
+} macro_def;
+
+/* Structure for block collection state and macro definitions */
+typedef struct script_state {
+    char **block_lines;           /* Raw lines of the block being collected */
+    int block_length;             /* Number of collected lines */
+    int block_capacity;           /* Allocated number of line slots */
+    int depth;                    /* Current nesting depth, 0 outside of blocks */
+    int failed;                   /* Non-zero if the block being collected is discarded at its end */
+    macro_def macros[MAX_MACROS]; /* Defined macros */
+    int macro_count;              /* Number of defined macros */
+} script_state;
+
+/* Function called with every instruction just before run_program executes it, or NULL;
+ * used to record command traces and to track register dataflow in watch mode */
+extern void (*instruction_hook)(const instruction *instr);
+
+/**
+ * @brief Initializes an empty program
+ * @param prog Program to initialize
+ */
+void init_program(program *prog);
+
+/**
+ * @brief Removes all instructions from a program but keeps its storage for reuse
+ * @param prog Program to reset
+ * @note Owned repeat bodies and file names are freed
+ */
+void reset_program(program *prog);
+
+/**
+ * @brief Frees all instructions of a program, including owned repeat bodies
+ * @param prog Program to clear
+ * @note The program is left empty and can be reused
+ */
+void clear_program(program *prog);
+
+/**
+ * @brief Allocates and initializes an empty program
+ * @return Pointer to the new program, or NULL on allocation failure
+ */
+program* create_program(void);
+
+/**
+ * @brief Frees a program created with create_program
+ * @param prog Program to free
+ */
+void free_program(program *prog);
+
+/**
+ * @brief Translates a parsed and validated command into instructions
+ * @param command_name Name of the command (must not be "stop")
+ * @param args Validated argument list of the command
+ * @param prog Program the instructions are appended to
+ * @return 1 on success, 0 on failure
+ * @note print_mat and print_as produce one instruction per matrix name
+ * @note A read_mat with an invalid value is still emitted with its failed flag set,
+ *       so that the values before the error are stored just like read_mat does
+ * @warning Caller must validate the arguments with validate_command_arguments first
+ */
+int compile_command(const char *command_name, arg_list *args, program *prog);
+
+/**
+ * @brief Executes a compiled program against the matrix registers
+ * @param prog Program to execute
+ * @param matrices Array of matrices (MAT_A through MAT_F)
+ * @note Produces exactly the output of the equivalent unrolled script
+ */
+void run_program(const program *prog, mat matrices[MAT_COUNT]);
+
+/**
+ * @brief Initializes block collection state with no macros defined
+ * @param state Script state to initialize
+ */
+void init_script_state(script_state *state);
+
+/**
+ * @brief Frees collected lines and macro definitions
+ * @param state Script state to clean up
+ * @note Reports an error if the input ended inside an unterminated block
+ */
+void free_script_state(script_state *state);
+
+/**
+ * @brief Checks whether a line is a block construct rather than an ordinary command
+ * @param line Input line
+ * @return 1 for "repeat N {", "macro NAME {", "}" and "call NAME" lines, 0 otherwise
+ */
+int is_script_line(const char *line);
+
+/**
+ * @brief Handles the block constructs of the command language
+ * @param state Script state holding the current block and macros
+ * @param line Input line
+ * @param matrices Array of matrices (MAT_A through MAT_F)
+ * @return 1 if the line was consumed by the block handler, 0 if it is an ordinary command
+ * @note Supports "repeat N {", "macro NAME {", "}" and "call NAME"
+ * @note A block is compiled and validated once when its closing brace is read;
+ *       a block containing any error is discarded as a whole
+ */
+int handle_script_line(script_state *state, const char *line, mat matrices[MAT_COUNT]);
+
+#endif /* PROGRAM_H */
@@ -0,0 +1,299 @@
+#include "replay.h"
+#include "output.h"
+#include "points.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define REPLAY_MAGIC "MATREC"        /* Trace magic, stored with two terminators */
+#define REPLAY_MAGIC_LENGTH 8
+#define REPLAY_HEADER_BYTES (REPLAY_MAGIC_LENGTH + 4 + sizeof(double))
+#define RECORD_BUFFER_SIZE 65536
+#define NO_MODE 255                  /* Mode byte of a print_mat using the current mode */
+#define SEED_BYTES 8                 /* rand_mat seeds are stored as 64-bit little-endian */
+
+static FILE *record_file = NULL;
+static const double BYTE_ORDER_MARK = 1.0;
+
+/* Start a trace file with its header */
+int record_start(const char *path) {
+    unsigned long version = REPLAY_FORMAT_VERSION;
+    unsigned char header[REPLAY_HEADER_BYTES];
+
+    record_file = fopen(path, "wb");
+    if (!record_file) {
+        out_printf("Error: Cannot write file '%s'\n", path);
+        return 0;
+    }
+    setvbuf(record_file, NULL, _IOFBF, RECORD_BUFFER_SIZE);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, REPLAY_MAGIC, strlen(REPLAY_MAGIC));
+    header[8] = (unsigned char)(version & 0xff);
+    header[9] = (unsigned char)(version >> 8 & 0xff);
+    memcpy(header + 12, &BYTE_ORDER_MARK, sizeof(double));
+    fwrite(header, 1, sizeof(header), record_file);
+
+    instruction_hook = record_instruction;
+    return 1;
+}
+
+/* Append the opcode, registers and operands of one instruction */
+void record_instruction(const instruction *instr) {
+    unsigned char head[4 + SEED_BYTES];
+    unsigned short length;
+    int size = 4, i;
+
+    head[0] = (unsigned char)instr->op;
+    head[1] = (unsigned char)instr->regs[0];
+    head[2] = (unsigned char)instr->regs[1];
+    head[3] = (unsigned char)instr->regs[2];
+
+    switch (instr->op) {
+        case OP_READ_MAT:
+            head[4] = (unsigned char)instr->value_count;
+            head[5] = (unsigned char)((instr->has_extra ? 1 : 0) | (instr->failed ? 2 : 0));
+            fwrite(head, 1, 6, record_file);
+            fwrite(instr->values, sizeof(double), instr->value_count, record_file);
+            return;
+        case OP_MUL_SCALAR:
+        case OP_FILL_MAT:
+            fwrite(head, 1, 4, record_file);
+            fwrite(&instr->scalar, sizeof(double), 1, record_file);
+            return;
+        case OP_RAND_MAT:
+            /* Low then high 32 bits; shifted in two steps in case unsigned long has 32 bits */
+            for (i = 0; i < 4; i++) {
+                head[4 + i] = (unsigned char)(instr->seed >> (8 * i) & 0xff);
+                head[8 + i] = (unsigned char)(instr->seed >> 16 >> 16 >> (8 * i) & 0xff);
+            }
+            size = 4 + SEED_BYTES;
+            break;
+        case OP_PRINT_MAT:
+        case OP_OUTPUT_MODE:
+            head[4] = (unsigned char)(instr->print_mode < 0 ? NO_MODE : instr->print_mode);
+            size = 5;
+            break;
+        case OP_NORM_MAT:
+            head[4] = (unsigned char)instr->norm_kind;
+            size = 5;
+            break;
+        case OP_LOAD_MAT:
+        case OP_SAVE_MAT:
+        case OP_SAVE_STATE:
+        case OP_LOAD_STATE:
+            length = (unsigned short)strlen(instr->path);
+            fwrite(head, 1, 4, record_file);
+            fwrite(&length, sizeof(length), 1, record_file);
+            fwrite(instr->path, 1, length, record_file);
+            return;
+        case OP_TRANSFORM_POINTS:
+            /* Thread count, then the input and output names, each with its length */
+            head[4] = (unsigned char)instr->thread_count;
+            fwrite(head, 1, 5, record_file);
+            length = (unsigned short)strlen(instr->path);
+            fwrite(&length, sizeof(length), 1, record_file);
+            fwrite(instr->path, 1, length, record_file);
+            length = (unsigned short)strlen(instr->out_path);
+            fwrite(&length, sizeof(length), 1, record_file);
+            fwrite(instr->out_path, 1, length, record_file);
+            return;
+        default:
+            break;
+    }
+    fwrite(head, 1, size, record_file);
+}
+
+/* Flush and close the trace file */
+void record_finish(void) {
+    if (!record_file) return;
+    instruction_hook = NULL;
+    if (fclose(record_file) != 0) {
+        out_printf("Error: Writing the command trace failed\n");
+    }
+    record_file = NULL;
+}
+
+/* Decode a length-prefixed file name at data + *size into a new string, advancing *size */
+static int decode_path(const unsigned char *data, size_t available, size_t *size, char **path) {
+    unsigned short length;
+
+    if (available < *size + sizeof(length)) return 0;
+    memcpy(&length, data + *size, sizeof(length));
+    *size += sizeof(length);
+    if (available < *size + length) return 0;
+    /* The program owns file names and frees them when it is reset */
+    *path = (char*)malloc(length + 1);
+    if (!*path) return 0;
+    memcpy(*path, data + *size, length);
+    (*path)[length] = '\0';
+    *size += length;
+    return 1;
+}
+
+/* Decode one record at data into instr; return its size, or 0 if it is invalid */
+static size_t decode_record(const unsigned char *data, size_t available, instruction *instr) {
+    unsigned long low = 0, high = 0;
+    size_t size = 4;
+    int i;
+
+    /* Cleared first, so a caller freeing the owned names of a rejected record never
+     * sees stale pointers */
+    memset(instr, 0, sizeof(instruction));
+    if (available < size) return 0;
+    instr->op = (opcode)data[0];
+    for (i = 0; i < 3; i++) {
+        instr->regs[i] = data[1 + i];
+        if (instr->regs[i] >= REGISTER_COUNT) return 0;
+    }
+
+    switch (instr->op) {
+        case OP_READ_MAT:
+            if (available < 6 || data[4] > 16) return 0;
+            instr->value_count = data[4];
+            instr->has_extra = data[5] & 1;
+            instr->failed = (data[5] & 2) != 0;
+            size = 6 + instr->value_count * sizeof(double);
+            if (available < size) return 0;
+            memcpy(instr->values, data + 6, instr->value_count * sizeof(double));
+            break;
+        case OP_MUL_SCALAR:
+        case OP_FILL_MAT:
+            size += sizeof(double);
+            if (available < size) return 0;
+            memcpy(&instr->scalar, data + 4, sizeof(double));
+            break;
+        case OP_RAND_MAT:
+            size += SEED_BYTES;
+            if (available < size) return 0;
+            for (i = 3; i >= 0; i--) {
+                low = low << 8 | data[4 + i];
+                high = high << 8 | data[8 + i];
+            }
+            instr->seed = low | high << 16 << 16;
+            /* A seed that does not fit this platform's unsigned long is invalid */
+            if ((instr->seed >> 16 >> 16) != high) return 0;
+            break;
+        case OP_PRINT_MAT:
+        case OP_OUTPUT_MODE:
+            size = 5;
+            if (available < size) return 0;
+            instr->print_mode = data[4] == NO_MODE ? -1 : data[4];
+            if (instr->print_mode > OUTPUT_EXACT ||
+                (instr->print_mode < 0 && instr->op == OP_OUTPUT_MODE)) return 0;
+            break;
+        case OP_NORM_MAT:
+            size = 5;
+            if (available < size || data[4] > NORM_INF) return 0;
+            instr->norm_kind = data[4];
+            break;
+        case OP_LOAD_MAT:
+        case OP_SAVE_MAT:
+        case OP_SAVE_STATE:
+        case OP_LOAD_STATE:
+            if (!decode_path(data, available, &size, &instr->path)) return 0;
+            break;
+        case OP_TRANSFORM_POINTS:
+            size = 5;
+            if (available < size || data[4] < 1 || data[4] > MAX_TRANSFORM_THREADS) return 0;
+            instr->thread_count = data[4];
+            if (!decode_path(data, available, &size, &instr->path) ||
+                !decode_path(data, available, &size, &instr->out_path)) return 0;
+            break;
+        case OP_ADD_MAT:
+        case OP_SUB_MAT:
+        case OP_MUL_MAT:
+        case OP_MUL_MAT_SW:
+        case OP_TRANS_MAT:
+        case OP_IDENT_MAT:
+        case OP_COPY_MAT:
+        case OP_SUM_MAT:
+        case OP_TRACE_MAT:
+        case OP_STATS:
+            break;
+        default:
+            return 0;
+    }
+    return size;
+}
+
+/* Run a mapped trace in batches of decoded instructions */
+static int replay_records(const unsigned char *data, size_t size, mat matrices[MAT_COUNT]) {
+    program batch;
+    size_t offset = REPLAY_HEADER_BYTES, used;
+    int ok = 1;
+
+    init_program(&batch);
+    batch.code = (instruction*)malloc(REPLAY_BATCH * sizeof(instruction));
+    if (!batch.code) {
+        out_printf("Error: Memory allocation failed for program\n");
+        return 0;
+    }
+    batch.capacity = REPLAY_BATCH;
+
+    while (ok && offset < size) {
+        while (batch.length < REPLAY_BATCH && offset < size) {
+            used = decode_record(data + offset, size - offset, &batch.code[batch.length]);
+            if (!used) {
+                out_printf("Error: Invalid command trace record at offset %lu\n", (unsigned long)offset);
+                free(batch.code[batch.length].path);
+                free(batch.code[batch.length].out_path);
+                ok = 0;
+                break;
+            }
+            batch.length++;
+            offset += used;
+        }
+        /* Records before an invalid one are still executed, like the recorded run */
+        run_program(&batch, matrices);
+        reset_program(&batch);
+    }
+
+    clear_program(&batch);
+    return ok;
+}
+
+/* Execute a command trace without parsing any text */
+int replay_file(const char *path, mat matrices[MAT_COUNT]) {
+    const unsigned char *data;
+    struct stat info;
+    int fd, ok;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0) {
+        out_printf("Error: Cannot read file '%s'\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    if ((size_t)info.st_size < REPLAY_HEADER_BYTES) {
+        out_printf("Error: '%s' is not a command trace\n", path);
+        close(fd);
+        return 0;
+    }
+
+    data = (const unsigned char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        out_printf("Error: Cannot read file '%s'\n", path);
+        return 0;
+    }
+    posix_madvise((void*)data, info.st_size, POSIX_MADV_SEQUENTIAL);
+
+    if (memcmp(data, REPLAY_MAGIC, strlen(REPLAY_MAGIC) + 1) != 0) {
+        out_printf("Error: '%s' is not a command trace\n", path);
+        ok = 0;
+    } else if ((data[8] | data[9] << 8) != REPLAY_FORMAT_VERSION ||
+               memcmp(data + 12, &BYTE_ORDER_MARK, sizeof(double)) != 0) {
+        out_printf("Error: Command trace '%s' was written by an incompatible build\n", path);
+        ok = 0;
+    } else {
+        ok = replay_records(data, info.st_size, matrices);
+    }
+
+    munmap((void*)data, info.st_size);
+    return ok;
+}
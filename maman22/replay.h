@@ -0,0 +1,54 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "program.h"
+
+#define REPLAY_FORMAT_VERSION 1      /* Bumped when a record layout changes; appended opcodes keep it */
+#define REPLAY_BATCH 4096            /* Instructions decoded before each run_program */
+
+/**
+ * @brief Starts recording every executed instruction to a binary command trace
+ * @param path Trace file to create
+ * @return 1 on success, 0 if the file cannot be created
+ * @note Installs record_instruction as the instruction_hook until record_finish
+ * @note Format: "MATREC\0\0", format version (uint32), the double 1.0 as a byte-order
+ *       mark; then per instruction its opcode and three register bytes followed by the
+ *       operands it uses: read_mat a value count, a flags byte (1: extra values,
+ *       2: failed) and the values; mul_scalar the scalar; print_mat and output_mode the
+ *       mode byte (255: current mode); file commands a uint16 length and the file name;
+ *       rand_mat the 64-bit seed as 8 little-endian bytes; fill_mat the value as a double;
+ *       transform_points a thread count byte, then the input and the output file name,
+ *       each as a uint16 length and the name; norm_mat the norm kind byte (0: fro, 1: 1,
+ *       2: inf).
+ *       Integers and doubles are otherwise in host byte order.
+ * @note New commands append opcodes without changing earlier records, so older traces
+ *       stay valid; a build that predates an opcode rejects it as an invalid record.
+ * @note Repeat and call blocks are recorded unrolled, as the instructions they execute
+ * @warning Recording is for single-threaded runs; it is not available in server mode
+ */
+int record_start(const char *path);
+
+/**
+ * @brief Appends one executed instruction to the command trace
+ * @param instr Instruction about to be executed (not a repeat or call block)
+ */
+void record_instruction(const instruction *instr);
+
+/**
+ * @brief Flushes and closes the command trace
+ * @note Does nothing if recording was not started
+ */
+void record_finish(void);
+
+/**
+ * @brief Executes a command trace written by record_start without any text parsing
+ * @param path Trace file, mapped into memory
+ * @param matrices Array of matrices (MAT_A through MAT_F)
+ * @return 1 if the whole trace was executed, 0 if it could not be read or is invalid
+ * @note Produces the output of the recorded run, except for errors that were reported
+ *       while the original script was parsed and validated
+ * @warning A trace is only accepted by a build with the same format version and byte order
+ */
+int replay_file(const char *path, mat matrices[MAT_COUNT]);
+
+#endif /* REPLAY_H */
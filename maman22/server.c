@@ -0,0 +1,502 @@
+#include "server.h"
+#include "commands.h"
+#include "output.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_EVENTS 64       /* Events handled per epoll_wait call */
+#define READ_CHUNK 4096     /* Bytes read from a client per readiness event */
+#define LINE_LIMIT 1024     /* Same line buffer size as process_commands */
+#define INPUT_LIMIT (1024 * 1024)    /* Pending input bytes at which a session stops being read */
+#define OUTPUT_LIMIT (1024 * 1024)   /* Unsent output bytes at which a session's input waits */
+
+/* Structure for one client connection and its private calculator state */
+typedef struct client_session {
+    int fd;                              /* Connected socket */
+    int slot;                            /* Index in the server's session table */
+    mat matrices[MAT_COUNT];             /* Registers of this session */
+    command_session commands;            /* Queue, block state and macros */
+    char *input;                         /* Received bytes not yet executed */
+    size_t input_length;                 /* Number of bytes in input */
+    size_t input_capacity;               /* Allocated size of input */
+    char *output;                        /* Produced bytes the client has not accepted yet */
+    size_t output_length;                /* Number of bytes in output */
+    size_t output_capacity;              /* Allocated size of output */
+    int busy;                            /* Queued for or running on a worker */
+    int polled;                          /* Registered with the event loop */
+    int eof;                             /* Client closed its end of the connection */
+    int stopped;                         /* "stop" was executed, further input is ignored */
+    output_mode mode;                    /* print_mat mode selected with output_mode */
+    struct client_session *next_ready;   /* Link in the server's ready queue */
+    pthread_mutex_t lock;                /* Protects input, output, busy, eof and stopped */
+} client_session;
+
+/* Structure for the shared server state */
+typedef struct server_state {
+    int listen_fd;                       /* Listening Unix domain socket */
+    int epoll_fd;                        /* Event loop instance */
+    client_session *sessions[MAX_SESSIONS]; /* All open sessions by slot */
+    int session_count;                   /* Number of open sessions */
+    client_session *ready_head;          /* Sessions with complete lines waiting for a worker */
+    client_session *ready_tail;
+    int shutting_down;                   /* Set when workers must exit */
+    pthread_mutex_t lock;                /* Protects the session table and ready queue */
+    pthread_cond_t ready_cond;           /* Signaled when a session becomes ready */
+} server_state;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/* Signal handler requesting a clean shutdown */
+static void handle_stop_signal(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
+
+/* Length of the next line as fgets with a LINE_LIMIT buffer would read it, 0 if incomplete */
+static size_t next_line_length(const char *data, size_t length, int at_eof) {
+    size_t i;
+
+    for (i = 0; i < length && i < LINE_LIMIT - 1; i++) {
+        if (data[i] == '\n') return i + 1;
+    }
+    if (i == LINE_LIMIT - 1 || (at_eof && length > 0)) return i;
+    return 0;
+}
+
+/* Number of leading bytes of the session input that form complete lines, stopping once
+ * limit is reached; the first complete line is always included */
+static size_t complete_input_length(client_session *session, size_t limit) {
+    size_t total = 0, line;
+
+    while (total < limit &&
+           (line = next_line_length(session->input + total, session->input_length - total,
+                                    session->eof)) > 0) {
+        total += line;
+    }
+    return total;
+}
+
+/* Append bytes to a session input or output buffer */
+static int append_bytes(char **buffer, size_t *length, size_t *capacity,
+                        const char *data, size_t count) {
+    char *grown;
+    size_t new_capacity;
+
+    if (*length + count > *capacity) {
+        new_capacity = *capacity ? *capacity : READ_CHUNK;
+        while (new_capacity < *length + count) new_capacity *= 2;
+        grown = (char*)realloc(*buffer, new_capacity);
+        if (!grown) return 0;
+        *buffer = grown;
+        *capacity = new_capacity;
+    }
+
+    memcpy(*buffer + *length, data, count);
+    *length += count;
+    return 1;
+}
+
+/* Create a session for a newly accepted connection */
+static client_session* create_client_session(int fd) {
+    client_session *session = (client_session*)calloc(1, sizeof(client_session));
+    int i;
+
+    if (!session) return NULL;
+
+    for (i = 0; i < MAT_COUNT; i++) {
+        session->matrices[i] = initialize_mat();
+    }
+    if (!init_command_session(&session->commands, session->matrices)) {
+        free(session);
+        return NULL;
+    }
+
+    session->fd = fd;
+    pthread_mutex_init(&session->lock, NULL);
+    return session;
+}
+
+/* Close the connection and free everything owned by the session */
+static void free_client_session(server_state *server, client_session *session) {
+    pthread_mutex_lock(&server->lock);
+    server->sessions[session->slot] = NULL;
+    server->session_count--;
+    pthread_mutex_unlock(&server->lock);
+
+    free_command_session(&session->commands);
+    close(session->fd);
+    free(session->input);
+    free(session->output);
+    pthread_mutex_destroy(&session->lock);
+    free(session);
+}
+
+/* Hand a session to the worker pool */
+static void schedule_session(server_state *server, client_session *session) {
+    pthread_mutex_lock(&server->lock);
+    session->next_ready = NULL;
+    if (server->ready_tail) {
+        server->ready_tail->next_ready = session;
+    } else {
+        server->ready_head = session;
+    }
+    server->ready_tail = session;
+    pthread_cond_signal(&server->ready_cond);
+    pthread_mutex_unlock(&server->lock);
+}
+
+/* Select the readiness events the event loop waits for, from the session state; the
+ * session lock must be held. Input is not read while it is over INPUT_LIMIT, unsent
+ * output waits for EPOLLOUT, and a finished session asks for EPOLLOUT so the event loop,
+ * the only place sessions are released, sees it promptly. A session waiting only for its
+ * worker is removed from the event loop, which would otherwise spin on a hangup. */
+static void update_events(server_state *server, client_session *session) {
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    if (!session->eof && session->input_length < INPUT_LIMIT) event.events |= EPOLLIN;
+    if (session->output_length > 0 || (session->eof && !session->busy)) event.events |= EPOLLOUT;
+    event.data.ptr = session;
+
+    if (event.events == 0) {
+        if (session->polled) epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+        session->polled = 0;
+    } else {
+        epoll_ctl(server->epoll_fd, session->polled ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                  session->fd, &event);
+        session->polled = 1;
+    }
+}
+
+/* Send as much pending output as the socket accepts without blocking; the session lock
+ * must be held. Output for a client that went away is dropped. */
+static void flush_output(client_session *session) {
+    ssize_t sent;
+    size_t done = 0;
+
+    while (done < session->output_length) {
+        sent = send(session->fd, session->output + done, session->output_length - done,
+                    MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) done = session->output_length;
+            break;
+        }
+        done += sent;
+    }
+    memmove(session->output, session->output + done, session->output_length - done);
+    session->output_length -= done;
+
+    if (session->stopped && session->output_length == 0) {
+        /* Let the event loop see the end of the connection */
+        shutdown(session->fd, SHUT_RDWR);
+    }
+}
+
+/* Execute a batch of complete lines for a session and queue the output for the client */
+static void execute_lines(server_state *server, client_session *session,
+                          const char *data, size_t length) {
+    char line[LINE_LIMIT];
+    char *output = NULL;
+    size_t output_length = 0, line_length;
+    FILE *stream;
+
+    stream = open_memstream(&output, &output_length);
+    if (!stream) return;
+    set_output_stream(stream);
+    set_output_mode(session->mode);
+
+    while (length > 0 && !session->stopped) {
+        line_length = next_line_length(data, length, 1);
+        memcpy(line, data, line_length);
+        line[line_length] = '\0';
+        data += line_length;
+        length -= line_length;
+
+        TRACE_BEGIN(line);
+        if (!process_line(&session->commands, line)) {
+            pthread_mutex_lock(&session->lock);
+            session->stopped = 1;
+            pthread_mutex_unlock(&session->lock);
+        }
+        TRACE_END(line);
+    }
+
+    TRACE_BEGIN(flush);
+    session->mode = get_output_mode();
+    set_output_stream(NULL);
+    fclose(stream);
+    pthread_mutex_lock(&session->lock);
+    if (!append_bytes(&session->output, &session->output_length, &session->output_capacity,
+                      output, output_length)) {
+        fprintf(stderr, "Error: Memory allocation failed for client output\n");
+    }
+    flush_output(session);
+    update_events(server, session);
+    pthread_mutex_unlock(&session->lock);
+    free(output);
+    TRACE_END(flush);
+}
+
+/* Worker thread: run ready sessions until the server shuts down */
+static void* worker_main(void *arg) {
+    server_state *server = (server_state*)arg;
+    client_session *session;
+    char *batch;
+    size_t batch_length;
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (!server->ready_head && !server->shutting_down) {
+            pthread_cond_wait(&server->ready_cond, &server->lock);
+        }
+        if (server->shutting_down) {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        session = server->ready_head;
+        server->ready_head = session->next_ready;
+        if (!server->ready_head) server->ready_tail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        /* Drain the session, picking up lines that arrive while executing; a session
+         * whose client is not reading its output is resumed by the event loop */
+        for (;;) {
+            pthread_mutex_lock(&session->lock);
+            batch_length = session->stopped || session->output_length >= OUTPUT_LIMIT ? 0 :
+                           complete_input_length(session, READ_CHUNK);
+            if (batch_length == 0) {
+                session->busy = 0;
+                update_events(server, session);
+                pthread_mutex_unlock(&session->lock);
+                break;
+            }
+            batch = (char*)malloc(batch_length);
+            if (batch) {
+                memcpy(batch, session->input, batch_length);
+            }
+            memmove(session->input, session->input + batch_length,
+                    session->input_length - batch_length);
+            session->input_length -= batch_length;
+            update_events(server, session);
+            pthread_mutex_unlock(&session->lock);
+
+            if (batch) {
+                execute_lines(server, session, batch, batch_length);
+                free(batch);
+            }
+        }
+    }
+}
+
+/* Accept all pending connections */
+static void accept_clients(server_state *server) {
+    struct epoll_event event;
+    client_session *session;
+    int fd, slot;
+
+    for (;;) {
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) return; /* EAGAIN: no more pending connections */
+
+        pthread_mutex_lock(&server->lock);
+        for (slot = 0; slot < MAX_SESSIONS && server->sessions[slot]; slot++);
+        pthread_mutex_unlock(&server->lock);
+
+        session = slot < MAX_SESSIONS ? create_client_session(fd) : NULL;
+        if (!session) {
+            fprintf(stderr, "Error: Rejecting connection, session limit reached\n");
+            close(fd);
+            continue;
+        }
+        /* Workers queue output instead of waiting for a client that does not read */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        session->slot = slot;
+        pthread_mutex_lock(&server->lock);
+        server->sessions[slot] = session;
+        server->session_count++;
+        pthread_mutex_unlock(&server->lock);
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            free_client_session(server, session);
+        } else {
+            session->polled = 1;
+        }
+    }
+}
+
+/* Handle readiness of a client: send pending output, read available input, then
+ * schedule the session if it has complete lines or release it once it is finished */
+static void service_client(server_state *server, client_session *session, unsigned int events) {
+    char buffer[READ_CHUNK];
+    ssize_t received = 0;
+    int schedule = 0, release = 0;
+
+    pthread_mutex_lock(&session->lock);
+    if (session->output_length > 0 && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+        flush_output(session);
+    }
+
+    if (!session->eof && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        received = read(session->fd, buffer, sizeof(buffer));
+        if (received == 0 || (received < 0 && errno != EINTR && errno != EAGAIN)) {
+            session->eof = 1;
+        } else if (received > 0 && !session->stopped &&
+                   !append_bytes(&session->input, &session->input_length, &session->input_capacity,
+                                 buffer, received)) {
+            fprintf(stderr, "Error: Memory allocation failed for client input\n");
+        }
+    }
+
+    /* A busy session is drained by its worker, which also picks up these bytes */
+    if (!session->busy) {
+        if (!session->stopped && session->output_length < OUTPUT_LIMIT &&
+            complete_input_length(session, 1) > 0) {
+            session->busy = 1;
+            schedule = 1;
+        } else if (session->eof && session->output_length == 0) {
+            release = 1;
+        }
+    }
+    if (!release) update_events(server, session);
+    pthread_mutex_unlock(&session->lock);
+
+    if (schedule) {
+        schedule_session(server, session);
+    } else if (release) {
+        if (session->polled) epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+        free_client_session(server, session);
+    }
+}
+
+/* Create the listening socket */
+static int open_listen_socket(const char *socket_path) {
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path is too long\n");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/* Run the event loop until a stop signal arrives */
+int run_server(const char *socket_path, int worker_count) {
+    static server_state server;
+    struct epoll_event events[MAX_EVENTS];
+    struct epoll_event event;
+    struct sigaction action;
+    sigset_t stop_signals, previous_mask;
+    pthread_t workers[MAX_WORKER_COUNT];
+    client_session *session;
+    int ready, i, started = 0;
+
+    if (!socket_path || worker_count < 1 || worker_count > MAX_WORKER_COUNT) {
+        fprintf(stderr, "Error: Worker count must be between 1 and %d\n", MAX_WORKER_COUNT);
+        return 0;
+    }
+
+    memset(&server, 0, sizeof(server));
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready_cond, NULL);
+
+    server.listen_fd = open_listen_socket(socket_path);
+    if (server.listen_fd < 0) return 0;
+
+    server.epoll_fd = epoll_create(MAX_EVENTS);
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; /* NULL marks the listening socket */
+    if (server.epoll_fd < 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &event) < 0) {
+        perror("epoll");
+        close(server.listen_fd);
+        unlink(socket_path);
+        return 0;
+    }
+
+    /* Workers block the stop signals so they are delivered to the event loop */
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous_mask);
+    for (i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, &server) != 0) break;
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "Listening on %s with %d workers\n", socket_path, started);
+
+    while (!stop_requested && started > 0) {
+        ready = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+        for (i = 0; i < ready; i++) {
+            session = (client_session*)events[i].data.ptr;
+            if (!session) {
+                accept_clients(&server);
+            } else {
+                service_client(&server, session, events[i].events);
+            }
+        }
+    }
+
+    /* Stop the workers, then release the sessions they no longer reference */
+    pthread_mutex_lock(&server.lock);
+    server.shutting_down = 1;
+    pthread_cond_broadcast(&server.ready_cond);
+    pthread_mutex_unlock(&server.lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    for (i = 0; i < MAX_SESSIONS; i++) {
+        if (server.sessions[i]) {
+            free_client_session(&server, server.sessions[i]);
+        }
+    }
+
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    unlink(socket_path);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.ready_cond);
+    return started > 0;
+}
@@ -0,0 +1,25 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#define DEFAULT_WORKER_COUNT 4   /* Worker threads when --workers is not given */
+#define MAX_WORKER_COUNT 64      /* Upper bound for the worker pool */
+#define MAX_SESSIONS 1024        /* Maximum number of concurrent client sessions */
+
+/**
+ * @brief Runs the calculator as a daemon listening on a Unix domain socket
+ * @param socket_path Filesystem path of the socket (an existing socket file is replaced)
+ * @param worker_count Number of worker threads executing commands (1 to MAX_WORKER_COUNT)
+ * @return 1 on clean shutdown (SIGINT or SIGTERM), 0 if the server could not start
+ * @note Each connection is an independent session with its own MAT_A through MAT_F
+ *       and its own macros, speaking the same line protocol as standard input
+ * @note A single epoll loop receives input; complete lines are executed by a bounded
+ *       pool of worker threads, at most one worker per session so commands stay ordered
+ * @note Client sockets are non-blocking: output is queued per session and sent as the
+ *       client reads it. A session stops being read while 1 MiB of its input is pending,
+ *       and its input waits while 1 MiB of output is unsent, so a client that does not
+ *       read holds neither a worker nor unbounded memory.
+ * @note "stop" ends the session and closes the connection
+ */
+int run_server(const char *socket_path, int worker_count);
+
+#endif /* SERVER_H */
@@ -0,0 +1,198 @@
+#include "shared.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* One published value of a shared register */
+typedef struct shared_version {
+    mat value;                            /* Must stay first: callers only see &value */
+    unsigned long retire_epoch;           /* Epoch at which the version was replaced */
+    struct shared_version *next_retired;  /* Link in the list of versions awaiting reclamation */
+} shared_version;
+
+/* Per-thread reader state, padded to its own cache line */
+typedef struct reader_slot {
+    unsigned long active_epoch;           /* Epoch seen on entry, 0 outside a read-side section */
+    int in_use;                           /* Owned by a thread */
+    int nesting;                          /* Read-side section depth, touched only by the owner */
+    char padding[64 - sizeof(unsigned long) - 2 * sizeof(int)];
+} reader_slot;
+
+static shared_version *current_versions[SHARED_COUNT];
+static pthread_mutex_t writer_locks[SHARED_COUNT];
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static shared_version *retired_versions = NULL;
+static unsigned long global_epoch = 1;    /* 0 is reserved for "not reading" */
+static reader_slot reader_slots[MAX_READER_THREADS];
+static pthread_key_t reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+
+/* Give a thread's reader slot back when the thread exits */
+static void release_reader_slot(void *slot) {
+    __atomic_store_n(&((reader_slot*)slot)->active_epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&((reader_slot*)slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* Create the thread-specific key holding each thread's reader slot */
+static void create_reader_key(void) {
+    pthread_key_create(&reader_key, release_reader_slot);
+}
+
+/* Get the calling thread's reader slot, claiming a free one on first use */
+static reader_slot* get_reader_slot(void) {
+    reader_slot *slot;
+    int i, expected;
+
+    pthread_once(&reader_key_once, create_reader_key);
+    slot = (reader_slot*)pthread_getspecific(reader_key);
+    if (slot) return slot;
+
+    /* All slots taken: wait for a reader thread to exit */
+    for (;;) {
+        for (i = 0; i < MAX_READER_THREADS; i++) {
+            expected = 0;
+            if (__atomic_compare_exchange_n(&reader_slots[i].in_use, &expected, 1, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                slot = &reader_slots[i];
+                slot->nesting = 0;
+                pthread_setspecific(reader_key, slot);
+                return slot;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/* Smallest epoch any active reader entered with, 0 if no reader is active */
+static unsigned long oldest_reader_epoch(void) {
+    unsigned long oldest = 0, epoch;
+    int i;
+
+    for (i = 0; i < MAX_READER_THREADS; i++) {
+        epoch = __atomic_load_n(&reader_slots[i].active_epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && (oldest == 0 || epoch < oldest)) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+/* Free retired versions that no active reader can still see */
+static void reclaim_versions(void) {
+    shared_version **link, *version;
+    unsigned long oldest;
+
+    pthread_mutex_lock(&retired_lock);
+    oldest = oldest_reader_epoch();
+    link = &retired_versions;
+    while (*link) {
+        version = *link;
+        /* Readers that entered at or after the retire epoch already see the newer version */
+        if (oldest == 0 || version->retire_epoch <= oldest) {
+            *link = version->next_retired;
+            free(version);
+        } else {
+            link = &version->next_retired;
+        }
+    }
+    pthread_mutex_unlock(&retired_lock);
+}
+
+/* Create the shared registers */
+int init_shared_registers(void) {
+    int i;
+
+    for (i = 0; i < SHARED_COUNT; i++) {
+        current_versions[i] = (shared_version*)calloc(1, sizeof(shared_version));
+        if (!current_versions[i]) {
+            out_printf("Error: Failed to allocate memory for shared registers\n");
+            return 0;
+        }
+        current_versions[i]->value = initialize_mat();
+        pthread_mutex_init(&writer_locks[i], NULL);
+    }
+    return 1;
+}
+
+/* Free every version of the shared registers */
+void free_shared_registers(void) {
+    shared_version *version;
+    int i;
+
+    for (i = 0; i < SHARED_COUNT; i++) {
+        free(current_versions[i]);
+        current_versions[i] = NULL;
+        pthread_mutex_destroy(&writer_locks[i]);
+    }
+    while (retired_versions) {
+        version = retired_versions;
+        retired_versions = version->next_retired;
+        free(version);
+    }
+}
+
+/* Enter a read-side section */
+void shared_read_lock(void) {
+    reader_slot *slot = get_reader_slot();
+
+    if (slot->nesting++ == 0) {
+        /* Announce the epoch before loading any pointer (full barrier) */
+        __atomic_store_n(&slot->active_epoch, __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST),
+                         __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Leave a read-side section */
+void shared_read_unlock(void) {
+    reader_slot *slot = get_reader_slot();
+
+    if (--slot->nesting == 0) {
+        __atomic_store_n(&slot->active_epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Get the current version of a shared register */
+mat* shared_snapshot(int shared_index) {
+    if (shared_index < 0 || shared_index >= SHARED_COUNT) return NULL;
+    return &__atomic_load_n(&current_versions[shared_index], __ATOMIC_SEQ_CST)->value;
+}
+
+/* Lock a shared register for writing and return a private copy of it */
+mat* shared_write_begin(int shared_index) {
+    shared_version *version;
+
+    if (shared_index < 0 || shared_index >= SHARED_COUNT) return NULL;
+
+    version = (shared_version*)malloc(sizeof(shared_version));
+    if (!version) {
+        out_printf("Error: Failed to allocate memory for shared register update\n");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&writer_locks[shared_index]);
+    version->value = current_versions[shared_index]->value;
+    version->next_retired = NULL;
+    return &version->value;
+}
+
+/* Publish a new version and retire the old one */
+void shared_write_commit(int shared_index, mat *new_value) {
+    shared_version *version = (shared_version*)new_value;
+    shared_version *old;
+
+    if (shared_index < 0 || shared_index >= SHARED_COUNT || !version) return;
+
+    old = current_versions[shared_index];
+    __atomic_store_n(&current_versions[shared_index], version, __ATOMIC_SEQ_CST);
+    old->retire_epoch = __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&writer_locks[shared_index]);
+
+    pthread_mutex_lock(&retired_lock);
+    old->next_retired = retired_versions;
+    retired_versions = old;
+    pthread_mutex_unlock(&retired_lock);
+
+    reclaim_versions();
+}
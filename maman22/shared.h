@@ -0,0 +1,58 @@
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "mymat.h"
+
+#define MAX_READER_THREADS 256  /* Threads that may hold a read-side section at once */
+
+/**
+ * @brief Creates the shared registers SHR_A through SHR_F, all set to zero
+ * @return 1 on success, 0 on allocation failure
+ * @note Must be called once before any thread uses shared registers
+ */
+int init_shared_registers(void);
+
+/**
+ * @brief Frees all versions of the shared registers
+ * @warning No thread may be using shared registers when this is called
+ */
+void free_shared_registers(void);
+
+/**
+ * @brief Enters a read-side section on the calling thread
+ * @note Never blocks and never takes a lock; sections may be nested
+ * @note Snapshots obtained inside the section stay valid until the matching shared_read_unlock
+ */
+void shared_read_lock(void);
+
+/**
+ * @brief Leaves a read-side section on the calling thread
+ */
+void shared_read_unlock(void);
+
+/**
+ * @brief Gets the currently published version of a shared register
+ * @param shared_index Index of the shared register (0 for SHR_A through SHARED_COUNT - 1)
+ * @return Read-only pointer to the current version, or NULL if the index is invalid
+ * @warning Must be called inside a read-side section, and the matrix must not be modified
+ */
+mat* shared_snapshot(int shared_index);
+
+/**
+ * @brief Starts an update of a shared register
+ * @param shared_index Index of the shared register
+ * @return Private copy of the current version to be modified, or NULL on failure
+ * @note Serializes with other writers of the same register until shared_write_commit
+ */
+mat* shared_write_begin(int shared_index);
+
+/**
+ * @brief Publishes a version created with shared_write_begin
+ * @param shared_index Index of the shared register
+ * @param version Matrix returned by shared_write_begin
+ * @note Readers switch to the new version atomically; the old version is reclaimed
+ *       once no read-side section that could still see it is active
+ */
+void shared_write_commit(int shared_index, mat *version);
+
+#endif /* SHARED_H */
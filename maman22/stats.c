@@ -0,0 +1,155 @@
+#include "stats.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *COMMAND_NAMES[STATS_COMMAND_COUNT] = {
+    "read_mat", "print_mat", "add_mat", "sub_mat", "mul_mat", "mul_scalar", "trans_mat",
+    "mul_mat_sw", "rand_mat", "ident_mat", "fill_mat", "copy_mat", "print_as", "output_mode",
+    "load_mat", "save_mat", "save_state", "load_state", "transform_points", "sum_mat",
+    "trace_mat", "norm_mat", "stats", "stop", "other"
+};
+
+/* Get the name of a statistics command type */
+const char* stats_command_name(stats_command command) {
+    return COMMAND_NAMES[command];
+}
+
+/* Map a command name to its statistics command type */
+stats_command stats_command_index(const char *command_name) {
+    int i;
+
+    if (!command_name) return STATS_OTHER;
+    for (i = 0; i < STATS_OTHER; i++) {
+        if (strcmp(command_name, COMMAND_NAMES[i]) == 0) return (stats_command)i;
+    }
+    return STATS_OTHER;
+}
+
+#ifdef MYMAT_STATS
+
+/* Log-bucketed histogram of the durations of one command and stage */
+typedef struct stage_histogram {
+    unsigned long buckets[STATS_BUCKETS];
+    unsigned long count;
+    unsigned long total_ns;
+    unsigned long max_ns;
+} stage_histogram;
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {
+    "read", "parse", "validate", "compile", "execute", "output"
+};
+
+static stage_histogram histograms[STATS_COMMAND_COUNT][STAGE_COUNT];
+
+/* Current monotonic time in nanoseconds */
+double stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Add one duration to a histogram */
+void stats_record(stats_command command, stats_stage stage, double elapsed_ns) {
+    stage_histogram *histogram = &histograms[command][stage];
+    unsigned long ns = elapsed_ns > 0 ? (unsigned long)elapsed_ns : 0;
+    unsigned long max;
+    int bucket = 0;
+
+    /* Bucket is floor(log2(ns)), with 0 and 1 ns sharing the first bucket */
+    if (ns > 1) {
+        bucket = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(ns);
+        if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+    }
+
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->total_ns, ns, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, 1,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Estimate a percentile as the upper bound of the bucket containing it */
+static unsigned long estimate_percentile(const unsigned long *buckets, unsigned long count,
+                                         unsigned long max, double percent) {
+    unsigned long rank = (unsigned long)(count * percent / 100.0 + 0.5);
+    unsigned long seen = 0, bound;
+    int bucket;
+
+    if (rank < 1) rank = 1;
+    for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= rank) break;
+    }
+    bound = bucket + 1 < (int)(sizeof(unsigned long) * 8) ? 1UL << (bucket + 1) : max;
+    return bound < max ? bound : max;
+}
+
+/* Write the statistics table to a stream */
+static void write_statistics(FILE *stream) {
+    unsigned long buckets[STATS_BUCKETS];
+    unsigned long count, total, max;
+    int command, stage, bucket, printed = 0;
+
+    for (command = 0; command < STATS_COMMAND_COUNT; command++) {
+        for (stage = 0; stage < STAGE_COUNT; stage++) {
+            stage_histogram *histogram = &histograms[command][stage];
+
+            count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+            if (count == 0) continue;
+
+            total = __atomic_load_n(&histogram->total_ns, __ATOMIC_RELAXED);
+            max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+            for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+                buckets[bucket] = __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+            }
+
+            if (!printed) {
+                fprintf(stream, "%-16s %-9s %10s %10s %10s %10s %10s\n", "command", "stage",
+                        "count", "mean ns", "p50 ns", "p99 ns", "max ns");
+                printed = 1;
+            }
+            fprintf(stream, "%-16s %-9s %10lu %10lu %10lu %10lu %10lu\n", COMMAND_NAMES[command],
+                    STAGE_NAMES[stage], count, total / count,
+                    estimate_percentile(buckets, count, max, 50),
+                    estimate_percentile(buckets, count, max, 99), max);
+        }
+    }
+
+    if (!printed) {
+        fprintf(stream, "No statistics recorded\n");
+    }
+}
+
+/* Print the statistics to standard error */
+static void dump_statistics(void) {
+    write_statistics(stderr);
+}
+
+/* Print the statistics to the calling thread's output stream */
+void stats_print(void) {
+    write_statistics(get_output_stream());
+}
+
+/* Print the statistics to standard error at exit */
+void stats_dump_at_exit(void) {
+    atexit(dump_statistics);
+}
+
+#else
+
+/* Statistics were compiled out */
+void stats_print(void) {
+    out_printf("Note: Statistics are not available (build with -DMYMAT_STATS)\n");
+}
+
+/* Statistics were compiled out */
+void stats_dump_at_exit(void) {
+}
+
+#endif /* MYMAT_STATS */
@@ -0,0 +1,110 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* Processing stages timed for each command */
+typedef enum stats_stage {
+    STAGE_READ,        /* Reading the input line (fgets) */
+    STAGE_PARSE,       /* parse_line */
+    STAGE_VALIDATE,    /* validate_command_arguments */
+    STAGE_COMPILE,     /* compile_command */
+    STAGE_EXECUTE,     /* Matrix kernel */
+    STAGE_OUTPUT,      /* Formatting and writing output (print_mat, stats) */
+    STAGE_COUNT
+} stats_stage;
+
+/* Command types the stages are attributed to */
+typedef enum stats_command {
+    STATS_READ_MAT,
+    STATS_PRINT_MAT,
+    STATS_ADD_MAT,
+    STATS_SUB_MAT,
+    STATS_MUL_MAT,
+    STATS_MUL_SCALAR,
+    STATS_TRANS_MAT,
+    STATS_MUL_MAT_SW,
+    STATS_RAND_MAT,
+    STATS_IDENT_MAT,
+    STATS_FILL_MAT,
+    STATS_COPY_MAT,
+    STATS_PRINT_AS,
+    STATS_OUTPUT_MODE,
+    STATS_LOAD_MAT,
+    STATS_SAVE_MAT,
+    STATS_SAVE_STATE,
+    STATS_LOAD_STATE,
+    STATS_TRANSFORM_POINTS,
+    STATS_SUM_MAT,
+    STATS_TRACE_MAT,
+    STATS_NORM_MAT,
+    STATS_STATS,
+    STATS_STOP,
+    STATS_OTHER,       /* Block lines (repeat, macro, call, '}') and unidentified lines */
+    STATS_COMMAND_COUNT
+} stats_command;
+
+#define STATS_BUCKETS 40   /* Bucket b counts durations in [2^b, 2^(b+1)) nanoseconds */
+
+#ifdef MYMAT_STATS
+
+/* Timestamp type used by the STATS_* macros */
+typedef double stats_timer;
+
+/* Declares a timer; must be placed among the declarations of a block */
+#define STATS_TIMER(timer) stats_timer timer
+/* Starts (or restarts) a timer */
+#define STATS_START(timer) ((timer) = stats_now_ns())
+/* Records the time since the timer was started */
+#define STATS_RECORD(command, stage, timer) stats_record((command), (stage), stats_now_ns() - (timer))
+
+/**
+ * @brief Gets the current monotonic time
+ * @return Time in nanoseconds
+ */
+double stats_now_ns(void);
+
+/**
+ * @brief Adds one duration to the histogram of a command and stage
+ * @param command Command type the time is attributed to
+ * @param stage Processing stage
+ * @param elapsed_ns Duration in nanoseconds
+ * @note Thread-safe; counters are updated with relaxed atomics
+ */
+void stats_record(stats_command command, stats_stage stage, double elapsed_ns);
+
+#else
+
+/* Statistics compiled out: timers and records expand to nothing.
+ * The timer declaration becomes an empty struct tag declaration so it stays a declaration. */
+#define STATS_TIMER(timer) struct stats_disabled_timer
+#define STATS_START(timer) ((void)0)
+#define STATS_RECORD(command, stage, timer) ((void)0)
+
+#endif /* MYMAT_STATS */
+
+/**
+ * @brief Maps a command name to its statistics command type
+ * @param command_name Command name, may be NULL
+ * @return Matching command type, or STATS_OTHER
+ */
+stats_command stats_command_index(const char *command_name);
+
+/**
+ * @brief Gets the name of a command type
+ * @param command Command type
+ * @return The command name, or "other" for STATS_OTHER
+ */
+const char* stats_command_name(stats_command command);
+
+/**
+ * @brief Prints count, mean, estimated p50/p99 and maximum for every recorded command and stage
+ * @note Prints a note instead when the program was built without MYMAT_STATS
+ */
+void stats_print(void);
+
+/**
+ * @brief Arranges for the statistics to be printed to standard error when the program exits
+ * @note Does nothing when the program was built without MYMAT_STATS
+ */
+void stats_dump_at_exit(void);
+
+#endif /* STATS_H */
@@ -0,0 +1,151 @@
+#include "trace.h"
+#include <stdio.h>
+
+#ifdef MYMAT_TRACE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* One recorded begin or end event */
+typedef struct trace_event {
+    double timestamp_us;          /* Microseconds since trace_start */
+    const char *name;
+    char phase;
+} trace_event;
+
+/* Per-thread event ring, written only by its owner */
+typedef struct trace_ring {
+    trace_event events[TRACE_RING_SIZE];
+    unsigned long head;           /* Number of events ever written */
+    int thread_id;
+    struct trace_ring *next;      /* Link in the list of all rings */
+} trace_ring;
+
+int trace_enabled = 0;
+
+static char *trace_path = NULL;
+static double trace_origin_us;
+static trace_ring *rings = NULL;
+static int next_thread_id = 0;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+/* Current monotonic time in microseconds */
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Create the thread-specific key holding each thread's ring; rings outlive their threads */
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, NULL);
+}
+
+/* Get the calling thread's ring, creating and publishing it on first use */
+static trace_ring* get_ring(void) {
+    trace_ring *ring;
+
+    pthread_once(&ring_key_once, create_ring_key);
+    ring = (trace_ring*)pthread_getspecific(ring_key);
+    if (ring) return ring;
+
+    ring = (trace_ring*)calloc(1, sizeof(trace_ring));
+    if (!ring) return NULL;
+    ring->thread_id = __atomic_add_fetch(&next_thread_id, 1, __ATOMIC_RELAXED);
+
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+/* Append an event to the calling thread's ring */
+void trace_record(const char *name, char phase) {
+    trace_ring *ring = get_ring();
+    trace_event *event;
+
+    if (!ring) return;
+
+    event = &ring->events[ring->head & (TRACE_RING_SIZE - 1)];
+    event->timestamp_us = now_us() - trace_origin_us;
+    event->name = name;
+    event->phase = phase;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Start recording events */
+int trace_start(const char *path) {
+    trace_path = (char*)malloc(strlen(path) + 1);
+    if (!trace_path) {
+        fprintf(stderr, "Error: Memory allocation failed for trace path\n");
+        return 0;
+    }
+    strcpy(trace_path, path);
+
+    trace_origin_us = now_us();
+    trace_enabled = 1;
+    return 1;
+}
+
+/* Write all buffered events as Chrome trace-event JSON and free the rings */
+void trace_finish(void) {
+    trace_ring *ring, *next;
+    trace_event *event;
+    unsigned long head, first, i;
+    FILE *out;
+    int pid = (int)getpid();
+    int written = 0;
+
+    if (!trace_path) return;
+    trace_enabled = 0;
+
+    out = fopen(trace_path, "w");
+    if (!out) {
+        perror(trace_path);
+    } else {
+        fprintf(out, "{\"traceEvents\": [");
+    }
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = next) {
+        next = ring->next;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        /* Only the newest TRACE_RING_SIZE events survive a wrapped ring */
+        first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (i = first; out && i < head; i++) {
+            event = &ring->events[i & (TRACE_RING_SIZE - 1)];
+            fprintf(out, "%s\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+                    written++ ? "," : "", event->name, event->phase, event->timestamp_us,
+                    pid, ring->thread_id);
+        }
+        free(ring);
+    }
+    rings = NULL;
+
+    if (out) {
+        fprintf(out, "\n], \"displayTimeUnit\": \"ns\"}\n");
+        fclose(out);
+    }
+    free(trace_path);
+    trace_path = NULL;
+}
+
+#else
+
+/* Tracing was compiled out */
+int trace_start(const char *path) {
+    (void)path;
+    fprintf(stderr, "Error: Tracing is not available (build with -DMYMAT_TRACE)\n");
+    return 0;
+}
+
+/* Tracing was compiled out */
+void trace_finish(void) {
+}
+
+#endif /* MYMAT_TRACE */
@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_RING_SIZE 32768  /* Events kept per thread; a power of two, oldest are overwritten */
+
+/* USDT probes (provider "mymat", probes EVENT_begin/EVENT_end) for perf and bpftrace */
+#ifdef MYMAT_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE(event, phase) DTRACE_PROBE(mymat, event##_##phase)
+#else
+#define TRACE_PROBE(event, phase) ((void)0)
+#endif
+
+#ifdef MYMAT_TRACE
+
+/* Non-zero while events are being recorded (set by trace_start) */
+extern int trace_enabled;
+
+#define TRACE_RECORD(event, phase) (trace_enabled ? trace_record(#event, (phase)) : (void)0)
+
+/**
+ * @brief Appends an event to the calling thread's ring buffer
+ * @param name Event name; must be a string literal or otherwise outlive the trace
+ * @param phase 'B' for begin, 'E' for end
+ * @note Lock-free: each thread writes only its own ring
+ */
+void trace_record(const char *name, char phase);
+
+#else
+#define TRACE_RECORD(event, phase) ((void)0)
+#endif /* MYMAT_TRACE */
+
+/* Mark the begin and end of a traced span; event is a bare identifier such as parse */
+#define TRACE_BEGIN(event) do { TRACE_PROBE(event, begin); TRACE_RECORD(event, 'B'); } while (0)
+#define TRACE_END(event) do { TRACE_PROBE(event, end); TRACE_RECORD(event, 'E'); } while (0)
+
+/**
+ * @brief Starts recording events
+ * @param path File the Chrome trace-event JSON is written to by trace_finish
+ * @return 1 on success, 0 if tracing is not available in this build
+ */
+int trace_start(const char *path);
+
+/**
+ * @brief Stops recording and writes all buffered events as Chrome trace-event JSON
+ * @note Must be called after every traced thread has finished; does nothing if tracing was not started
+ */
+void trace_finish(void);
+
+#endif /* TRACE_H */
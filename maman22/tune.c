@@ -0,0 +1,296 @@
+#include "tune.h"
+#include "mymat.h"
+#include "commands.h"
+#include "output.h"
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define TUNE_SAMPLES 15            /* Timed samples per candidate; the median is used */
+#define TUNE_MUL_CALLS 20000       /* mul_mat or mul_mat_sw calls per sample */
+#define TUNE_THREAD_STARTS 50      /* Threads started and joined per sample */
+#define TUNE_SCRIPT_RUNS 50        /* Script runs per sample */
+#define TUNE_MARGIN 0.97           /* A candidate must beat the default by 3% to be chosen */
+
+/* Unroll factors accepted by set_mul_unroll, in the order they are measured */
+static const int MUL_UNROLL_CANDIDATES[] = { 1, 4, 16 };
+
+/* Cutoffs accepted by set_sw_cutoff, in the order they are measured */
+static const int SW_CUTOFF_CANDIDATES[] = { 1, 2, 4 };
+
+/* A small script like the ones run by --batch, used to price one batch job */
+static const char TUNE_SCRIPT[] =
+    "read_mat MAT_A, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16\n"
+    "read_mat MAT_B, 2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 2, 0, 0, 0, 0, 2\n"
+    "add_mat MAT_A, MAT_B, MAT_C\n"
+    "mul_mat MAT_C, MAT_A, MAT_D\n"
+    "mul_scalar MAT_D, 0.5, MAT_E\n"
+    "trans_mat MAT_E, MAT_F\n"
+    "print_mat MAT_F\n"
+    "stop\n";
+
+/* Current monotonic time in nanoseconds */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Order sample times for the median */
+static int compare_times(const void *left, const void *right) {
+    double a = *(const double*)left, b = *(const double*)right;
+    return (a > b) - (a < b);
+}
+
+/* Median of the sample times */
+static double median_time(double samples[TUNE_SAMPLES]) {
+    qsort(samples, TUNE_SAMPLES, sizeof(double), compare_times);
+    return samples[TUNE_SAMPLES / 2];
+}
+
+/* Median time of one call of a product command with the current settings */
+static double time_product(void (*multiply)(mat*, mat*, mat*)) {
+    double samples[TUNE_SAMPLES], start;
+    mat left, right, result;
+    int sample, i, j;
+    long call;
+
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            left.matrix[i][j] = i * 4 + j + 1;
+            right.matrix[i][j] = 0.25 * (j * 4 + i) - 1;
+        }
+    }
+    left.version = right.version = result.version = 0;
+
+    multiply(&left, &right, &result);   /* Warm up */
+    for (sample = 0; sample < TUNE_SAMPLES; sample++) {
+        start = now_ns();
+        for (call = 0; call < TUNE_MUL_CALLS; call++) {
+            multiply(&left, &right, &result);
+        }
+        samples[sample] = (now_ns() - start) / TUNE_MUL_CALLS;
+    }
+    return median_time(samples);
+}
+
+/* Thread body for pricing a thread start */
+static void* empty_thread(void *arg) {
+    return arg;
+}
+
+/* Median time of starting and joining one thread */
+static double time_thread_start(void) {
+    double samples[TUNE_SAMPLES], start;
+    pthread_t thread;
+    int sample, i, started;
+
+    for (sample = 0; sample < TUNE_SAMPLES; sample++) {
+        started = 0;
+        start = now_ns();
+        for (i = 0; i < TUNE_THREAD_STARTS; i++) {
+            if (pthread_create(&thread, NULL, empty_thread, NULL) != 0) continue;
+            pthread_join(thread, NULL);
+            started++;
+        }
+        samples[sample] = started ? (now_ns() - start) / started : 0;
+    }
+    return median_time(samples);
+}
+
+/* Median time of running TUNE_SCRIPT with fresh registers, or 0 if it cannot be run */
+static double time_script(void) {
+    double samples[TUNE_SAMPLES], start;
+    mat matrices[MAT_COUNT];
+    FILE *input, *output;
+    int sample, run, i;
+
+    output = fopen("/dev/null", "w");
+    if (!output) return 0;
+    set_output_stream(output);
+    set_output_mode(OUTPUT_TEXT);
+
+    for (sample = 0; sample < TUNE_SAMPLES; sample++) {
+        start = now_ns();
+        for (run = 0; run < TUNE_SCRIPT_RUNS; run++) {
+            input = fmemopen((void*)TUNE_SCRIPT, strlen(TUNE_SCRIPT), "r");
+            if (!input) break;
+            for (i = 0; i < MAT_COUNT; i++) {
+                matrices[i] = initialize_mat();
+            }
+            process_stream(input, matrices);
+            fclose(input);
+        }
+        samples[sample] = run ? (now_ns() - start) / run : 0;
+    }
+
+    set_output_stream(stdout);
+    fclose(output);
+    return median_time(samples);
+}
+
+/* Pick the mul_mat kernel, reporting every candidate */
+static int tune_mul_unroll(void) {
+    double times[sizeof(MUL_UNROLL_CANDIDATES) / sizeof(MUL_UNROLL_CANDIDATES[0])];
+    double default_time = 0, best_time;
+    int count = sizeof(times) / sizeof(times[0]);
+    int best = MUL_UNROLL_DEFAULT, i;
+
+    for (i = 0; i < count; i++) {
+        set_mul_unroll(MUL_UNROLL_CANDIDATES[i]);
+        times[i] = time_product(mul_mat);
+        if (MUL_UNROLL_CANDIDATES[i] == MUL_UNROLL_DEFAULT) default_time = times[i];
+        fprintf(stderr, "tune: mul_mat unroll %-2d  %8.2f ns\n", MUL_UNROLL_CANDIDATES[i], times[i]);
+    }
+
+    /* Timing noise must not move the choice away from the default */
+    best_time = default_time * TUNE_MARGIN;
+    for (i = 0; i < count; i++) {
+        if (times[i] < best_time) {
+            best = MUL_UNROLL_CANDIDATES[i];
+            best_time = times[i];
+        }
+    }
+    set_mul_unroll(best);
+    return best;
+}
+
+/* Pick the mul_mat_sw cutoff, reporting every candidate; run after tune_mul_unroll,
+ * since the largest cutoff uses the mul_mat kernel */
+static int tune_sw_cutoff(void) {
+    double times[sizeof(SW_CUTOFF_CANDIDATES) / sizeof(SW_CUTOFF_CANDIDATES[0])];
+    double default_time = 0, best_time;
+    int count = sizeof(times) / sizeof(times[0]);
+    int best = SW_CUTOFF_DEFAULT, i;
+
+    for (i = 0; i < count; i++) {
+        set_sw_cutoff(SW_CUTOFF_CANDIDATES[i]);
+        times[i] = time_product(mul_mat_sw);
+        if (SW_CUTOFF_CANDIDATES[i] == SW_CUTOFF_DEFAULT) default_time = times[i];
+        fprintf(stderr, "tune: mul_mat_sw cutoff %d %8.2f ns\n", SW_CUTOFF_CANDIDATES[i], times[i]);
+    }
+
+    best_time = default_time * TUNE_MARGIN;
+    for (i = 0; i < count; i++) {
+        if (times[i] < best_time) {
+            best = SW_CUTOFF_CANDIDATES[i];
+            best_time = times[i];
+        }
+    }
+    set_sw_cutoff(best);
+    return best;
+}
+
+/* Pick the number of batch scripts that justifies starting a worker thread */
+static int tune_batch_jobs_per_worker(void) {
+    double thread_ns = time_thread_start();
+    double script_ns = time_script();
+    int jobs = 1;
+
+    fprintf(stderr, "tune: thread start+join  %8.2f ns\n", thread_ns);
+    fprintf(stderr, "tune: typical script     %8.2f ns\n", script_ns);
+    if (script_ns > 0 && thread_ns > script_ns) {
+        jobs = thread_ns / script_ns + 0.999;
+        if (jobs > MAX_JOBS_PER_WORKER) jobs = MAX_JOBS_PER_WORKER;
+    }
+    set_batch_jobs_per_worker(jobs);
+    return jobs;
+}
+
+/* Write the tuning file next to its final name and rename it into place */
+static int write_tune_file(const char *path, int mul_unroll, int sw_cutoff, int jobs_per_worker) {
+    char *temp_path;
+    FILE *file;
+    int ok;
+
+    temp_path = (char*)malloc(strlen(path) + 5);
+    if (!temp_path) {
+        out_printf("Error: Memory allocation failed for tuning file\n");
+        return 0;
+    }
+    sprintf(temp_path, "%s.tmp", path);
+
+    file = fopen(temp_path, "w");
+    ok = file != NULL;
+    if (ok) {
+        fprintf(file, "# Written by mainmat --tune for this machine\n");
+        fprintf(file, "mul_unroll %d\n", mul_unroll);
+        fprintf(file, "sw_cutoff %d\n", sw_cutoff);
+        fprintf(file, "batch_jobs_per_worker %d\n", jobs_per_worker);
+        ok = fclose(file) == 0;
+    }
+    ok = ok && rename(temp_path, path) == 0;
+    if (!ok) {
+        remove(temp_path);
+        out_printf("Error: Cannot write tuning file '%s'\n", path);
+    }
+    free(temp_path);
+    return ok;
+}
+
+/* Get the tuning file named by the environment, or the default one */
+const char* tune_file_path(void) {
+    const char *path = getenv(TUNE_FILE_ENV);
+    return path && *path ? path : TUNE_FILE_DEFAULT;
+}
+
+/* Load a tuning file; every line is checked before any setting is applied */
+int load_tune_file(const char *path) {
+    char line[256], key[64];
+    int mul_unroll = get_mul_unroll();
+    int sw_cutoff = get_sw_cutoff();
+    int jobs_per_worker = get_batch_jobs_per_worker();
+    int value, line_number = 0, ok = 1;
+    char extra;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file) return 1;   /* No tuning file: keep the defaults */
+
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)) continue;
+
+        if (sscanf(line, "%63s %d %c", key, &value, &extra) != 2) {
+            ok = 0;
+        } else if (strcmp(key, "mul_unroll") == 0) {
+            mul_unroll = value;
+            ok = value == 1 || value == 4 || value == 16;
+        } else if (strcmp(key, "sw_cutoff") == 0) {
+            sw_cutoff = value;
+            ok = value == 1 || value == 2 || value == 4;
+        } else if (strcmp(key, "batch_jobs_per_worker") == 0) {
+            jobs_per_worker = value;
+            ok = value >= 1 && value <= MAX_JOBS_PER_WORKER;
+        } else {
+            ok = 0;
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Error: Invalid tuning file '%s' at line %d; using defaults\n",
+                path, line_number);
+        return 0;
+    }
+    set_mul_unroll(mul_unroll);
+    set_sw_cutoff(sw_cutoff);
+    set_batch_jobs_per_worker(jobs_per_worker);
+    return 1;
+}
+
+/* Measure the tunable settings, apply the winners and save them */
+int run_autotune(const char *path) {
+    int mul_unroll = tune_mul_unroll();
+    int sw_cutoff = tune_sw_cutoff();
+    int jobs_per_worker = tune_batch_jobs_per_worker();
+
+    fprintf(stderr, "tune: chose mul_unroll %d, sw_cutoff %d, batch_jobs_per_worker %d\n",
+            mul_unroll, sw_cutoff, jobs_per_worker);
+    if (!write_tune_file(path, mul_unroll, sw_cutoff, jobs_per_worker)) return 0;
+    fprintf(stderr, "tune: wrote '%s'\n", path);
+    return 1;
+}
@@ -0,0 +1,36 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#define TUNE_FILE_DEFAULT "mainmat.tune"   /* Tuning file used when TUNE_FILE_ENV is not set */
+#define TUNE_FILE_ENV "MAINMAT_TUNE"       /* Environment variable naming the tuning file */
+
+/**
+ * @brief Gets the path of the tuning file
+ * @return The value of TUNE_FILE_ENV if set and not empty, else TUNE_FILE_DEFAULT
+ */
+const char* tune_file_path(void);
+
+/**
+ * @brief Loads a tuning file and applies its settings
+ * @param path Tuning file written by run_autotune
+ * @return 1 if the file was applied or does not exist, 0 if it is invalid
+ * @note Without a file the built-in defaults stay in effect. An invalid file is
+ *       reported on standard error and not applied at all.
+ * @note Format: one "key value" pair per line; lines starting with '#' are comments
+ */
+int load_tune_file(const char *path);
+
+/**
+ * @brief Benchmarks the tunable settings on this machine, applies the fastest and
+ *        writes them to a tuning file
+ * @param path Tuning file to write, replaced atomically
+ * @return 1 on success, 0 if the file cannot be written
+ * @note The measurements and the chosen settings are reported on standard error
+ * @note Candidates are the mul_mat unroll factors 1, 4 and 16 and the mul_mat_sw cutoffs
+ *       1, 2 and 4; a candidate replaces the default only if it is clearly faster. The
+ *       batch cutoff is the number of typical scripts that take as long to run as
+ *       starting and joining one thread.
+ */
+int run_autotune(const char *path);
+
+#endif /* TUNE_H */
@@ -0,0 +1,421 @@
+#include "watch.h"
+#include "commands.h"
+#include "program.h"
+#include "shared.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define LINE_CHUNK 1024                          /* Lines are split like process_commands reads them */
+#define ALL_REGISTERS ((1UL << REGISTER_COUNT) - 1)
+#define MODE_BIT (1UL << REGISTER_COUNT)          /* Dataflow bit of the output mode */
+
+/* Results of one script line from the latest run that reached it */
+typedef struct watch_line {
+    char *text;                   /* Line as read, including its newline */
+    char *output;                 /* Output the line produced */
+    size_t output_length;
+    unsigned long reads;          /* Registers (and MODE_BIT) the results depend on */
+    unsigned long writes;         /* Registers (and MODE_BIT) the line changes */
+    mat *values;                  /* Written registers after the line, in register order */
+    output_mode mode;             /* Output mode after the line */
+    int executed;                 /* The line was reached, so the fields above are valid */
+    int always_run;               /* Never reuse: blocks, calls, files, stats, stop */
+    int stops;                    /* The line is a stop command */
+} watch_line;
+
+/* All lines of one version of the watched file */
+typedef struct watch_script {
+    watch_line *lines;
+    int count;
+} watch_script;
+
+/* Dataflow of the line being executed, collected by track_instruction */
+static unsigned long line_reads, line_writes;
+static int line_side_effects;
+
+/* Bit of a register in the dataflow masks */
+static unsigned long register_bit(int index) {
+    return 1UL << index;
+}
+
+/* Instruction hook adding the registers an instruction reads and writes to the line's masks */
+static void track_instruction(const instruction *instr) {
+    unsigned long reads = 0, writes = 0;
+
+    switch (instr->op) {
+        case OP_READ_MAT:
+            writes = register_bit(instr->regs[0]);
+            /* Elements that are not given keep their previous values */
+            if (instr->failed || instr->value_count < 16) reads = writes;
+            break;
+        case OP_PRINT_MAT:
+            reads = register_bit(instr->regs[0]) | (instr->print_mode < 0 ? MODE_BIT : 0);
+            break;
+        case OP_ADD_MAT:
+        case OP_SUB_MAT:
+        case OP_MUL_MAT:
+        case OP_MUL_MAT_SW:
+            /* A kernel that fails leaves its target unchanged, so the target is an input too */
+            writes = register_bit(instr->regs[2]);
+            reads = register_bit(instr->regs[0]) | register_bit(instr->regs[1]) | writes;
+            break;
+        case OP_MUL_SCALAR:
+        case OP_TRANS_MAT:
+            writes = register_bit(instr->regs[1]);
+            reads = register_bit(instr->regs[0]) | writes;
+            break;
+        case OP_COPY_MAT:
+            writes = register_bit(instr->regs[1]);
+            reads = register_bit(instr->regs[0]);
+            break;
+        case OP_RAND_MAT:
+        case OP_IDENT_MAT:
+            writes = register_bit(instr->regs[0]);
+            break;
+        case OP_FILL_MAT:
+            /* A value that is not finite leaves the target unchanged */
+            writes = register_bit(instr->regs[0]);
+            if (isnan(instr->scalar) || isinf(instr->scalar)) reads = writes;
+            break;
+        case OP_SUM_MAT:
+        case OP_TRACE_MAT:
+        case OP_NORM_MAT:
+            reads = register_bit(instr->regs[0]) | MODE_BIT;
+            break;
+        case OP_OUTPUT_MODE:
+            writes = MODE_BIT;
+            break;
+        case OP_LOAD_MAT:
+            reads = writes = register_bit(instr->regs[0]);
+            line_side_effects = 1;
+            break;
+        case OP_SAVE_MAT:
+            reads = register_bit(instr->regs[0]);
+            line_side_effects = 1;
+            break;
+        case OP_SAVE_STATE:
+            reads = ALL_REGISTERS;
+            line_side_effects = 1;
+            break;
+        case OP_LOAD_STATE:
+            reads = writes = ALL_REGISTERS;
+            line_side_effects = 1;
+            break;
+        case OP_TRANSFORM_POINTS:
+            reads = register_bit(instr->regs[0]);
+            line_side_effects = 1;
+            break;
+        default:
+            line_side_effects = 1;
+            break;
+    }
+
+    /* Values produced earlier on the same line are not inputs of the line */
+    line_reads |= reads & ~line_writes;
+    line_writes |= writes;
+}
+
+/* Free the results of a line, keeping its text */
+static void clear_line_results(watch_line *line) {
+    free(line->output);
+    free(line->values);
+    line->output = NULL;
+    line->values = NULL;
+    line->output_length = 0;
+    line->executed = 0;
+}
+
+/* Free all lines of a script */
+static void free_script(watch_script *script) {
+    int i;
+
+    for (i = 0; i < script->count; i++) {
+        clear_line_results(&script->lines[i]);
+        free(script->lines[i].text);
+    }
+    free(script->lines);
+    script->lines = NULL;
+    script->count = 0;
+}
+
+/* Read a script file into lines split exactly like process_commands splits them */
+static int read_script(const char *path, watch_script *script) {
+    char buffer[LINE_CHUNK];
+    watch_line *grown;
+    FILE *file;
+    int capacity = 0;
+
+    script->lines = NULL;
+    script->count = 0;
+    file = fopen(path, "r");
+    if (!file) {
+        out_printf("Error: Cannot read file '%s'\n", path);
+        return 0;
+    }
+
+    while (fgets(buffer, sizeof(buffer), file)) {
+        if (script->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            grown = (watch_line*)realloc(script->lines, capacity * sizeof(watch_line));
+            if (!grown) break;
+            script->lines = grown;
+        }
+        memset(&script->lines[script->count], 0, sizeof(watch_line));
+        script->lines[script->count].text = (char*)malloc(strlen(buffer) + 1);
+        if (!script->lines[script->count].text) break;
+        strcpy(script->lines[script->count].text, buffer);
+        script->count++;
+    }
+
+    if (!feof(file)) {
+        out_printf("Error: Memory allocation failed for script '%s'\n", path);
+        fclose(file);
+        free_script(script);
+        return 0;
+    }
+    fclose(file);
+    return 1;
+}
+
+/* Set every private and shared register to zero and the output mode to text */
+static void reset_registers(mat matrices[MAT_COUNT]) {
+    mat *target;
+    int i;
+
+    for (i = 0; i < MAT_COUNT; i++) {
+        matrices[i] = initialize_mat();
+    }
+    for (i = 0; i < SHARED_COUNT; i++) {
+        target = shared_write_begin(i);
+        if (!target) continue;
+        *target = initialize_mat();
+        shared_write_commit(i, target);
+    }
+    set_output_mode(OUTPUT_TEXT);
+}
+
+/* Keep the values of the registers a line wrote */
+static void store_written(watch_line *line, mat matrices[MAT_COUNT]) {
+    int index, count = 0;
+
+    for (index = 0; index < REGISTER_COUNT; index++) {
+        if (line->writes & register_bit(index)) count++;
+    }
+    line->values = count ? (mat*)malloc(count * sizeof(mat)) : NULL;
+    if (count && !line->values) {
+        /* Without its values the line cannot be reused */
+        line->always_run = 1;
+        return;
+    }
+
+    count = 0;
+    shared_read_lock();
+    for (index = 0; index < REGISTER_COUNT; index++) {
+        if (line->writes & register_bit(index)) {
+            line->values[count++] = index < MAT_COUNT ? matrices[index] : *shared_snapshot(index - MAT_COUNT);
+        }
+    }
+    shared_read_unlock();
+    line->mode = get_output_mode();
+}
+
+/* Store the kept values of a reused line back into the registers */
+static void apply_written(const watch_line *line, mat matrices[MAT_COUNT]) {
+    mat *target;
+    int index, count = 0;
+
+    for (index = 0; index < REGISTER_COUNT; index++) {
+        if (!(line->writes & register_bit(index))) continue;
+
+        target = index < MAT_COUNT ? &matrices[index] : shared_write_begin(index - MAT_COUNT);
+        if (target) {
+            memcpy(target->matrix, line->values[count].matrix, sizeof(target->matrix));
+            touch_mat(target);
+            if (index >= MAT_COUNT) shared_write_commit(index - MAT_COUNT, target);
+        }
+        count++;
+    }
+    if (line->writes & MODE_BIT) {
+        set_output_mode(line->mode);
+    }
+}
+
+/* Check whether the values of the registers a line wrote were kept */
+static int has_values(const watch_line *line) {
+    return !(line->writes & ALL_REGISTERS) || line->values;
+}
+
+/* Registers whose value after the new run of a line may differ from the previous run */
+static unsigned long changed_registers(const watch_line *previous, const watch_line *line) {
+    unsigned long changed, both;
+    int index, old_count = 0, new_count = 0;
+
+    if (!previous || !previous->executed) {
+        return line->writes;
+    }
+    if (!has_values(previous) || !has_values(line)) {
+        return previous->writes | line->writes;
+    }
+
+    both = previous->writes & line->writes;
+    changed = previous->writes ^ line->writes;
+    for (index = 0; index < REGISTER_COUNT; index++) {
+        if ((both & register_bit(index)) &&
+            memcmp(previous->values[old_count].matrix, line->values[new_count].matrix,
+                   sizeof(line->values[0].matrix)) != 0) {
+            changed |= register_bit(index);
+        }
+        if (previous->writes & register_bit(index)) old_count++;
+        if (line->writes & register_bit(index)) new_count++;
+    }
+    if ((both & MODE_BIT) && previous->mode != line->mode) {
+        changed |= MODE_BIT;
+    }
+    return changed;
+}
+
+/* Execute one line through the session, collecting its output and dataflow */
+static void run_line(command_session *session, watch_line *line) {
+    char buffer[LINE_CHUNK];
+    FILE *stream = get_output_stream(), *capture;
+    int depth = session->script.depth;
+
+    line_reads = line_writes = 0;
+    line_side_effects = 0;
+    capture = open_memstream(&line->output, &line->output_length);
+    if (capture) set_output_stream(capture);
+
+    strcpy(buffer, line->text);
+    line->stops = !process_line(session, buffer);
+
+    if (capture) {
+        set_output_stream(stream);
+        fclose(capture);
+    }
+
+    line->executed = 1;
+    line->reads = line_reads;
+    line->writes = line_writes;
+    line->always_run = !capture || line_side_effects || line->stops || depth > 0 ||
+                       session->script.depth > 0 || is_script_line(line->text);
+    store_written(line, session->matrices);
+}
+
+/* Run a new version of the script, reusing results of the previous version where still valid */
+static void run_script(watch_script *previous, watch_script *script, mat matrices[MAT_COUNT],
+                       int *executed, int *reused) {
+    command_session session;
+    watch_line *line, *old;
+    char *text;
+    unsigned long dirty = 0;
+    int prefix = 0, suffix = 0, shift, stopped = 0, i, j;
+
+    /* The edited region lies between the longest unchanged prefix and suffix */
+    while (prefix < previous->count && prefix < script->count &&
+           strcmp(previous->lines[prefix].text, script->lines[prefix].text) == 0) {
+        prefix++;
+    }
+    while (suffix < previous->count - prefix && suffix < script->count - prefix &&
+           strcmp(previous->lines[previous->count - 1 - suffix].text,
+                  script->lines[script->count - 1 - suffix].text) == 0) {
+        suffix++;
+    }
+    shift = previous->count - script->count;
+
+    *executed = *reused = 0;
+    reset_registers(matrices);
+    if (!init_command_session(&session, matrices)) {
+        return;
+    }
+
+    for (i = 0; i < script->count && !stopped; i++) {
+        if (i == prefix) {
+            /* The previous results after the edit include the effects of the replaced lines */
+            for (j = prefix; j < previous->count - suffix; j++) {
+                if (previous->lines[j].executed) dirty |= previous->lines[j].writes;
+            }
+        }
+
+        line = &script->lines[i];
+        old = i < prefix ? &previous->lines[i] :
+              i >= script->count - suffix ? &previous->lines[i + shift] : NULL;
+
+        if (old && old->executed && !old->always_run && !(old->reads & dirty)) {
+            /* Take over the previous results; the registers end up exactly as before */
+            text = line->text;
+            *line = *old;
+            line->text = text;
+            old->output = NULL;
+            old->values = NULL;
+            apply_written(line, matrices);
+            dirty &= ~line->writes;
+            (*reused)++;
+        } else {
+            run_line(&session, line);
+            (*executed)++;
+            stopped = line->stops;
+            dirty = (dirty & ~(line->writes | (old ? old->writes : 0))) | changed_registers(old, line);
+        }
+
+        fwrite(line->output, 1, line->output_length, stdout);
+    }
+
+    free_command_session(&session);
+}
+
+/* Wait until the file's modification time or size changes */
+static void wait_for_change(const char *path, struct stat *last) {
+    struct timespec delay;
+    struct stat info;
+
+    delay.tv_sec = WATCH_POLL_MS / 1000;
+    delay.tv_nsec = (WATCH_POLL_MS % 1000) * 1000000L;
+    for (;;) {
+        nanosleep(&delay, NULL);
+        if (stat(path, &info) != 0) continue;
+        if (info.st_mtim.tv_sec != last->st_mtim.tv_sec || info.st_mtim.tv_nsec != last->st_mtim.tv_nsec ||
+            info.st_size != last->st_size) {
+            *last = info;
+            return;
+        }
+    }
+}
+
+/* Run a script and re-run it incrementally whenever it is modified */
+int watch_file(const char *path) {
+    watch_script previous, script;
+    mat matrices[MAT_COUNT];
+    struct stat last;
+    int run, executed, reused;
+
+    previous.lines = NULL;
+    previous.count = 0;
+    if (stat(path, &last) != 0) {
+        out_printf("Error: Cannot read file '%s'\n", path);
+        return 0;
+    }
+    if (!read_script(path, &script)) {
+        return 0;
+    }
+
+    instruction_hook = track_instruction;
+    for (run = 1; ; run++) {
+        run_script(&previous, &script, matrices, &executed, &reused);
+        fflush(stdout);
+        fprintf(stderr, "watch: run %d of '%s': %d of %d lines executed, %d reused\n",
+                run, path, executed, script.count, reused);
+
+        free_script(&previous);
+        previous = script;
+
+        /* A file caught in the middle of being rewritten is read again on the next change */
+        do {
+            wait_for_change(path, &last);
+        } while (!read_script(path, &script));
+    }
+}
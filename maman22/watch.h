@@ -0,0 +1,24 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "mymat.h"
+
+#define WATCH_POLL_MS 200      /* Interval between checks of the watched file */
+
+/**
+ * @brief Runs a script file, then re-runs it incrementally every time it changes
+ * @param path Script file to watch
+ * @return 0 if the file cannot be read at the start; otherwise does not return
+ *         until the process is interrupted
+ * @note Every run writes the complete output of the script to standard output and a
+ *       summary line to standard error. Each run starts from zero registers.
+ * @note The new version of the file is compared with the previous one: unchanged lines
+ *       before and after the edited region keep their results (register values and
+ *       output) as long as no register or output mode they read changed. The edited
+ *       lines and everything downstream of them in register dataflow run again.
+ * @note Block constructs and the lines inside them, calls, file commands, stats and
+ *       stop always run again
+ */
+int watch_file(const char *path);
+
+#endif /* WATCH_H */